@@ -1,20 +1,9 @@
 // Bindable function declarations ("commands").
 
-enum Direction {
-	UP    = (1<<0),
-	DOWN  = (1<<1),
-	LEFT  = (1<<2),
-	RIGHT = (1<<3),
-};
-
 enum Mouse {
 	BTNLEFT = Button1,
 	BTNMIDDLE = Button2,
 	BTNRIGHT = Button3,
-	SCROLLUP = 4,
-	SCROLLDOWN = 5,
-	SCROLLLEFT = 6,
-	SCROLLRIGHT = 7,
 };
 
 enum {
@@ -34,7 +23,8 @@ void togglegrabkeyboard(const Arg *ignored);
 void grabandmove2scroll(const Arg *ignored);
 
 // Movement and scrolling:
-// dir can be any of UP, DOWN, LEFT, RIGHT, bitwise or'd together.
+// dir can be any of UP, DOWN, LEFT, RIGHT, bitwise or'd together, optionally
+// with a PROFILE().
 void movestart(const Arg *dir);
 void movestop(const Arg *dir);
 void move2scroll(const Arg *enable); // enable is treated as a boolean.
@@ -45,11 +35,46 @@ void scrollstop(const Arg *dir);
 void multiplyspeed(const Arg *factor);
 void dividespeed(const Arg *factor);
 
+// Targeting:
+// gridstart divides the monitor under the pointer into a grid and warps to its
+// center. Until a key outside of gridkeys[] is pressed, each key in gridkeys[]
+// narrows the grid to its cell and warps to the cell's center.
+void gridstart(const Arg *ignored);
+// snap warps to the nearest edge or center of a top-level window in dir, or in
+// the direction the pointer is being moved if dir is 0.
+void snap(const Arg *dir);
+// snapedge is like snap, but warps to the nearest edge on the screen, such as
+// a border or splitter, found in a screen capture.
+void snapedge(const Arg *dir);
+
+// Layers:
+// layer is an index into layers[]. Layers are only active while the keyboard
+// is grabbed, and ungrabbing pops them all.
+void pushlayer(const Arg *layer);
+void poplayer(const Arg *ignored);
+void latchlayer(const Arg *layer); // Push layer until the next key press.
+
+// Marks:
+// slot is an int from 0 to NMARKS-1.
+void setmark(const Arg *slot);    // Save the pointer position.
+void setwinmark(const Arg *slot); // Save it relative to the focused window.
+void gotomark(const Arg *slot);
+
 // Clicking:
-// btn can be any value from enum Mouse.
+// btn can be any value from enum Mouse or enum Wheel.
 void clickpress(const Arg *btn);
 void clickrelease(const Arg *btn);
+void doubleclick(const Arg *btn); // Click twice, MULTICLICK_MS apart.
+
+// Macros:
+// speed is a double factor to play back faster or slower than recorded.
+void togglerecording(const Arg *ignored);
+void playmacro(const Arg *speed);
+void playmacrowarps(const Arg *speed); // Warp straight to where each path ends.
 
 // Misc:
 void resetmovement(const Arg *ignored);
 void quit(const Arg *ignored);
+// restart replaces ptrkeys with a fresh exec of its binary, which takes over
+// its grabs and state, eg after upgrading.
+void restart(const Arg *ignored);
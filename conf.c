@@ -0,0 +1,455 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/Xlib.h>
+
+#include "jot.h"
+#include "pk.h"
+#include "command.h"
+#include "conf.h"
+
+
+#define LEN(X) (sizeof X / sizeof X[0])
+#define MAX_LINE_LEN 1024
+#define MAX_TOKENS 16
+
+enum ArgType {
+	ARGNONE,
+	ARGDIR,
+	ARGBUTTON,
+	ARGINT,
+	ARGFLOAT,
+	ARGKEYSYM, // Optional: omitted if the next token names a command.
+	ARGOPTDIR, // Likewise.
+	ARGLAYER,
+};
+
+typedef struct {
+	const char *name;
+	void (*func)(const Arg *);
+	enum ArgType argtype;
+} Command;
+
+typedef struct {
+	const char *name;
+	unsigned int val;
+} Name;
+
+typedef struct {
+	Config *c;
+	const char *name;
+	int lineno;
+	long layer; // Index of the layer bindings are added to, or -1 for the base.
+} Parser;
+
+static const Command *findcommand(const char *name);
+static int lookupname(const Name *names, size_t len, const char *s, unsigned int *val);
+static int parsemods(char *s, unsigned int *mods);
+static int parsekey(char *s, unsigned int *mod, KeySym *keysym);
+static int parsedir(char *s, unsigned int *dir);
+static int parsearg(Parser *p, enum ArgType type, char *s, Arg *arg);
+static int parsebind(Parser *p, char **tok, int ntok);
+static int parseline(Parser *p, char *line);
+static size_t findlayer(Config *c, const char *name);
+static void appendkey(Key **keys, size_t *nkeys, Key *key);
+
+
+static const Command commands[] = {
+	{"none",               NULL,               ARGNONE},
+	{"grabkeyboard",       grabkeyboard,       ARGKEYSYM},
+	{"ungrabkeyboard",     ungrabkeyboard,     ARGNONE},
+	{"togglegrabkeyboard", togglegrabkeyboard, ARGNONE},
+	{"grabandmove2scroll", grabandmove2scroll, ARGNONE},
+	{"movestart",          movestart,          ARGDIR},
+	{"movestop",           movestop,           ARGDIR},
+	{"move2scroll",        move2scroll,        ARGINT},
+	{"togglem2s",          togglem2s,          ARGNONE},
+	{"scrollstart",        scrollstart,        ARGDIR},
+	{"scrollstop",         scrollstop,         ARGDIR},
+	{"multiplyspeed",      multiplyspeed,      ARGFLOAT},
+	{"dividespeed",        dividespeed,        ARGFLOAT},
+	{"gridstart",          gridstart,          ARGNONE},
+	{"snap",               snap,               ARGOPTDIR},
+	{"snapedge",           snapedge,           ARGOPTDIR},
+	{"pushlayer",          pushlayer,          ARGLAYER},
+	{"poplayer",           poplayer,           ARGNONE},
+	{"latchlayer",         latchlayer,         ARGLAYER},
+	{"setmark",            setmark,            ARGINT},
+	{"setwinmark",         setwinmark,         ARGINT},
+	{"gotomark",           gotomark,           ARGINT},
+	{"clickpress",         clickpress,         ARGBUTTON},
+	{"clickrelease",       clickrelease,       ARGBUTTON},
+	{"doubleclick",        doubleclick,        ARGBUTTON},
+	{"togglerecording",    togglerecording,    ARGNONE},
+	{"playmacro",          playmacro,          ARGFLOAT},
+	{"playmacrowarps",     playmacrowarps,     ARGFLOAT},
+	{"resetmovement",      resetmovement,      ARGNONE},
+	{"quit",               quit,               ARGNONE},
+	{"restart",            restart,            ARGNONE},
+};
+
+static const Name modnames[] = {
+	{"Shift", ShiftMask},
+	{"Lock", LockMask},
+	{"Control", ControlMask},
+	{"Mod1", Mod1Mask},
+	{"Mod2", Mod2Mask},
+	{"Mod3", Mod3Mask},
+	{"Mod4", Mod4Mask},
+	{"Mod5", Mod5Mask},
+};
+
+static const Name dirnames[] = {
+	{"up", UP},
+	{"down", DOWN},
+	{"left", LEFT},
+	{"right", RIGHT},
+};
+
+static const Name buttonnames[] = {
+	{"left", BTNLEFT},
+	{"middle", BTNMIDDLE},
+	{"right", BTNRIGHT},
+	{"scrollup", PK_SCROLLUP},
+	{"scrolldown", PK_SCROLLDOWN},
+	{"scrollleft", PK_SCROLLLEFT},
+	{"scrollright", PK_SCROLLRIGHT},
+};
+
+
+// parseconfig parses the configuration in text into c, which should already
+// hold the default settings and no keys. Errors are reported with name and a
+// line number. Returns the number of errors.
+//
+// Each line is a setting or a binding, and # starts a comment:
+//
+//     fps 60
+//     basespeed 1000
+//     basescroll 14
+//     internalmods Shift+Control+Mod1
+//     bind [MODS+]KEYSYM [grab] [norepeat] PRESSFUNC [ARG] [RELEASEFUNC [ARG]]
+//     layer NAME
+//
+// Bindings following a layer line are added to that layer, or to the base
+// bindings if NAME is "base". Layers are numbered in order of first mention,
+// whether in a layer line or as an argument.
+int
+parseconfig(Config *c, const char *text, const char *name)
+{
+	Parser p = {c, name, 0, -1};
+	int nerr = 0;
+	for (const char *s = text; *s;) {
+		p.lineno++;
+		const char *end = strchr(s, '\n');
+		size_t len = end ? (size_t)(end - s) : strlen(s);
+		char line[MAX_LINE_LEN];
+		if (len >= sizeof line) {
+			jotf("%s:%d: line too long", name, p.lineno);
+			nerr++;
+		} else {
+			memcpy(line, s, len);
+			line[len] = '\0';
+			nerr += parseline(&p, line);
+		}
+		s += len;
+		if (*s == '\n') s++;
+	}
+	return nerr;
+}
+
+// loadconfigfile reads and parses the file at path into c. See parseconfig.
+int
+loadconfigfile(Config *c, const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (!f) {
+		jotf("open config %s: %s", path, strerror(errno));
+		return 1;
+	}
+	size_t len = 0, cap = 4096;
+	char *text = malloc(cap);
+	if (!text) die("load config: out of memory");
+	for (size_t n; (n = fread(text + len, 1, cap - len - 1, f)) > 0;) {
+		len += n;
+		if (cap - len > 1) continue;
+		cap *= 2;
+		text = realloc(text, cap);
+		if (!text) die("load config: out of memory");
+	}
+	int err = ferror(f);
+	fclose(f);
+	if (err) {
+		jotf("read config %s: failed", path);
+		free(text);
+		return 1;
+	}
+	text[len] = '\0';
+	int nerr = parseconfig(c, text, path);
+	free(text);
+	return nerr;
+}
+
+void
+freeconfig(Config *c)
+{
+	free(c->keys);
+	c->keys = NULL;
+	c->nkeys = 0;
+	for (size_t i = 0; i < c->nlayers; i++) {
+		free((char *)c->layers[i].name);
+		free(c->layers[i].keys);
+	}
+	free(c->layers);
+	c->layers = NULL;
+	c->nlayers = 0;
+}
+
+static int
+parseline(Parser *p, char *line)
+{
+	Config *c = p->c;
+	const char *name = p->name;
+	int lineno = p->lineno;
+	char *tok[MAX_TOKENS];
+	int ntok = 0;
+	for (char *s = strtok(line, " \t\r"); s; s = strtok(NULL, " \t\r")) {
+		if (*s == '#') break;
+		if (ntok == MAX_TOKENS) {
+			jotf("%s:%d: too many fields", name, lineno);
+			return 1;
+		}
+		tok[ntok++] = s;
+	}
+	if (!ntok) return 0;
+
+	if (!strcmp(tok[0], "bind")) return parsebind(p, tok, ntok);
+	if (ntok != 2) {
+		jotf("%s:%d: %s: want one value", name, lineno, tok[0]);
+		return 1;
+	}
+	char *end;
+	errno = 0;
+	if (!strcmp(tok[0], "fps")) {
+		long fps = strtol(tok[1], &end, 10);
+		if (*end || errno || fps <= 0 || fps > 1000) goto badvalue;
+		c->fps = fps;
+	} else if (!strcmp(tok[0], "basespeed")) {
+		c->basespeed = strtod(tok[1], &end);
+		if (*end || errno || c->basespeed <= 0) goto badvalue;
+	} else if (!strcmp(tok[0], "basescroll")) {
+		c->basescroll = strtod(tok[1], &end);
+		if (*end || errno || c->basescroll <= 0) goto badvalue;
+	} else if (!strcmp(tok[0], "internalmods")) {
+		if (parsemods(tok[1], &c->internalmods)) goto badvalue;
+	} else if (!strcmp(tok[0], "layer")) {
+		p->layer = strcmp(tok[1], "base") ? (long)findlayer(c, tok[1]) : -1;
+	} else {
+		jotf("%s:%d: unknown setting: %s", name, lineno, tok[0]);
+		return 1;
+	}
+	return 0;
+badvalue:
+	jotf("%s:%d: %s: bad value: %s", name, lineno, tok[0], tok[1]);
+	return 1;
+}
+
+static int
+parsebind(Parser *p, char **tok, int ntok)
+{
+	const char *name = p->name;
+	int lineno = p->lineno;
+	unsigned int mod = 0, opts = 0;
+	KeySym keysym;
+	int i = 1;
+	if (i >= ntok || parsekey(tok[i], &mod, &keysym)) {
+		jotf("%s:%d: bind: bad key: %s", name, lineno, i < ntok ? tok[i] : "");
+		return 1;
+	}
+	for (i++; i < ntok; i++) {
+		if (!strcmp(tok[i], "grab")) {
+			opts |= GRAB;
+		} else if (!strcmp(tok[i], "norepeat")) {
+			opts |= NOREPEAT;
+		} else {
+			break;
+		}
+	}
+
+	void (*funcs[2])(const Arg *) = {NULL, NULL};
+	Arg args[2] = {{0}, {0}};
+	for (int j = 0; j < 2 && i < ntok; j++) {
+		const Command *cmd = findcommand(tok[i]);
+		if (!cmd) {
+			jotf("%s:%d: bind: unknown command: %s", name, lineno, tok[i]);
+			return 1;
+		}
+		funcs[j] = cmd->func;
+		i++;
+		if (cmd->argtype == ARGNONE) continue;
+		if ((cmd->argtype == ARGKEYSYM || cmd->argtype == ARGOPTDIR)
+		&& (i >= ntok || findcommand(tok[i]))) continue;
+		if (i >= ntok) {
+			jotf("%s:%d: bind: %s: missing argument", name, lineno, cmd->name);
+			return 1;
+		}
+		if (parsearg(p, cmd->argtype, tok[i], &args[j])) {
+			jotf("%s:%d: bind: %s: bad argument: %s", name, lineno, cmd->name, tok[i]);
+			return 1;
+		}
+		i++;
+	}
+	if (i < ntok) {
+		jotf("%s:%d: bind: unexpected field: %s", name, lineno, tok[i]);
+		return 1;
+	}
+	if (!funcs[0] && !funcs[1]) {
+		jotf("%s:%d: bind: no command given", name, lineno);
+		return 1;
+	}
+	Key key = {mod, keysym, opts, funcs[0], args[0], funcs[1], args[1]};
+	if (p->layer >= 0) {
+		Layer *layer = &p->c->layers[p->layer];
+		appendkey(&layer->keys, &layer->nkeys, &key);
+	} else {
+		appendkey(&p->c->keys, &p->c->nkeys, &key);
+	}
+	return 0;
+}
+
+// findlayer returns the index of the layer with the given name, adding an
+// empty one if there isn't one yet.
+static size_t
+findlayer(Config *c, const char *name)
+{
+	for (size_t i = 0; i < c->nlayers; i++) {
+		if (!strcmp(name, c->layers[i].name)) return i;
+	}
+	c->layers = realloc(c->layers, (c->nlayers + 1) * sizeof *c->layers);
+	char *dup = malloc(strlen(name) + 1);
+	if (!c->layers || !dup) die("parse config: out of memory");
+	strcpy(dup, name);
+	c->layers[c->nlayers] = (Layer){dup, NULL, 0};
+	return c->nlayers++;
+}
+
+static void
+appendkey(Key **keys, size_t *nkeys, Key *key)
+{
+	// Grow by powers of two.
+	if (!(*nkeys & (*nkeys - 1))) {
+		size_t cap = *nkeys ? 2 * *nkeys : 1;
+		*keys = realloc(*keys, cap * sizeof **keys);
+		if (!*keys) die("parse config: out of memory");
+	}
+	// Key's members are const, so it can only be copied whole.
+	memcpy(&(*keys)[(*nkeys)++], key, sizeof *key);
+}
+
+static const Command *
+findcommand(const char *name)
+{
+	for (size_t i = 0; i < LEN(commands); i++) {
+		if (!strcmp(name, commands[i].name)) return &commands[i];
+	}
+	return NULL;
+}
+
+// lookupname sets val to the value for s in names. Returns nonzero if s isn't
+// found.
+static int
+lookupname(const Name *names, size_t len, const char *s, unsigned int *val)
+{
+	for (size_t i = 0; i < len; i++) {
+		if (strcmp(s, names[i].name)) continue;
+		*val = names[i].val;
+		return 0;
+	}
+	return 1;
+}
+
+// parsemods parses modifier names separated by '+', or "none".
+static int
+parsemods(char *s, unsigned int *mods)
+{
+	*mods = 0;
+	if (!strcmp(s, "none")) return 0;
+	for (char *save, *m = strtok_r(s, "+", &save); m; m = strtok_r(NULL, "+", &save)) {
+		unsigned int mod;
+		if (lookupname(modnames, LEN(modnames), m, &mod)) return 1;
+		*mods |= mod;
+	}
+	return 0;
+}
+
+// parsekey parses a keysym name preceded by optional modifiers, eg Mod4+w.
+static int
+parsekey(char *s, unsigned int *mod, KeySym *keysym)
+{
+	*mod = 0;
+	char *name = strrchr(s, '+');
+	if (name) {
+		*name++ = '\0';
+		if (parsemods(s, mod)) return 1;
+	} else {
+		name = s;
+	}
+	*keysym = XStringToKeysym(name);
+	return *keysym == NoSymbol;
+}
+
+// parsedir parses direction names separated by '+', optionally followed by
+// @N to select profiles[N], eg up+left@2.
+static int
+parsedir(char *s, unsigned int *dir)
+{
+	*dir = 0;
+	char *profile = strchr(s, '@');
+	if (profile) {
+		*profile++ = '\0';
+		char *end;
+		errno = 0;
+		long n = strtol(profile, &end, 10);
+		if (*end || errno || n < 0 || n > 0xffff) return 1;
+		*dir |= PROFILE(n);
+	}
+	for (char *save, *d = strtok_r(s, "+", &save); d; d = strtok_r(NULL, "+", &save)) {
+		unsigned int bit;
+		if (lookupname(dirnames, LEN(dirnames), d, &bit)) return 1;
+		*dir |= bit;
+	}
+	if ((*dir & (UP|DOWN)) == (UP|DOWN)) return 1;
+	if ((*dir & (LEFT|RIGHT)) == (LEFT|RIGHT)) return 1;
+	return !(*dir & PK_DIRMASK);
+}
+
+static int
+parsearg(Parser *p, enum ArgType type, char *s, Arg *arg)
+{
+	char *end;
+	errno = 0;
+	switch (type) {
+	case ARGNONE:
+		return 1;
+	case ARGDIR:
+	case ARGOPTDIR:
+		return parsedir(s, &arg->ui);
+	case ARGBUTTON:
+		if (!lookupname(buttonnames, LEN(buttonnames), s, &arg->ui)) return 0;
+		arg->ui = strtoul(s, &end, 10);
+		return *end || errno || !arg->ui;
+	case ARGINT:
+		arg->i = strtol(s, &end, 10);
+		return *end || errno;
+	case ARGFLOAT:
+		arg->f = strtod(s, &end);
+		return *end || errno || arg->f <= 0;
+	case ARGKEYSYM:
+		arg->ul = XStringToKeysym(s);
+		return arg->ul == NoSymbol;
+	case ARGLAYER:
+		if (!strcmp(s, "base")) return 1;
+		arg->i = findlayer(p->c, s);
+		return 0;
+	}
+	return 1;
+}
@@ -0,0 +1,11 @@
+#ifndef CONF_H
+#define CONF_H
+// Runtime configuration files.
+
+#include "pk.h"
+
+int parseconfig(Config *c, const char *text, const char *name);
+int loadconfigfile(Config *c, const char *path);
+void freeconfig(Config *c);
+
+#endif
@@ -0,0 +1,195 @@
+#include <string.h>
+#include <X11/keysym.h>
+
+#include "pk.h"
+#include "command.h"
+#include "conf.h"
+#include "prove.h"
+#include "jot.h"
+
+#define LEN(X) (sizeof X / sizeof X[0])
+
+int jottrace = 1;
+
+int
+test_parseconfig_settings()
+{
+	int rc = 0;
+	Config c = {NULL, 0, 0, 60, 1000, 14, NULL, 0};
+	const char *text =
+		"# comment\n"
+		"\n"
+		"fps 120  # trailing comment\n"
+		"basespeed 800.5\n"
+		"\tbasescroll 20\n"
+		"internalmods Shift+Mod4";
+	int nerr = parseconfig(&c, text, "test");
+	if (nerr) {
+		rc = 1;
+		jotf("nerr=%d want 0", nerr);
+	}
+	if (c.fps != 120 || c.basespeed != 800.5 || c.basescroll != 20
+	|| c.internalmods != (ShiftMask|Mod4Mask) || c.nkeys != 0) {
+		rc = 1;
+		jotf("got fps=%d basespeed=%g basescroll=%g internalmods=%u nkeys=%zu",
+				c.fps, c.basespeed, c.basescroll, c.internalmods, c.nkeys);
+	}
+	freeconfig(&c);
+	return rc;
+}
+
+int
+test_parseconfig_bind()
+{
+	int rc = 0;
+	Config c = {0};
+	const char *text =
+		"bind Mod4+w grab grabkeyboard w\n"
+		"bind Select grab norepeat grabkeyboard ungrabkeyboard\n"
+		"bind w movestart up+left@2 movestop up+left\n"
+		"bind space clickpress left clickrelease left\n"
+		"bind j dividespeed 8 multiplyspeed 8\n"
+		"bind F1 setmark 3\n"
+		"bind x none quit\n";
+	Key want[] = {
+		{Mod4Mask, XK_w, GRAB, grabkeyboard, {.ul=XK_w}, NULL, {0}},
+		{0, XK_Select, GRAB|NOREPEAT, grabkeyboard, {0}, ungrabkeyboard, {0}},
+		{0, XK_w, 0, movestart, {.ui=UP|LEFT|PROFILE(2)}, movestop, {.ui=UP|LEFT}},
+		{0, XK_space, 0, clickpress, {.ui=BTNLEFT}, clickrelease, {.ui=BTNLEFT}},
+		{0, XK_j, 0, dividespeed, {.f=8}, multiplyspeed, {.f=8}},
+		{0, XK_F1, 0, setmark, {.i=3}, NULL, {0}},
+		{0, XK_x, 0, NULL, {0}, quit, {0}},
+	};
+	int nerr = parseconfig(&c, text, "test");
+	if (nerr || c.nkeys != LEN(want)) {
+		jotf("nerr=%d nkeys=%zu, want 0 and %zu", nerr, c.nkeys, LEN(want));
+		freeconfig(&c);
+		return 1;
+	}
+	for (size_t i = 0; i < LEN(want); i++) {
+		Key got = c.keys[i];
+		Key w = want[i];
+		if (got.mod != w.mod || got.keysym != w.keysym || got.opts != w.opts
+		|| got.pressfunc != w.pressfunc || got.releasefunc != w.releasefunc
+		|| memcmp(&got.pressarg, &w.pressarg, sizeof(Arg))
+		|| memcmp(&got.releasearg, &w.releasearg, sizeof(Arg))) {
+			rc = 1;
+			jotf("key=%zu: got mod=%u keysym=%lx opts=%u, want mod=%u keysym=%lx opts=%u",
+					i, got.mod, got.keysym, got.opts, w.mod, w.keysym, w.opts);
+		}
+	}
+	freeconfig(&c);
+	return rc;
+}
+
+int
+test_parseconfig_errors()
+{
+	int rc = 0;
+	const char *texts[] = {
+		"fps\n",
+		"fps 0\n",
+		"basespeed fast\n",
+		"internalmods Hyper\n",
+		"speed 10\n",
+		"bind NotAKeysym quit\n",
+		"bind w\n",
+		"bind w frobnicate\n",
+		"bind w movestart\n",
+		"bind w movestart up+down\n",
+		"bind w movestart sideways\n",
+		"bind w clickpress 0\n",
+		"bind w quit quit quit\n",
+		"bind w pushlayer base\n",
+	};
+	for (size_t i = 0; i < LEN(texts); i++) {
+		Config c = {NULL, 0, 0, 60, 1000, 14, NULL, 0};
+		int nerr = parseconfig(&c, texts[i], "test");
+		if (nerr != 1 || c.nkeys != 0) {
+			rc = 1;
+			jotf("test=%zu nerr=%d nkeys=%zu, want 1 error and no keys", i, nerr, c.nkeys);
+		}
+		freeconfig(&c);
+	}
+	return rc;
+}
+
+int
+test_parseconfig_layers()
+{
+	int rc = 0;
+	Config c = {0};
+	const char *text =
+		"bind Tab pushlayer scroll poplayer\n"
+		"bind grave latchlayer mark\n"
+		"layer scroll\n"
+		"bind w scrollstart up scrollstop up\n"
+		"bind s scrollstart down scrollstop down\n"
+		"layer base\n"
+		"bind q ungrabkeyboard\n"
+		"layer mark\n"
+		"bind 1 setmark 0\n";
+	int nerr = parseconfig(&c, text, "test");
+	if (nerr || c.nkeys != 3 || c.nlayers != 2) {
+		jotf("nerr=%d nkeys=%zu nlayers=%zu, want 0, 3 and 2", nerr, c.nkeys, c.nlayers);
+		freeconfig(&c);
+		return 1;
+	}
+	if (c.keys[0].pressarg.i != 0 || c.keys[1].pressarg.i != 1) {
+		rc = 1;
+		jotf("layer args: got %d and %d, want 0 and 1", c.keys[0].pressarg.i, c.keys[1].pressarg.i);
+	}
+	if (strcmp(c.layers[0].name, "scroll") || c.layers[0].nkeys != 2
+	|| strcmp(c.layers[1].name, "mark") || c.layers[1].nkeys != 1) {
+		rc = 1;
+		jotf("layers: got %s with %zu keys and %s with %zu keys",
+				c.layers[0].name, c.layers[0].nkeys, c.layers[1].name, c.layers[1].nkeys);
+	}
+	if (c.keys[2].keysym != XK_q || c.layers[1].keys[0].pressfunc != setmark) {
+		rc = 1;
+		jot("bindings added to the wrong layer");
+	}
+	freeconfig(&c);
+	return rc;
+}
+
+// A mark slot is only a number to the parser, so a config with one out of
+// range is rejected by badconfig, before it replaces the running config.
+int
+test_parseconfig_bad_mark()
+{
+	int rc = 0;
+	const char *texts[] = {
+		"bind w gotomark 99\n",
+		"bind w setmark -1\n",
+		"layer mark\nbind 1 setwinmark 10\n",
+	};
+	for (size_t i = 0; i < LEN(texts); i++) {
+		Config c = {0};
+		int nerr = parseconfig(&c, texts[i], "test");
+		if (nerr || !badconfig(&c)) {
+			rc = 1;
+			jotf("test=%zu nerr=%d, want 0 errors and a bad config", i, nerr);
+		}
+		freeconfig(&c);
+	}
+	Config c = {0};
+	if (parseconfig(&c, "bind w gotomark 9\n", "test") || badconfig(&c)) {
+		rc = 1;
+		jot("slot 9 rejected");
+	}
+	freeconfig(&c);
+	return rc;
+}
+
+int
+main()
+{
+	prove_init();
+	prove_run(test_parseconfig_settings);
+	prove_run(test_parseconfig_bind);
+	prove_run(test_parseconfig_errors);
+	prove_run(test_parseconfig_layers);
+	prove_run(test_parseconfig_bad_mark);
+	prove_exit();
+}
@@ -5,6 +5,86 @@
 // Events per second.
 #define BASE_SCROLL 14
 
+// Scroll flood control. At most SCROLL_MAX_PER_FRAME scroll events are sent
+// per axis each frame. Up to SCROLL_MAX_BACKLOG more are carried over to later
+// frames; any beyond that are dropped, so there's little scrolling left to do
+// once a key is released. Scrolling pauses while the xserver is more than
+// SCROLL_MAX_LAG_MS behind, which is checked every SCROLL_PROBE_MS.
+#define SCROLL_MAX_PER_FRAME 4
+#define SCROLL_MAX_BACKLOG 8
+#define SCROLL_MAX_LAG_MS 50
+#define SCROLL_PROBE_MS 100
+
+// Clicks of a doubleclick are MULTICLICK_MS apart, timed by the xserver.
+#define MULTICLICK_MS 20
+
+// Macros hold at most MACRO_MAX_STEPS motion and button events. At 60 fps
+// that's about 18 minutes of continuous movement.
+#define MACRO_MAX_STEPS 65536
+
+// snapedge looks for edges up to EDGE_REACH pixels from the pointer. An edge
+// is a change of at least EDGE_THRESHOLD in a color channel, out of 255,
+// across a band EDGE_BAND pixels wide, so text doesn't count.
+#define EDGE_REACH 128
+#define EDGE_BAND 4
+#define EDGE_THRESHOLD 48
+
+// A frame that comes more than MAX_STEP_MS after the last one, because
+// ptrkeys or the xserver stalled, is handled according to STALL_POLICY:
+// STALL_CLAMP moves only MAX_STEP_MS worth, STALL_SPREAD catches up over the
+// following frames, and STALL_DROP skips the frame's movement.
+#define MAX_STEP_MS 100
+#define STALL_POLICY STALL_CLAMP
+
+// If the event loop stalls for WATCHDOG_MS while the keyboard is grabbed, a
+// watchdog thread restores the keyboard and exits so that the grab is
+// released. 0 disables the watchdog.
+#define WATCHDOG_MS 3000
+
+// Velocity profiles scale the speed of a movement by how long it's been held,
+// so a single key can start slowly for precise approach and speed up for long
+// distances. Speed ramps linearly from start to cruise over the given number
+// of milliseconds, or follows a custom curve whose points are spaced evenly
+// over the ramp, in which case start and cruise are unused. Speed multipliers
+// apply on top of the profile.
+//
+// PTR_PROFILE and SCROLL_PROFILE are used for pointer movement and scrolling
+// unless a movestart or scrollstart binding picks another profile by or'ing
+// PROFILE(n) into its direction, eg {.ui=UP|PROFILE(2)}.
+static const double easeincurve[] = {0.1, 0.15, 0.3, 0.6, 1, 1.5, 2.2, 3};
+static Profile profiles[] = {
+// start  cruise  ramp ms  curve        curve len
+{  1,     1,      0,       NULL,        0},                 // 0: constant
+{  0.25,  1,      400,     NULL,        0},                 // 1: precise approach
+{  0,     0,      800,     easeincurve, LEN(easeincurve)},  // 2: fling
+};
+#define PTR_PROFILE 0
+#define SCROLL_PROFILE 0
+
+// Keys that pick a cell of the grid while targeting with gridstart, in
+// row-major order. Each press narrows the grid to the chosen cell, so a
+// 3x3 grid reaches any pixel of a 4K monitor in about 8 presses. They take
+// precedence over keys[] while targeting.
+#define GRID_COLS 3
+static KeySym gridkeys[] = {
+	XK_u, XK_i,     XK_o,
+	XK_j, XK_k,     XK_l,
+	XK_m, XK_comma, XK_period,
+};
+
+// Number of slots for setmark, setwinmark, and gotomark.
+#define NMARKS 10
+
+// Speeds for particular applications, used while one of their windows is
+// focused according to the window manager's _NET_ACTIVE_WINDOW. Applications
+// are matched by WM_CLASS class or instance name, as shown by xprop(1).
+// Speeds of 0 keep BASE_SPEED and BASE_SCROLL.
+static AppProfile appprofiles[] = {
+// class      base speed  base scroll  multiplier
+{  "firefox", 0,          28,          1},
+{  "FreeCAD", 400,        0,           1},
+};
+
 // Set modifier bits as "internal" while the keyboard is grabbed, that is, the
 // xserver still keeps track of their state but doesn't pass them along in key
 // events to applications.
@@ -52,7 +132,23 @@ static Key keys[] = {
 {0,          XK_a,          0,              movestart,           {.i=LEFT},        movestop,        {.i=LEFT}},
 {0,          XK_s,          0,              movestart,           {.i=DOWN},        movestop,        {.i=DOWN}},
 {0,          XK_d,          0,              movestart,           {.i=RIGHT},       movestop,        {.i=RIGHT}},
+// Flinging with the arrow keys.
+{0,          XK_Up,         0,              movestart,           {.ui=UP|PROFILE(2)},    movestop,  {.i=UP}},
+{0,          XK_Left,       0,              movestart,           {.ui=LEFT|PROFILE(2)},  movestop,  {.i=LEFT}},
+{0,          XK_Down,       0,              movestart,           {.ui=DOWN|PROFILE(2)},  movestop,  {.i=DOWN}},
+{0,          XK_Right,      0,              movestart,           {.ui=RIGHT|PROFILE(2)}, movestop,  {.i=RIGHT}},
+// Targeting
+{0,          XK_g,          0,              gridstart,           {0},              NULL,            {0}},
+{0,          XK_t,          0,              snap,                {0},              NULL,            {0}},
+{0,          XK_h,          0,              snapedge,            {0},              NULL,            {0}},
+// Marks
+{0,          XK_grave,      0,              latchlayer,          {.i=1},           NULL,            {0}},
+{0,          XK_1,          0,              gotomark,            {.i=0},           NULL,            {0}},
+{0,          XK_2,          0,              gotomark,            {.i=1},           NULL,            {0}},
+{0,          XK_3,          0,              gotomark,            {.i=2},           NULL,            {0}},
+{0,          XK_4,          0,              gotomark,            {.i=3},           NULL,            {0}},
 // Scrolling
+{0,          XK_Tab,        0,              pushlayer,           {.i=0},           poplayer,        {0}},
 {0,          XK_Shift_L,    0,              move2scroll,         {.i=1},           move2scroll,     {.i=0}},
 {0,          XK_f,          0,              togglem2s,           {0},              NULL,            {0}},
 // Speed multiply/divide.
@@ -66,9 +162,50 @@ static Key keys[] = {
 {0,          XK_space,      0,              clickpress,          {.ui=BTNLEFT},    clickrelease,    {.ui=BTNLEFT}},
 {0,          XK_e,          0,              clickpress,          {.ui=BTNRIGHT},   clickrelease,    {.ui=BTNRIGHT}},
 {0,          XK_r,          0,              clickpress,          {.ui=BTNMIDDLE},  clickrelease,    {.ui=BTNMIDDLE}},
+{0,          XK_c,          0,              doubleclick,         {.ui=BTNLEFT},    NULL,            {0}},
 // Right-handed clicking, for dragging, etc.
 {0,          XK_n,          0,              clickpress,          {.ui=BTNRIGHT},   clickrelease,    {.ui=BTNRIGHT}},
 {0,          XK_m,          0,              clickpress,          {.ui=BTNMIDDLE},  clickrelease,    {.ui=BTNMIDDLE}},
+// Macros
+{0,          XK_z,          0,              togglerecording,     {0},              NULL,            {0}},
+{0,          XK_v,          0,              playmacro,           {.f=1},           NULL,            {0}},
+{0,          XK_b,          0,              playmacrowarps,      {.f=4},           NULL,            {0}},
 // Debugging
 {Mod4Mask,   XK_g,          GRAB,           resetmovement,       {0},              NULL,            {0}},
 };
+
+// Layers are extra sets of bindings that can be pushed on top of keys[] while
+// the keyboard is grabbed, replacing the bindings of the keys they bind. Keys
+// they don't bind keep their keys[] bindings. Use pushlayer and poplayer as a
+// key's press and release functions to activate a layer while the key is
+// held, or latchlayer to activate it for the next key press. Layer arguments
+// are indexes into layers[].
+//
+// Layer bindings can't have modifiers.
+static Key scrollkeys[] = {
+// modifier  key            opts            press func           press arg         release func     release arg
+{0,          XK_w,          0,              scrollstart,         {.i=UP},          scrollstop,      {.i=UP}},
+{0,          XK_a,          0,              scrollstart,         {.i=LEFT},        scrollstop,      {.i=LEFT}},
+{0,          XK_s,          0,              scrollstart,         {.i=DOWN},        scrollstop,      {.i=DOWN}},
+{0,          XK_d,          0,              scrollstart,         {.i=RIGHT},       scrollstop,      {.i=RIGHT}},
+};
+static Key markkeys[] = {
+{0,          XK_1,          0,              setwinmark,          {.i=0},           NULL,            {0}},
+{0,          XK_2,          0,              setwinmark,          {.i=1},           NULL,            {0}},
+{0,          XK_3,          0,              setwinmark,          {.i=2},           NULL,            {0}},
+{0,          XK_4,          0,              setwinmark,          {.i=3},           NULL,            {0}},
+};
+static Layer layers[] = {
+{"scroll",  scrollkeys,  LEN(scrollkeys)},
+{"mark",    markkeys,    LEN(markkeys)},
+};
+
+// Chords are bindings for two keys pressed within CHORD_MS of each other
+// while the keyboard is grabbed. Presses of keys that are part of a chord are
+// held back for up to CHORD_MS, at most 100, to see if it's a chord; other
+// keys aren't delayed. 0 disables chords.
+#define CHORD_MS 40
+static Chord chords[] = {
+// keys           press func    press arg         release func   release arg
+{{XK_y, XK_p},    clickpress,   {.ui=BTNMIDDLE},  clickrelease,  {.ui=BTNMIDDLE}},
+};
@@ -0,0 +1,86 @@
+#include <stddef.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "edge.h"
+
+static unsigned int gradient(uint32_t a, uint32_t b);
+#ifdef __SSE2__
+static __m128i gradients16(const uint32_t *p);
+#endif
+
+
+// edgescan returns the index of the first pixel past an edge in the rows of
+// strip, which are stride pixels apart, or -1 if there's none before len. An
+// edge is where every row's pixel differs from the one before it by at least
+// threshold in some channel. The steps between pixels before start are
+// skipped, so a pointer already on an edge can move on to the next.
+//
+// With SSE2 the steps of 16 pixels are compared at once.
+int
+edgescan(const uint32_t *strip, size_t stride, size_t rows, size_t len, unsigned int threshold, size_t start)
+{
+	if (!rows || threshold > 255) return -1;
+	size_t i = start;
+#ifdef __SSE2__
+	__m128i thr = _mm_set1_epi8((char)threshold);
+	for (; i + 16 < len; i += 16) {
+		__m128i g = gradients16(strip + i);
+		for (size_t r = 1; r < rows; r++) g = _mm_min_epu8(g, gradients16(strip + r*stride + i));
+		int hits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(g, thr), g));
+		if (hits) return i + __builtin_ctz(hits) + 1;
+	}
+#endif
+	return edgescanscalar(strip, stride, rows, len, threshold, i);
+}
+
+// edgescanscalar is edgescan without SIMD.
+int
+edgescanscalar(const uint32_t *strip, size_t stride, size_t rows, size_t len, unsigned int threshold, size_t start)
+{
+	if (!rows) return -1;
+	for (size_t i = start; i + 1 < len; i++) {
+		size_t r = 0;
+		for (; r < rows; r++) {
+			const uint32_t *p = strip + r*stride;
+			if (gradient(p[i], p[i+1]) < threshold) break;
+		}
+		if (r == rows) return i + 1;
+	}
+	return -1;
+}
+
+// gradient returns the largest difference between the channels of a and b.
+static unsigned int
+gradient(uint32_t a, uint32_t b)
+{
+	unsigned int g = 0;
+	for (int shift = 0; shift < 32; shift += 8) {
+		int d = (int)((a >> shift) & 0xff) - (int)((b >> shift) & 0xff);
+		if (d < 0) d = -d;
+		if ((unsigned int)d > g) g = d;
+	}
+	return g;
+}
+
+#ifdef __SSE2__
+// gradients16 returns the gradients between p[0..15] and p[1..16], a byte
+// each.
+static __m128i
+gradients16(const uint32_t *p)
+{
+	__m128i g[4];
+	for (int k = 0; k < 4; k++) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(p + 4*k));
+		__m128i b = _mm_loadu_si128((const __m128i *)(p + 4*k + 1));
+		__m128i d = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+		// Fold each pixel's channel differences into its low byte.
+		d = _mm_max_epu8(d, _mm_srli_epi32(d, 16));
+		d = _mm_max_epu8(d, _mm_srli_epi32(d, 8));
+		g[k] = _mm_and_si128(d, _mm_set1_epi32(0xff));
+	}
+	return _mm_packus_epi16(_mm_packs_epi32(g[0], g[1]), _mm_packs_epi32(g[2], g[3]));
+}
+#endif
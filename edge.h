@@ -0,0 +1,17 @@
+#ifndef EDGE_H
+#define EDGE_H
+// Finding edges, such as window borders and splitters, in captured pixels.
+//
+// A strip is rows of pixels sampled along a line from the pointer, one row for
+// each parallel line in a band around it, so scanning in any direction is a
+// scan along rows. An edge is a step in color that every row of the band
+// crosses at the same place, which keeps text and icons from counting as
+// edges.
+
+#include <stddef.h>
+#include <stdint.h>
+
+int edgescan(const uint32_t *strip, size_t stride, size_t rows, size_t len, unsigned int threshold, size_t start);
+int edgescanscalar(const uint32_t *strip, size_t stride, size_t rows, size_t len, unsigned int threshold, size_t start);
+
+#endif
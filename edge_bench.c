@@ -0,0 +1,46 @@
+// edge_bench times edgescan against edgescanscalar on strips the size
+// snapedge scans, with the edge at the far end so every pixel is compared.
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "edge.h"
+
+#define ROWS 4
+#define LEN 128
+#define ROUNDS 100000
+
+typedef int (*Scan)(const uint32_t *, size_t, size_t, size_t, unsigned int, size_t);
+
+static long long
+nowns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static double
+bench(Scan scan, const uint32_t *strip)
+{
+	long long start = nowns();
+	volatile int sink = 0;
+	for (int i = 0; i < ROUNDS; i++) sink += scan(strip, LEN, ROWS, LEN, 32, 1);
+	(void)sink;
+	return (double)(nowns() - start) / ROUNDS;
+}
+
+int
+main()
+{
+	static uint32_t strip[ROWS][LEN];
+	srand(1);
+	for (size_t r = 0; r < ROWS; r++) {
+		for (size_t i = 0; i < LEN; i++) strip[r][i] = rand() & 0x0f0f0f;
+		strip[r][LEN-1] = 0xffffff;
+	}
+	printf("%-8s %10s\n", "kernel", "ns/scan");
+	printf("%-8s %10.1f\n", "edgescan", bench(edgescan, &strip[0][0]));
+	printf("%-8s %10.1f\n", "scalar", bench(edgescanscalar, &strip[0][0]));
+	return 0;
+}
@@ -0,0 +1,95 @@
+#include <stdlib.h>
+
+#include "edge.h"
+#include "prove.h"
+#include "jot.h"
+
+#define LEN(X) (sizeof X / sizeof X[0])
+#define ROWS 4
+#define STRIDE 100
+
+int jottrace = 1;
+
+// fillstrip fills rows of strip with gray, then with color from edge on.
+static void
+fillstrip(uint32_t strip[ROWS][STRIDE], size_t rows, size_t edge, uint32_t color)
+{
+	for (size_t r = 0; r < ROWS; r++) {
+		for (size_t i = 0; i < STRIDE; i++) {
+			strip[r][i] = (r < rows && i >= edge) ? color : 0x808080;
+		}
+	}
+}
+
+int
+test_edgescan()
+{
+	int rc = 0;
+	static uint32_t strip[ROWS][STRIDE];
+	struct test {
+		size_t rows; // Rows the edge crosses.
+		size_t edge;
+		uint32_t color;
+		size_t len, start;
+		int want;
+	};
+	struct test tests[] = {
+		{ROWS, 40, 0xffffff, STRIDE, 1, 40},
+		{ROWS, 5, 0x80ff80, STRIDE, 1, 5}, // One channel is enough.
+		{ROWS, 40, 0x909090, STRIDE, 1, -1}, // Too faint.
+		{ROWS - 1, 40, 0xffffff, STRIDE, 1, -1}, // Doesn't cross the band.
+		{ROWS, 1, 0xffffff, STRIDE, 1, -1}, // Right at the start.
+		{ROWS, 97, 0x000000, STRIDE, 1, 97}, // In the scalar tail.
+		{ROWS, 99, 0x000000, STRIDE, 1, 99},
+		{ROWS, 40, 0x000000, 40, 1, -1}, // Out of reach.
+		{ROWS, 40, 0x000000, 41, 1, 40},
+		{ROWS, 17, 0x000000, STRIDE, 17, -1},
+	};
+	for (size_t i = 0; i < LEN(tests); i++) {
+		struct test test = tests[i];
+		fillstrip(strip, test.rows, test.edge, test.color);
+		int got = edgescan(&strip[0][0], STRIDE, ROWS, test.len, 32, test.start);
+		int scalar = edgescanscalar(&strip[0][0], STRIDE, ROWS, test.len, 32, test.start);
+		if (got != test.want || scalar != test.want) {
+			rc = 1;
+			jotf("test=%zu got=%d scalar=%d want=%d", i, got, scalar, test.want);
+		}
+	}
+	return rc;
+}
+
+// The SIMD and scalar scans agree on noise.
+int
+test_edgescan_random()
+{
+	int rc = 0;
+	static uint32_t strip[ROWS][STRIDE];
+	srand(1);
+	for (int round = 0; round < 1000; round++) {
+		for (size_t r = 0; r < ROWS; r++) {
+			for (size_t i = 0; i < STRIDE; i++) strip[r][i] = rand() & 0x3f3f3f;
+		}
+		size_t rows = 1 + rand() % ROWS;
+		size_t len = rand() % (STRIDE + 1);
+		size_t start = rand() % 20;
+		unsigned int threshold = rand() % 64;
+		int got = edgescan(&strip[0][0], STRIDE, rows, len, threshold, start);
+		int want = edgescanscalar(&strip[0][0], STRIDE, rows, len, threshold, start);
+		if (got != want) {
+			rc = 1;
+			jotf("round=%d rows=%zu len=%zu start=%zu threshold=%u got=%d want=%d",
+					round, rows, len, start, threshold, got, want);
+			break;
+		}
+	}
+	return rc;
+}
+
+int
+main()
+{
+	prove_init();
+	prove_run(test_edgescan);
+	prove_run(test_edgescan_random);
+	prove_exit();
+}
@@ -0,0 +1,579 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+#include "inject.h"
+
+
+#define LEN(X) (sizeof X / sizeof X[0])
+
+
+static void selectprofile(PkEngine *e, PkMovements *m, size_t ch, unsigned int dir, size_t def);
+static int throttleaxis(int *backlog, unsigned int *button, int n, unsigned int newbutton, int max, int maxbacklog, long *dropped);
+static int isconflicting(unsigned int dir);
+static int moving(const PkMovements *m);
+static int stepdelta(PkEngine *e, int usec);
+
+
+// enginereset stops all movement on e and sizes it for nchannels channels.
+void
+enginereset(PkEngine *e, size_t nchannels)
+{
+	if (nchannels > PK_MAX_CHANNELS) nchannels = PK_MAX_CHANNELS;
+	pk_initmovements(&e->ptr, nchannels, e->basespeed, 0);
+	pk_initmovements(&e->scroll, nchannels, e->basescroll, 1);
+	memset(e->velocity, 0, sizeof e->velocity);
+	memset(e->throttle, 0, sizeof e->throttle);
+	e->debt = 0;
+	e->appmul = 1;
+}
+
+// enginestartmove starts moving channel ch's pointer in dir, which may select a
+// profile with PK_PROFILE().
+int
+enginestartmove(PkEngine *e, size_t ch, unsigned int dir)
+{
+	if (isconflicting(dir)) return -1;
+	selectprofile(e, &e->ptr, ch, dir, e->ptrprofile);
+	return pk_startdir(&e->ptr, ch, dir & PK_DIRMASK);
+}
+
+void
+enginestopmove(PkEngine *e, size_t ch, unsigned int dir)
+{
+	pk_stopdir(&e->ptr, ch, dir & PK_DIRMASK);
+}
+
+int
+enginestartscroll(PkEngine *e, size_t ch, unsigned int dir)
+{
+	if (isconflicting(dir)) return -1;
+	selectprofile(e, &e->scroll, ch, dir, e->scrollprofile);
+	return pk_startdir(&e->scroll, ch, dir & PK_DIRMASK);
+}
+
+void
+enginestopscroll(PkEngine *e, size_t ch, unsigned int dir)
+{
+	pk_stopdir(&e->scroll, ch, dir & PK_DIRMASK);
+}
+
+// enginesetm2s makes channel ch's pointer movement scroll instead, or not.
+void
+enginesetm2s(PkEngine *e, size_t ch, int enable)
+{
+	PkMovements *m = &e->ptr;
+	if (!enable == !m->isscroll[ch]) return;
+	m->isscroll[ch] = !!enable;
+	m->basespeed[ch] = enable ? e->basescroll : e->basespeed;
+	m->xrem[ch] = 0;
+	m->yrem[ch] = 0;
+	m->xcont[ch] = 0;
+	m->ycont[ch] = 0;
+}
+
+void
+enginemulspeed(PkEngine *e, size_t ch, double factor)
+{
+	e->ptr.mul[ch] *= factor;
+	e->scroll.mul[ch] *= factor;
+}
+
+// enginesetspeeds changes e's base speeds and the speed multiplier under
+// every channel's to mul, without interrupting movement. Multipliers applied
+// with enginemulspeed, such as by a key that's still held, are kept.
+void
+enginesetspeeds(PkEngine *e, double basespeed, double basescroll, double mul)
+{
+	double f = mul / (e->appmul ? e->appmul : 1);
+	e->appmul = mul;
+	e->basespeed = basespeed;
+	e->basescroll = basescroll;
+	for (size_t i = 0; i < e->ptr.n; i++) {
+		e->ptr.basespeed[i] = e->ptr.isscroll[i] ? basescroll : basespeed;
+		e->ptr.mul[i] *= f;
+		e->scroll.basespeed[i] = basescroll;
+		e->scroll.mul[i] *= f;
+	}
+}
+
+// enginestep advances e by usec, draining injected input up to now, and writes
+// what to send to f. Each channel sends at most maxscroll scroll events per
+// axis. Returns nonzero if anything is still moving, in which case the
+// frontend should step again next frame.
+int
+enginestep(PkEngine *e, int usec, long long now, int maxscroll, PkFrame *f)
+{
+	int elapsed = usec;
+	usec = stepdelta(e, usec);
+	f->nbuttons = 0;
+	if (e->inject) {
+		// Injected velocities are integrated over time stamps, so apply the
+		// stall policy by scaling the time since the last step.
+		double scale = elapsed > 0 ? (double)usec / elapsed : 1;
+		f->nbuttons = pk_draininject(e->inject, &e->ptr, e->velocity, now, scale,
+				f->buttons, LEN(f->buttons));
+	}
+	PkScrollUpdate su[PK_MAX_CHANNELS], m2s[PK_MAX_CHANNELS];
+	pk_scrollupdate(&e->scroll, usec, su);
+	// Pointer keys scroll on channels in move2scroll mode.
+	pk_scrollupdate(&e->ptr, usec, m2s);
+	f->isscrolling = 0;
+	f->dropped = 0;
+	for (size_t i = 0; i < e->ptr.n; i++) {
+		PkThrottle *t = &e->throttle[i];
+		long dropped = t->dropped;
+		f->scroll[i] = pk_throttlescroll(t, pk_addscroll(su[i], m2s[i]), maxscroll, e->maxbacklog);
+		f->dropped += t->dropped - dropped;
+		if (f->scroll[i].xevents || f->scroll[i].yevents || t->xbacklog || t->ybacklog) {
+			f->isscrolling = 1;
+		}
+	}
+	pk_pointerupdate(&e->ptr, usec, f->ptr);
+	int busy = f->isscrolling || moving(&e->ptr) || moving(&e->scroll);
+	for (size_t i = 0; i < e->ptr.n; i++) {
+		if (e->velocity[i].x || e->velocity[i].y) busy = 1;
+	}
+	// There's nothing to catch up on once everything has stopped.
+	if (!busy) e->debt = 0;
+	return busy;
+}
+
+// stepdelta applies e's stall policy to a step of usec, returning how much of
+// it to integrate now.
+static int
+stepdelta(PkEngine *e, int usec)
+{
+	if (!e->maxstepusec) return usec;
+	if (usec > e->maxstepusec) {
+		e->stalls++;
+		e->stalledusec += usec - e->maxstepusec;
+		if (e->stallpolicy == PK_STALL_CLAMP) return e->maxstepusec;
+		if (e->stallpolicy == PK_STALL_DROP) return 0;
+	}
+	if (e->stallpolicy != PK_STALL_SPREAD) return usec;
+	long long total = usec + e->debt;
+	int step = total < e->maxstepusec ? total : e->maxstepusec;
+	e->debt = total - step;
+	return step;
+}
+
+static int
+isconflicting(unsigned int dir)
+{
+	return (dir & PK_UP && dir & PK_DOWN) || (dir & PK_LEFT && dir & PK_RIGHT);
+}
+
+// selectprofile sets m's profile to the one chosen by the PK_PROFILE() bits of
+// dir, or to e's profiles[def] if there are none and m is starting from rest.
+// Switching profiles restarts the curve.
+static void
+selectprofile(PkEngine *e, PkMovements *m, size_t ch, unsigned int dir, size_t def)
+{
+	unsigned int n = dir >> PK_PROFILE_SHIFT;
+	const PkProfileTable *p = m->profile[ch];
+	if (n) {
+		p = n <= e->nprofiles ? &e->profiles[n - 1] : NULL;
+	} else if (!m->dir[ch]) {
+		p = def < e->nprofiles ? &e->profiles[def] : NULL;
+	}
+	if (p == m->profile[ch]) return;
+	m->profile[ch] = p;
+	m->held[ch] = 0;
+}
+
+// pk_buildprofile samples p's ramp or curve into t.
+void
+pk_buildprofile(PkProfileTable *t, const PkProfile *p)
+{
+	t->rampusec = p->rampms * 1000L;
+	for (size_t i = 0; i < PK_PROFILE_TABLE_LEN; i++) {
+		double x = (double)i / (PK_PROFILE_TABLE_LEN - 1);
+		if (!p->curve || !p->curvelen) {
+			t->f[i] = p->start + (p->cruise - p->start) * x;
+			continue;
+		}
+		double pos = x * (p->curvelen - 1);
+		size_t j = (size_t)pos;
+		if (j >= p->curvelen - 1) {
+			t->f[i] = p->curve[p->curvelen - 1];
+			continue;
+		}
+		t->f[i] = p->curve[j] + (p->curve[j+1] - p->curve[j]) * (pos - j);
+	}
+}
+
+// pk_profilefactor returns the speed factor usec microseconds into a movement.
+double
+pk_profilefactor(const PkProfileTable *t, long usec)
+{
+	if (!t) return 1;
+	if (usec >= t->rampusec) return t->f[PK_PROFILE_TABLE_LEN - 1];
+	if (usec <= 0) return t->f[0];
+	double pos = (double)usec * (PK_PROFILE_TABLE_LEN - 1) / t->rampusec;
+	size_t i = (size_t)pos;
+	return t->f[i] + (t->f[i+1] - t->f[i]) * (pos - i);
+}
+
+// pk_initmovements resets m to n channels at rest.
+void
+pk_initmovements(PkMovements *m, size_t n, double basespeed, int isscroll)
+{
+	memset(m, 0, sizeof *m);
+	m->n = n;
+	for (size_t i = 0; i < n; i++) {
+		m->basespeed[i] = basespeed;
+		m->mul[i] = 1;
+		m->isscroll[i] = isscroll;
+	}
+}
+
+// pk_startdir starts moving channel ch of m in dir, on top of any movement
+// along the other axis. Returns nonzero, leaving m alone, if dir has both
+// directions of an axis.
+int
+pk_startdir(PkMovements *m, size_t ch, unsigned int dir)
+{
+	if (isconflicting(dir)) return -1;
+	if (!m->dir[ch]) m->held[ch] = 0;
+	if (dir & (PK_UP|PK_DOWN)) {
+		m->yrem[ch] = 0;
+		m->ycont[ch] = 0;
+	}
+	if (dir & PK_UP) {
+		m->dir[ch] &= ~PK_DOWN;
+		m->dir[ch] |= PK_UP;
+	}
+	if (dir & PK_DOWN) {
+		m->dir[ch] &= ~PK_UP;
+		m->dir[ch] |= PK_DOWN;
+	}
+	if (dir & (PK_LEFT|PK_RIGHT)) {
+		m->xrem[ch] = 0;
+		m->xcont[ch] = 0;
+	}
+	if (dir & PK_LEFT) {
+		m->dir[ch] &= ~PK_RIGHT;
+		m->dir[ch] |= PK_LEFT;
+	}
+	if (dir & PK_RIGHT) {
+		m->dir[ch] &= ~PK_LEFT;
+		m->dir[ch] |= PK_RIGHT;
+	}
+	return 0;
+}
+
+void
+pk_stopdir(PkMovements *m, size_t ch, unsigned int dir)
+{
+	m->dir[ch] &= ~dir;
+}
+
+// pk_pointerupdate advances every channel of m that moves the pointer by usec,
+// writing each channel's displacement to pu, which must have room for m->n
+// updates.
+void
+pk_pointerupdate(PkMovements *m, int usec, PkPointerUpdate *pu)
+{
+	for (size_t i = 0; i < m->n; i++) {
+		pu[i] = (PkPointerUpdate){0};
+		unsigned int dir = m->dir[i];
+		double xin = m->xin[i], yin = m->yin[i];
+		m->xin[i] = m->yin[i] = 0;
+		if (m->isscroll[i] || (!dir && !xin && !yin)) continue;
+		// xsign and ysign can be one of -1, 0, 1.
+		double xsign = ((dir & PK_RIGHT) ? 1 : 0) - ((dir & PK_LEFT) ? 1 : 0);
+		double ysign = ((dir & PK_UP) ? 1 : 0) - ((dir & PK_DOWN) ? 1 : 0);
+		double speed = 0;
+		if (dir) {
+			speed = m->basespeed[i] * m->mul[i] * pk_profilefactor(m->profile[i], m->held[i] + usec/2);
+			m->held[i] += usec;
+		}
+		double dx = speed * xsign * usec / 1e6 + xin + m->xrem[i];
+		double dy = - speed * ysign * usec / 1e6 + yin + m->yrem[i];
+		double dummy;
+		m->xrem[i] = modf(dx, &dummy);
+		m->yrem[i] = modf(dy, &dummy);
+		pu[i].dx = (int)dx;
+		pu[i].dy = (int)dy;
+	}
+}
+
+// pk_scrollupdate is like pk_pointerupdate, but for the channels of m that scroll.
+void
+pk_scrollupdate(PkMovements *m, int usec, PkScrollUpdate *su)
+{
+	for (size_t i = 0; i < m->n; i++) {
+		su[i] = (PkScrollUpdate){0};
+		unsigned int dir = m->dir[i];
+		if (!dir || !m->isscroll[i]) continue;
+		// xsign and ysign can be one of 0, 1.
+		double xsign = ((dir & (PK_LEFT|PK_RIGHT)) ? 1 : 0);
+		double ysign = ((dir & (PK_UP|PK_DOWN)) ? 1 : 0);
+		double speed = m->basespeed[i] * m->mul[i] * pk_profilefactor(m->profile[i], m->held[i] + usec/2);
+		m->held[i] += usec;
+		double dx = speed * xsign * usec / 1e6 + m->xrem[i];
+		double dy = speed * ysign * usec / 1e6 + m->yrem[i];
+		double dummy;
+		m->xrem[i] = modf(dx, &dummy);
+		m->yrem[i] = modf(dy, &dummy);
+
+		su[i].xbutton = (dir & PK_LEFT) ? PK_SCROLLLEFT : PK_SCROLLRIGHT;
+		su[i].ybutton = (dir & PK_UP) ? PK_SCROLLUP : PK_SCROLLDOWN;
+
+		su[i].xevents = abs((int)dx);
+		su[i].yevents = abs((int)dy);
+		// Scroll immediately after a scroll key is pressed, but adjust the
+		// remainder so the configured number of scroll events occur in the
+		// first second.
+		if (!su[i].xevents && (dir & (PK_LEFT|PK_RIGHT)) && !m->xcont[i]) {
+			su[i].xevents += 1;
+			m->xrem[i] -= 1;
+		}
+		if (!su[i].yevents && (dir & (PK_UP|PK_DOWN)) && !m->ycont[i]) {
+			su[i].yevents += 1;
+			m->yrem[i] -= 1;
+		}
+		m->xcont[i] = 1;
+		m->ycont[i] = 1;
+	}
+}
+
+// pk_throttlescroll limits su to max events per axis, carrying up to maxbacklog
+// of the excess over to later calls in t and dropping the rest.
+PkScrollUpdate
+pk_throttlescroll(PkThrottle *t, PkScrollUpdate su, int max, int maxbacklog)
+{
+	PkScrollUpdate out = {0};
+	out.xevents = throttleaxis(&t->xbacklog, &t->xbutton, su.xevents, su.xbutton,
+			max, maxbacklog, &t->dropped);
+	out.xbutton = t->xbutton;
+	out.yevents = throttleaxis(&t->ybacklog, &t->ybutton, su.yevents, su.ybutton,
+			max, maxbacklog, &t->dropped);
+	out.ybutton = t->ybutton;
+	return out;
+}
+
+static int
+throttleaxis(int *backlog, unsigned int *button, int n, unsigned int newbutton, int max, int maxbacklog, long *dropped)
+{
+	if (n && newbutton != *button) {
+		// Scrolling the other way drops what's left of the old direction.
+		*dropped += *backlog;
+		*backlog = 0;
+		*button = newbutton;
+	}
+	int total = n + *backlog;
+	int send = total < max ? total : max;
+	int left = total - send;
+	*backlog = left < maxbacklog ? left : maxbacklog;
+	*dropped += left - *backlog;
+	return send;
+}
+
+// pk_draininject moves events from r into m and v, the injected velocities of
+// m's channels, and copies up to maxbuttons button events to buttons,
+// returning how many. Velocities are integrated piecewise up to now, so
+// samples arriving faster than the frame rate aren't lost, with time scaled by
+// scale, which is how a stall policy limits them. Events for channels that
+// don't exist are dropped.
+size_t
+pk_draininject(InjectRing *r, PkMovements *m, PkVelocity *v, long long now, double scale, InjectEvent *buttons, size_t maxbuttons)
+{
+	size_t nbuttons = 0;
+	for (InjectEvent *ev; (ev = injectpeek(r));) {
+		size_t ch = ev->channel;
+		if (ch >= m->n) {
+			injectrelease(r);
+			continue;
+		}
+		switch (ev->type) {
+		case INJECT_VELOCITY: {
+			long long t = ev->usec;
+			if (t < v[ch].usec) t = v[ch].usec;
+			if (t > now) t = now;
+			m->xin[ch] += v[ch].x * (t - v[ch].usec) * scale / 1e6;
+			m->yin[ch] += v[ch].y * (t - v[ch].usec) * scale / 1e6;
+			v[ch] = (PkVelocity){ev->x, ev->y, t};
+			break;
+		}
+		case INJECT_DISPLACEMENT:
+			m->xin[ch] += ev->x;
+			m->yin[ch] += ev->y;
+			break;
+		case INJECT_BUTTON:
+			// Leave the rest for the next frame.
+			if (nbuttons == maxbuttons) goto done;
+			buttons[nbuttons++] = *ev;
+			break;
+		}
+		injectrelease(r);
+	}
+done:
+	for (size_t i = 0; i < m->n; i++) {
+		if (v[i].usec >= now) continue;
+		m->xin[i] += v[i].x * (now - v[i].usec) * scale / 1e6;
+		m->yin[i] += v[i].y * (now - v[i].usec) * scale / 1e6;
+		v[i].usec = now;
+	}
+	return nbuttons;
+}
+
+// pk_gridcell returns the given cell of r divided into cols by rows cells,
+// counting from the top-left cell in row-major order. Cell edges are rounded
+// down so the cells tile r exactly.
+PkRegion
+pk_gridcell(PkRegion r, int cols, int rows, int cell)
+{
+	int col = cell % cols;
+	int row = cell / cols;
+	int x0 = r.x + r.w * col / cols;
+	int x1 = r.x + r.w * (col + 1) / cols;
+	int y0 = r.y + r.h * row / rows;
+	int y1 = r.y + r.h * (row + 1) / rows;
+	return (PkRegion){x0, y0, x1 - x0, y1 - y0};
+}
+
+// pk_markwindowmoved updates the cached position of win in marks relative to it.
+void
+pk_markwindowmoved(PkMark *marks, size_t len, unsigned long win, int wx, int wy)
+{
+	for (size_t i = 0; i < len; i++) {
+		if (marks[i].win != win) continue;
+		marks[i].wx = wx;
+		marks[i].wy = wy;
+	}
+}
+
+// pk_markwindowgone makes marks relative to win absolute, at win's last known
+// position.
+void
+pk_markwindowgone(PkMark *marks, size_t len, unsigned long win)
+{
+	for (size_t i = 0; i < len; i++) {
+		PkMark *m = &marks[i];
+		if (m->win != win) continue;
+		m->x += m->wx;
+		m->y += m->wy;
+		m->win = 0;
+		m->wx = m->wy = 0;
+	}
+}
+
+// pk_macroappend adds s to m, growing it as needed up to max steps. Returns
+// nonzero if it's full or out of memory.
+int
+pk_macroappend(PkMacro *m, const PkMacroStep *s, size_t max)
+{
+	if (m->n == m->cap) {
+		size_t cap = m->cap ? 2 * m->cap : 256;
+		if (cap > max) cap = max;
+		if (cap <= m->n) return -1;
+		PkMacroStep *steps = realloc(m->steps, cap * sizeof *steps);
+		if (!steps) return -1;
+		m->steps = steps;
+		m->cap = cap;
+	}
+	m->steps[m->n++] = *s;
+	return 0;
+}
+
+// pk_macroplan writes the steps of m to out, which must have room for m->n, for
+// playback speed times faster than recorded. With collapse, each path a
+// pointer took between button events becomes a warp to where it ended, made
+// when the path started so the pointer waits at its destination for as long
+// as it took to get there. Returns the number of steps written.
+size_t
+pk_macroplan(const PkMacro *m, double speed, int collapse, PkMacroStep *out)
+{
+	if (speed <= 0) speed = 1;
+	size_t path[PK_MAX_CHANNELS]; // Index in out of each channel's warp, or n.
+	size_t n = 0;
+	for (size_t i = 0; i < PK_MAX_CHANNELS; i++) path[i] = m->n;
+	for (size_t i = 0; i < m->n; i++) {
+		PkMacroStep s = m->steps[i];
+		s.usec = s.usec / speed;
+		if (collapse && s.channel < PK_MAX_CHANNELS) {
+			if (s.op == PK_MACRO_BUTTON) {
+				path[s.channel] = m->n;
+			} else if (path[s.channel] != m->n) {
+				out[path[s.channel]].x = s.x;
+				out[path[s.channel]].y = s.y;
+				continue;
+			} else {
+				s.op = PK_MACRO_WARP;
+				path[s.channel] = n;
+			}
+		}
+		out[n++] = s;
+	}
+	return n;
+}
+
+// pk_addscroll combines two scroll updates for the same channel. Events in
+// opposite directions cancel out.
+PkScrollUpdate
+pk_addscroll(PkScrollUpdate a, PkScrollUpdate b)
+{
+	if (!a.xevents) {
+		a.xevents = b.xevents;
+		a.xbutton = b.xbutton;
+	} else if (b.xevents) {
+		a.xevents += (a.xbutton == b.xbutton) ? b.xevents : -b.xevents;
+		if (a.xevents < 0) {
+			a.xevents = -a.xevents;
+			a.xbutton = b.xbutton;
+		}
+	}
+	if (!a.yevents) {
+		a.yevents = b.yevents;
+		a.ybutton = b.ybutton;
+	} else if (b.yevents) {
+		a.yevents += (a.ybutton == b.ybutton) ? b.yevents : -b.yevents;
+		if (a.yevents < 0) {
+			a.yevents = -a.yevents;
+			a.ybutton = b.ybutton;
+		}
+	}
+	return a;
+}
+
+static int
+moving(const PkMovements *m)
+{
+	for (size_t i = 0; i < m->n; i++) {
+		if (m->dir[i]) return 1;
+	}
+	return 0;
+}
+
+// pk_builddispatch fills the empty entries of table, which maps keycodes to
+// bindings, with the unmodified bindings in keys for each keycode's keysym.
+// Earlier bindings take precedence, so building a layer's table and then
+// adding the base bindings makes keys the layer doesn't bind fall through.
+void
+pk_builddispatch(const PkKey **table, const unsigned long *keysyms, PkKey *keys, size_t nkeys)
+{
+	for (size_t i = 0; i < nkeys; i++) {
+		PkKey *key = &keys[i];
+		if (key->mod) continue;
+		for (size_t code = 0; code < PK_NKEYCODES; code++) {
+			if (keysyms[code] != key->keysym || table[code]) continue;
+			table[code] = key;
+		}
+	}
+}
+
+// pk_findchord returns the first of chords made of keysyms a and b, or if b is
+// 0, the first that a is part of. Returns NULL if there's none.
+const PkChord *
+pk_findchord(const PkChord *chords, size_t n, unsigned long a, unsigned long b)
+{
+	for (size_t i = 0; i < n; i++) {
+		const unsigned long *k = chords[i].keysyms;
+		if (!b && (k[0] == a || k[1] == a)) return &chords[i];
+		if ((k[0] == a && k[1] == b) || (k[0] == b && k[1] == a)) return &chords[i];
+	}
+	return NULL;
+}
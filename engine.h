@@ -0,0 +1,234 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+// The movement engine: integrating key, scroll and injected movement into
+// pointer motion and scroll events, and compiling bindings into dispatch
+// tables.
+//
+// It has no globals and doesn't depend on Xlib, so it can be built into
+// libptrkeys and embedded in other programs, such as window managers, that
+// deliver the motion themselves. ptrkeys is an X frontend on top of it.
+
+#include <stddef.h>
+
+#include "inject.h"
+
+#define PK_PROFILE_TABLE_LEN 64
+#define PK_NKEYCODES 256
+#define PK_MAX_CHANNELS 8
+#define PK_MAX_INJECT_BUTTONS 64 // Per frame.
+
+enum PkDirection {
+	PK_UP    = (1<<0),
+	PK_DOWN  = (1<<1),
+	PK_LEFT  = (1<<2),
+	PK_RIGHT = (1<<3),
+};
+
+#define PK_DIRMASK (PK_UP|PK_DOWN|PK_LEFT|PK_RIGHT)
+
+// Or PK_PROFILE(n) into a direction to use profiles[n] instead of the movement's
+// default profile.
+#define PK_PROFILE_SHIFT 8
+#define PK_PROFILE(n) (((n)+1) << PK_PROFILE_SHIFT)
+
+// Scroll wheel buttons, as numbered by X.
+enum PkWheel {
+	PK_SCROLLUP = 4,
+	PK_SCROLLDOWN = 5,
+	PK_SCROLLLEFT = 6,
+	PK_SCROLLRIGHT = 7,
+};
+
+// A PkProfile is a velocity curve: a speed factor as a function of how long a
+// movement has been held. It ramps linearly from start to cruise over rampms,
+// or follows curve, whose points are spaced evenly over rampms.
+typedef struct {
+	double start, cruise;
+	int rampms;
+	const double *curve;
+	size_t curvelen;
+} PkProfile;
+
+// A PkProfileTable is a PkProfile sampled by pk_buildprofile(), so a frame only costs
+// a lookup and an interpolation.
+typedef struct {
+	long rampusec;
+	double f[PK_PROFILE_TABLE_LEN];
+} PkProfileTable;
+
+// PkMovements holds the movement state of each channel, one per pointer, as a
+// structure of arrays so a frame updates every channel in one loop.
+typedef struct {
+	size_t n; // Channels in use.
+	double basespeed[PK_MAX_CHANNELS];
+	unsigned int dir[PK_MAX_CHANNELS]; // Bits from enum PkDirection.
+	double mul[PK_MAX_CHANNELS];
+	double xrem[PK_MAX_CHANNELS], yrem[PK_MAX_CHANNELS]; // Subunit remainders.
+	int xcont[PK_MAX_CHANNELS], ycont[PK_MAX_CHANNELS]; // Continuing a movement?
+	const PkProfileTable *profile[PK_MAX_CHANNELS]; // NULL for constant speed.
+	long held[PK_MAX_CHANNELS]; // Microseconds since the movement started.
+	int isscroll[PK_MAX_CHANNELS]; // Scroll instead of moving the pointer?
+	double xin[PK_MAX_CHANNELS], yin[PK_MAX_CHANNELS]; // Injected displacement.
+} PkMovements;
+
+// A PkVelocity is the last injected velocity of a channel, in px/s, and the
+// time up to which it's been applied.
+typedef struct {
+	double x, y;
+	long long usec;
+} PkVelocity;
+
+typedef struct {
+	int dx, dy;
+} PkPointerUpdate;
+
+typedef struct {
+	int xevents, yevents;
+	unsigned int xbutton, ybutton;
+} PkScrollUpdate;
+
+// A PkThrottle is the scroll events of a channel held back by flood control.
+typedef struct {
+	int xbacklog, ybacklog;
+	unsigned int xbutton, ybutton;
+	long dropped;
+} PkThrottle;
+
+// A PkStallPolicy says what a PkEngine does with a step longer than its
+// maxstepusec, which happens when the frontend stalls while a key is held.
+enum PkStallPolicy {
+	PK_STALL_CLAMP, // Integrate maxstepusec and forget the rest.
+	PK_STALL_SPREAD, // Catch up over later steps, at most maxstepusec per step.
+	PK_STALL_DROP, // Integrate nothing for the step.
+};
+
+// A PkEngine is the movement state of a set of channels. Fill in its settings
+// and call enginereset before using it.
+typedef struct {
+	double basespeed, basescroll; // px/s and scroll events/s.
+	const PkProfileTable *profiles;
+	size_t nprofiles;
+	size_t ptrprofile, scrollprofile; // Defaults, indexes into profiles.
+	int maxbacklog; // Scroll events carried over to later frames.
+	int maxstepusec; // Longest step integrated at once, or 0 for no limit.
+	int stallpolicy; // From enum PkStallPolicy.
+	InjectRing *inject; // Drained each step, if not NULL.
+	// State:
+	PkMovements ptr, scroll; // Pointer keys and scroll keys.
+	PkVelocity velocity[PK_MAX_CHANNELS]; // Injected velocity of each channel.
+	PkThrottle throttle[PK_MAX_CHANNELS];
+	double appmul; // Multiplier set by enginesetspeeds, part of every mul.
+	long long debt; // Microseconds PK_STALL_SPREAD has yet to catch up on.
+	long stalls; // Steps longer than maxstepusec.
+	long long stalledusec; // How much longer they were, in total.
+} PkEngine;
+
+// A PkFrame is what a step of a PkEngine asks the frontend to do, in order:
+// scroll, move each channel's pointer, then press and release buttons.
+typedef struct {
+	PkScrollUpdate scroll[PK_MAX_CHANNELS];
+	PkPointerUpdate ptr[PK_MAX_CHANNELS];
+	InjectEvent buttons[PK_MAX_INJECT_BUTTONS];
+	size_t nbuttons;
+	int isscrolling; // Scroll events were sent or are backlogged.
+	long dropped; // Scroll events dropped by throttling.
+} PkFrame;
+
+void enginereset(PkEngine *e, size_t nchannels);
+int enginestartmove(PkEngine *e, size_t ch, unsigned int dir);
+void enginestopmove(PkEngine *e, size_t ch, unsigned int dir);
+int enginestartscroll(PkEngine *e, size_t ch, unsigned int dir);
+void enginestopscroll(PkEngine *e, size_t ch, unsigned int dir);
+void enginesetm2s(PkEngine *e, size_t ch, int enable);
+void enginemulspeed(PkEngine *e, size_t ch, double factor);
+void enginesetspeeds(PkEngine *e, double basespeed, double basescroll, double mul);
+int enginestep(PkEngine *e, int usec, long long now, int maxscroll, PkFrame *f);
+
+// Lower-level parts of the engine.
+void pk_buildprofile(PkProfileTable *t, const PkProfile *p);
+double pk_profilefactor(const PkProfileTable *t, long usec);
+void pk_initmovements(PkMovements *m, size_t n, double basespeed, int isscroll);
+int pk_startdir(PkMovements *m, size_t ch, unsigned int dir);
+void pk_stopdir(PkMovements *m, size_t ch, unsigned int dir);
+void pk_pointerupdate(PkMovements *m, int usec, PkPointerUpdate *pu);
+void pk_scrollupdate(PkMovements *m, int usec, PkScrollUpdate *su);
+PkScrollUpdate pk_addscroll(PkScrollUpdate a, PkScrollUpdate b);
+PkScrollUpdate pk_throttlescroll(PkThrottle *t, PkScrollUpdate su, int max, int maxbacklog);
+size_t pk_draininject(InjectRing *r, PkMovements *m, PkVelocity *v, long long now, double scale, InjectEvent *buttons, size_t maxbuttons);
+
+typedef struct {
+	int x, y, w, h;
+} PkRegion;
+
+PkRegion pk_gridcell(PkRegion r, int cols, int rows, int cell);
+
+// A PkMark is a saved pointer position. Unless win is 0, x and y are relative
+// to the top-level window win, whose last known position is wx, wy.
+typedef struct {
+	int isset;
+	int x, y;
+	unsigned long win;
+	int wx, wy;
+} PkMark;
+
+void pk_markwindowmoved(PkMark *marks, size_t len, unsigned long win, int wx, int wy);
+void pk_markwindowgone(PkMark *marks, size_t len, unsigned long win);
+
+enum PkMacroOp {
+	PK_MACRO_MOVE, // Relative motion by dx, dy.
+	PK_MACRO_WARP, // Absolute motion.
+	PK_MACRO_BUTTON,
+};
+
+// A PkMacroStep is a recorded action. x, y is where the channel's pointer was
+// afterwards, for any op.
+typedef struct {
+	long long usec; // Since recording started.
+	unsigned char op, channel, press;
+	unsigned int button;
+	int dx, dy;
+	int x, y;
+} PkMacroStep;
+
+// A PkMacro is a recording of the motion and button events sent to pointers.
+typedef struct {
+	PkMacroStep *steps;
+	size_t n, cap;
+} PkMacro;
+
+int pk_macroappend(PkMacro *m, const PkMacroStep *s, size_t max);
+size_t pk_macroplan(const PkMacro *m, double speed, int collapse, PkMacroStep *out);
+
+typedef union {
+	int i;
+	unsigned int ui;
+	unsigned long ul;
+	double f;
+	const void *v;
+} PkArg;
+
+// A PkKey is a binding. keysym and mod are X keysyms and modifier masks.
+typedef struct {
+	unsigned int mod;
+	unsigned long keysym;
+	unsigned int opts;
+	void (*pressfunc)(const PkArg *);
+	const PkArg pressarg;
+	void (*releasefunc)(const PkArg *);
+	const PkArg releasearg;
+} PkKey;
+
+void pk_builddispatch(const PkKey **table, const unsigned long *keysyms, PkKey *keys, size_t nkeys);
+
+// A PkChord is a binding for two keys pressed together, in either order.
+typedef struct {
+	unsigned long keysyms[2];
+	void (*pressfunc)(const PkArg *);
+	const PkArg pressarg;
+	void (*releasefunc)(const PkArg *);
+	const PkArg releasearg;
+} PkChord;
+
+const PkChord *pk_findchord(const PkChord *chords, size_t n, unsigned long a, unsigned long b);
+
+#endif
@@ -0,0 +1,778 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "engine.h"
+#include "inject.h"
+#include "prove.h"
+#include "jot.h"
+
+#define LEN(X) (sizeof X / sizeof X[0])
+
+int jottrace = 1;
+
+static void
+nop(const PkArg *arg)
+{
+	(void)arg;
+}
+
+int
+test_pointerupdate()
+{
+	int rc = 0;
+	double base = 100;
+	struct frame {
+		unsigned int startdirs, stopdirs;
+		double mul;
+		int usec;
+		PkPointerUpdate want;
+	};
+
+	struct frame each_dir_one_frame[] = {
+		{PK_RIGHT, 0,     1, 1e6, {base,  0}},
+		{PK_LEFT,  PK_RIGHT, 1, 1e6, {-base, 0}},
+		{PK_UP,    PK_LEFT,  1, 1e6, {0,     -base}},
+		{PK_DOWN,  PK_UP,    1, 1e6, {0,     base}},
+		{0,     PK_DOWN,  1, 1e6, {0,     0}},
+	};
+
+	struct frame subpixel_movements_add_up[] = {
+		{PK_RIGHT, 0, 1, 3e3, {0, 0}},
+		{0,     0, 1, 3e3, {0, 0}},
+		{0,     0, 1, 3e3, {0, 0}},
+		{0,     0, 1, 3e3, {1, 0}},
+	};
+
+	struct frame big_and_small_multipliers[] = {
+		{PK_RIGHT|PK_UP,  0, 50,      10e3, {50, -50}},
+		{0,         0, 50,      10e3, {50, -50}},
+		{PK_DOWN|PK_LEFT, 0, 1.0/5.0, 10e3, {0,  0}},
+		{0,         0, 1.0/5.0, 10e3, {0,  0}},
+		{0,         0, 1.0/5.0, 10e3, {0,  0}},
+		{0,         0, 1.0/5.0, 10e3, {0,  0}},
+		{0,         0, 1.0/5.0, 10e3, {-1, 1}},
+	};
+
+	struct test {
+		struct frame *frames;
+		size_t len;
+	};
+	struct test tests[] = {
+		{each_dir_one_frame, LEN(each_dir_one_frame)},
+		{subpixel_movements_add_up, LEN(subpixel_movements_add_up)},
+		{big_and_small_multipliers, LEN(big_and_small_multipliers)},
+	};
+	for (size_t i = 0; i < LEN(tests); i++) {
+		struct test test = tests[i];
+		PkMovements mv;
+		pk_initmovements(&mv, 1, base, 0);
+		for (size_t j = 0; j < test.len; j++) {
+			struct frame frame = test.frames[j];
+			pk_startdir(&mv, 0, frame.startdirs);
+			pk_stopdir(&mv, 0, frame.stopdirs);
+			mv.mul[0] = frame.mul;
+			PkPointerUpdate got;
+			pk_pointerupdate(&mv, frame.usec, &got);
+			PkPointerUpdate want = frame.want;
+			if (got.dx != want.dx || got.dy != want.dy) {
+				rc = 1;
+				jotf("mv: base=%.2g dir=%u mul=%.2g xrem=%.2g yrem=%.2g xcont=%d ycont=%d",
+						mv.basespeed[0], mv.dir[0], mv.mul[0], mv.xrem[0], mv.yrem[0], mv.xcont[0], mv.ycont[0]);
+				jotf("test=%zu frame=%zu got={dx=%d dy=%d}, want={dx=%d dy=%d}",
+						i, j, got.dx, got.dy, want.dx, want.dy);
+				break;
+			}
+		}
+	}
+	return rc;
+}
+
+int
+test_scrollupdate()
+{
+	int rc = 0;
+	double base = 10;
+	struct frame {
+		unsigned int startdirs, stopdirs;
+		double mul;
+		int usec;
+		PkScrollUpdate want;
+	};
+
+	struct frame each_dir_one_frame[] = {
+		{PK_RIGHT, 0,     1, 1e6, {base, 0,    PK_SCROLLRIGHT, 0}},
+		{PK_LEFT,  PK_RIGHT, 1, 1e6, {base, 0,    PK_SCROLLLEFT,  0}},
+		{PK_UP,    PK_LEFT,  1, 1e6, {0,    base, 0,           PK_SCROLLUP}},
+		{PK_DOWN,  PK_UP,    1, 1e6, {0,    base, 0,           PK_SCROLLDOWN}},
+		{0,     PK_DOWN,  1, 1e6, {0,    0,    0,           0}},
+	};
+
+	struct frame event_distribution[] = {
+		// One event right away...
+		{PK_RIGHT, 0, 1, 40e3,  {1, 0, PK_SCROLLRIGHT, 0}},
+		{0,     0, 1, 40e3,  {0, 0, 0,           0}},
+		{0,     0, 1, 40e3,  {0, 0, 0,           0}},
+		{0,     0, 1, 40e3,  {0, 0, 0,           0}},
+		// ...one 2/base seconds = 200ms later.
+		{0,     0, 1, 40e3,  {1, 0, PK_SCROLLRIGHT, 0}},
+		{0,     0, 1, 40e3,  {0, 0, 0,           0}},
+		// ...adding up to base*mul events happening in the first second.
+		{0,     0, 1, 760e3, {8, 0, PK_SCROLLRIGHT, 0}},
+	};
+
+	struct frame big_and_small_multipliers[] = {
+		// base*mul = 10*20 = 200 events per second; 200 * 0.01s = 2
+		{PK_RIGHT|PK_UP,  0, 20,      10e3,  {2, 2, PK_SCROLLRIGHT, PK_SCROLLUP}},  
+		{0,         0, 20,      10e3,  {2, 2, PK_SCROLLRIGHT, PK_SCROLLUP}},  
+		// base/mul = 10/5 = 2 events per second
+		{PK_DOWN|PK_LEFT, 0, 1.0/5.0, 10e3,  {1, 1, PK_SCROLLLEFT,  PK_SCROLLDOWN}},
+		{0,         0, 1.0/5.0, 10e3,  {0, 0, 0,           0}},         
+		{0,         0, 1.0/5.0, 970e3, {0, 0, 0,           0}},
+		{0,         0, 1.0/5.0, 10e3,  {1, 1, PK_SCROLLLEFT,  PK_SCROLLDOWN}},
+	};
+
+	struct test {
+		struct frame *frames;
+		size_t len;
+	};
+	struct test tests[] = {
+		{each_dir_one_frame, LEN(each_dir_one_frame)},
+		{event_distribution, LEN(event_distribution)},
+		{big_and_small_multipliers, LEN(big_and_small_multipliers)},
+	};
+	for (size_t i = 0; i < LEN(tests); i++) {
+		struct test test = tests[i];
+		PkMovements mv;
+		pk_initmovements(&mv, 1, base, 1);
+		for (size_t j = 0; j < test.len; j++) {
+			struct frame frame = test.frames[j];
+			pk_startdir(&mv, 0, frame.startdirs);
+			pk_stopdir(&mv, 0, frame.stopdirs);
+			mv.mul[0] = frame.mul;
+			PkScrollUpdate got;
+			pk_scrollupdate(&mv, frame.usec, &got);
+			PkScrollUpdate want = frame.want;
+			if (got.xevents != want.xevents
+			|| got.yevents != want.yevents
+			|| (want.xevents && got.xbutton != want.xbutton)
+			|| (want.yevents && got.ybutton != want.ybutton)) {
+				rc = 1;
+				jotf("mv: base=%.2g dir=%u mul=%.2g xrem=%.2g yrem=%.2g xcont=%d ycont=%d",
+						mv.basespeed[0], mv.dir[0], mv.mul[0], mv.xrem[0], mv.yrem[0], mv.xcont[0], mv.ycont[0]);
+				jotf("test=%zu frame=%zu got={x=%d xbut=%d y=%d ybut=%d}, want={x=%d xbut=%d y=%d ybut=%d}",
+						i, j,
+						got.xevents, got.xbutton, got.yevents, got.ybutton,
+						want.xevents, want.xbutton, want.yevents, want.ybutton);
+				break;
+			}
+		}
+	}
+	return rc;
+}
+
+int
+test_channels()
+{
+	int rc = 0;
+	// Channels move independently, and a channel in move2scroll mode only
+	// produces scroll updates.
+	PkMovements mv;
+	pk_initmovements(&mv, 3, 100, 0);
+	mv.isscroll[2] = 1;
+	mv.basespeed[2] = 10;
+	pk_startdir(&mv, 0, PK_RIGHT);
+	mv.mul[0] = 2;
+	pk_startdir(&mv, 2, PK_UP);
+	PkPointerUpdate pu[3];
+	PkScrollUpdate su[3];
+	pk_pointerupdate(&mv, 1e6, pu);
+	pk_scrollupdate(&mv, 1e6, su);
+	PkPointerUpdate wantpu[] = {{200, 0}, {0, 0}, {0, 0}};
+	int wantsu[] = {0, 0, 10};
+	for (size_t i = 0; i < LEN(pu); i++) {
+		if (pu[i].dx != wantpu[i].dx || pu[i].dy != wantpu[i].dy) {
+			rc = 1;
+			jotf("channel=%zu got={dx=%d dy=%d} want={dx=%d dy=%d}",
+					i, pu[i].dx, pu[i].dy, wantpu[i].dx, wantpu[i].dy);
+		}
+		if (su[i].yevents != wantsu[i] || su[i].xevents) {
+			rc = 1;
+			jotf("channel=%zu got={x=%d y=%d} want={x=0 y=%d}",
+					i, su[i].xevents, su[i].yevents, wantsu[i]);
+		}
+	}
+	return rc;
+}
+
+// Both directions of an axis are refused rather than fatal, since the engine
+// may be embedded in a window manager.
+int
+test_startdir_conflict()
+{
+	int rc = 0;
+	PkMovements mv;
+	pk_initmovements(&mv, 1, 100, 0);
+	pk_startdir(&mv, 0, PK_RIGHT);
+	unsigned int dirs[] = {PK_UP|PK_DOWN, PK_LEFT|PK_RIGHT, PK_UP|PK_LEFT|PK_RIGHT};
+	for (size_t i = 0; i < LEN(dirs); i++) {
+		if (!pk_startdir(&mv, 0, dirs[i]) || mv.dir[0] != PK_RIGHT) {
+			rc = 1;
+			jotf("dir=%#x: accepted, or changed the movement to %#x", dirs[i], mv.dir[0]);
+		}
+	}
+	PkEngine e = {.basespeed=100, .basescroll=10};
+	enginereset(&e, 1);
+	if (!enginestartmove(&e, 0, PK_UP|PK_DOWN) || !enginestartscroll(&e, 0, PK_LEFT|PK_RIGHT)
+	|| e.ptr.dir[0] || e.scroll.dir[0]) {
+		rc = 1;
+		jot("engine accepted conflicting directions");
+	}
+	return rc;
+}
+
+int
+test_draininject()
+{
+	int rc = 0;
+	InjectRing *r = malloc(sizeof *r);
+	if (!r) die("out of memory");
+	injectinit(r);
+	InjectEvent events[] = {
+		{0, INJECT_VELOCITY,     0, 0, 0, 1000, 100, 0},
+		{0, INJECT_VELOCITY,     0, 0, 0, 1500, 0, 0},  // 0.05px
+		{0, INJECT_DISPLACEMENT, 1, 0, 0, 0, 2.5, -1},
+		{0, INJECT_BUTTON,       1, 1, 1, 0, 0, 0},
+		{0, INJECT_DISPLACEMENT, 7, 0, 0, 0, 50, 50}, // No such channel.
+		{0, INJECT_VELOCITY,     0, 0, 0, 2000, 1000, 0},
+	};
+	for (size_t i = 0; i < LEN(events); i++) {
+		unsigned int pos;
+		InjectEvent *ev = injectreserve(r, &pos);
+		unsigned int seq = ev->seq;
+		*ev = events[i];
+		ev->seq = seq;
+		injectcommit(r, ev, pos);
+	}
+	PkMovements mv;
+	pk_initmovements(&mv, 2, 100, 0);
+	PkVelocity v[2] = {{0}};
+	InjectEvent buttons[4];
+	// The last velocity applies until now: 1000px/s * 1ms = 1px.
+	size_t n = pk_draininject(r, &mv, v, 3000, 1, buttons, LEN(buttons));
+	if (n != 1 || buttons[0].channel != 1 || buttons[0].button != 1 || !buttons[0].press) {
+		rc = 1;
+		jotf("got %zu buttons, want button 1 press on channel 1", n);
+	}
+	PkPointerUpdate pu[2];
+	pk_pointerupdate(&mv, 1000, pu);
+	if (pu[0].dx != 1 || pu[0].dy != 0 || pu[1].dx != 2 || pu[1].dy != -1) {
+		rc = 1;
+		jotf("got {%d %d} {%d %d}, want {1 0} {2 -1}", pu[0].dx, pu[0].dy, pu[1].dx, pu[1].dy);
+	}
+	// Sub-pixel remainders carry over, as for key movement.
+	int want[] = {0, 1};
+	for (size_t i = 0; i < LEN(want); i++) {
+		pk_draininject(r, &mv, v, 3500 + 500*i, 1, buttons, LEN(buttons));
+		pk_pointerupdate(&mv, 500, pu);
+		if (pu[0].dx != want[i]) {
+			rc = 1;
+			jotf("frame=%zu got dx=%d want %d", i, pu[0].dx, want[i]);
+		}
+	}
+	free(r);
+	return rc;
+}
+
+int
+test_throttlescroll()
+{
+	int rc = 0;
+	struct frame {
+		int max;
+		PkScrollUpdate su;
+		PkScrollUpdate want;
+		int wantbacklog;
+	};
+	// Flooding at 10 events per frame with room for 4, then releasing.
+	struct frame frames[] = {
+		{4, {10, 0, PK_SCROLLRIGHT, 0}, {4, 0, PK_SCROLLRIGHT, 0}, 6},
+		{4, {10, 0, PK_SCROLLRIGHT, 0}, {4, 0, PK_SCROLLRIGHT, 0}, 8},
+		{4, {0,  0, 0,           0}, {4, 0, PK_SCROLLRIGHT, 0}, 4},
+		// Nothing is sent while the xserver is lagging.
+		{0, {0,  2, 0,   PK_SCROLLUP},  {0, 0, PK_SCROLLRIGHT, 0}, 4},
+		// Reversing drops the backlog.
+		{4, {1,  0, PK_SCROLLLEFT,  0}, {1, 2, PK_SCROLLLEFT,  PK_SCROLLUP}, 0},
+		{4, {0,  0, 0,           0}, {0, 0, 0,           0}, 0},
+	};
+	PkThrottle t = {0};
+	for (size_t i = 0; i < LEN(frames); i++) {
+		struct frame f = frames[i];
+		PkScrollUpdate got = pk_throttlescroll(&t, f.su, f.max, 8);
+		if (got.xevents != f.want.xevents || got.yevents != f.want.yevents
+		|| (got.xevents && got.xbutton != f.want.xbutton)
+		|| (got.yevents && got.ybutton != f.want.ybutton)
+		|| t.xbacklog != f.wantbacklog) {
+			rc = 1;
+			jotf("frame=%zu got={x=%d xbut=%d y=%d ybut=%d} backlog=%d, want={x=%d xbut=%d y=%d ybut=%d} backlog=%d",
+					i, got.xevents, got.xbutton, got.yevents, got.ybutton, t.xbacklog,
+					f.want.xevents, f.want.xbutton, f.want.yevents, f.want.ybutton, f.wantbacklog);
+		}
+	}
+	// 21 horizontal events were asked for: 13 sent, 4 dropped on overflow,
+	// and 4 dropped on reversing.
+	if (t.dropped != 8) {
+		rc = 1;
+		jotf("dropped=%ld want 8", t.dropped);
+	}
+	return rc;
+}
+
+int
+test_profilefactor()
+{
+	int rc = 0;
+	static const double curve[] = {0, 2, 4};
+	PkProfile profiles[] = {
+		{0.5, 1.5, 100, NULL, 0},
+		{0, 0, 100, curve, LEN(curve)},
+		{1, 1, 0, NULL, 0},
+	};
+	PkProfileTable ramp, custom, constant;
+	pk_buildprofile(&ramp, &profiles[0]);
+	pk_buildprofile(&custom, &profiles[1]);
+	pk_buildprofile(&constant, &profiles[2]);
+	struct test {
+		const PkProfileTable *profile;
+		long usec;
+		double want;
+	};
+	struct test tests[] = {
+		{NULL,      50e3,  1},
+		{&constant, 0,     1},
+		{&constant, 1e6,   1},
+		{&ramp,     0,     0.5},
+		{&ramp,     50e3,  1},
+		{&ramp,     100e3, 1.5},
+		{&ramp,     5e6,   1.5},
+		{&custom,   25e3,  1},
+		{&custom,   75e3,  3},
+		{&custom,   200e3, 4},
+	};
+	for (size_t i = 0; i < LEN(tests); i++) {
+		struct test test = tests[i];
+		double got = pk_profilefactor(test.profile, test.usec);
+		if (fabs(got - test.want) > 1e-9) {
+			rc = 1;
+			jotf("test=%zu got=%g want=%g", i, got, test.want);
+		}
+	}
+	return rc;
+}
+
+int
+test_pointerupdate_profile()
+{
+	int rc = 0;
+	// Speed ramps from 0 to 200px/s over 100ms, then cruises. Each frame uses
+	// the speed at its midpoint.
+	PkProfile profile = {0, 2, 100, NULL, 0};
+	PkProfileTable ramp;
+	pk_buildprofile(&ramp, &profile);
+	PkMovements mv;
+	pk_initmovements(&mv, 1, 100, 0);
+	mv.profile[0] = &ramp;
+	pk_startdir(&mv, 0, PK_RIGHT);
+	int want[] = {2, 8, 10, 10};
+	for (size_t i = 0; i < LEN(want); i++) {
+		PkPointerUpdate got;
+		pk_pointerupdate(&mv, 50e3, &got);
+		if (got.dx != want[i]) {
+			rc = 1;
+			jotf("frame=%zu held=%ld got dx=%d want=%d", i, mv.held[0], got.dx, want[i]);
+		}
+	}
+	// Starting again from rest restarts the ramp.
+	pk_stopdir(&mv, 0, PK_RIGHT);
+	pk_startdir(&mv, 0, PK_LEFT);
+	if (mv.held[0] != 0) {
+		rc = 1;
+		jotf("held=%ld after restart, want 0", mv.held[0]);
+	}
+	return rc;
+}
+
+int
+test_gridcell()
+{
+	int rc = 0;
+	struct test {
+		PkRegion r;
+		int cols, rows, cell;
+		PkRegion want;
+	};
+	struct test tests[] = {
+		{{0, 0, 3840, 2160}, 2, 2, 0, {0, 0, 1920, 1080}},
+		{{0, 0, 3840, 2160}, 2, 2, 3, {1920, 1080, 1920, 1080}},
+		{{100, 50, 10, 10}, 3, 3, 4, {103, 53, 3, 3}},  // Uneven cells tile r.
+		{{100, 50, 10, 10}, 3, 3, 8, {106, 56, 4, 4}},
+		{{7, 7, 1, 1}, 3, 3, 0, {7, 7, 0, 0}},
+	};
+	for (size_t i = 0; i < LEN(tests); i++) {
+		struct test test = tests[i];
+		PkRegion got = pk_gridcell(test.r, test.cols, test.rows, test.cell);
+		PkRegion want = test.want;
+		if (got.x != want.x || got.y != want.y || got.w != want.w || got.h != want.h) {
+			rc = 1;
+			jotf("test=%zu got={%d %d %d %d} want={%d %d %d %d}", i,
+					got.x, got.y, got.w, got.h, want.x, want.y, want.w, want.h);
+		}
+	}
+	return rc;
+}
+
+int
+test_markwindow()
+{
+	int rc = 0;
+	PkMark marks[] = {
+		{1, 10, 20, 0, 0, 0},
+		{1, 5, 5, 42, 100, 100},
+		{1, 7, 7, 43, 300, 300},
+	};
+	pk_markwindowmoved(marks, LEN(marks), 42, 200, 50);
+	pk_markwindowgone(marks, LEN(marks), 43);
+	PkMark want[] = {
+		{1, 10, 20, 0, 0, 0},
+		{1, 5, 5, 42, 200, 50},
+		{1, 307, 307, 0, 0, 0},
+	};
+	for (size_t i = 0; i < LEN(marks); i++) {
+		PkMark got = marks[i];
+		PkMark w = want[i];
+		if (got.x != w.x || got.y != w.y || got.win != w.win || got.wx != w.wx || got.wy != w.wy) {
+			rc = 1;
+			jotf("mark=%zu got={%d %d %lu %d %d} want={%d %d %lu %d %d}", i,
+					got.x, got.y, got.win, got.wx, got.wy,
+					w.x, w.y, w.win, w.wx, w.wy);
+		}
+	}
+	return rc;
+}
+
+int
+test_macroplan()
+{
+	int rc = 0;
+	PkMacro m = {0};
+	PkMacroStep steps[] = {
+		{0, PK_MACRO_MOVE, 0, 0, 0, 5, 0, 105, 100},
+		{1000, PK_MACRO_MOVE, 1, 0, 0, 0, 5, 10, 15},
+		{2000, PK_MACRO_MOVE, 0, 0, 0, 5, 0, 110, 100},
+		{3000, PK_MACRO_BUTTON, 0, 1, 1, 0, 0, 110, 100},
+		{4000, PK_MACRO_WARP, 0, 0, 0, 0, 0, 300, 300},
+		{5000, PK_MACRO_BUTTON, 0, 0, 1, 0, 0, 300, 300},
+	};
+	for (size_t i = 0; i < LEN(steps); i++) {
+		if (pk_macroappend(&m, &steps[i], 4) != (i >= 4 ? -1 : 0)) {
+			rc = 1;
+			jotf("step=%zu: wrong result appending to a macro holding %zu of 4", i, m.n);
+		}
+	}
+	m.n = 0;
+	for (size_t i = 0; i < LEN(steps); i++) pk_macroappend(&m, &steps[i], 1000);
+	PkMacroStep out[LEN(steps)];
+
+	// Playback at double speed keeps every step.
+	size_t n = pk_macroplan(&m, 2, 0, out);
+	if (n != LEN(steps) || out[5].usec != 2500 || out[0].op != PK_MACRO_MOVE) {
+		rc = 1;
+		jotf("uncollapsed: n=%zu last at %lldus", n, out[n-1].usec);
+	}
+
+	// Collapsed, channel 0's path becomes a warp to its end, at its start.
+	struct {
+		long long usec;
+		unsigned char op, channel;
+		int x, y;
+	} want[] = {
+		{0, PK_MACRO_WARP, 0, 110, 100},
+		{1000, PK_MACRO_WARP, 1, 10, 15},
+		{3000, PK_MACRO_BUTTON, 0, 110, 100},
+		{4000, PK_MACRO_WARP, 0, 300, 300},
+		{5000, PK_MACRO_BUTTON, 0, 300, 300},
+	};
+	n = pk_macroplan(&m, 1, 1, out);
+	if (n != LEN(want)) {
+		rc = 1;
+		jotf("collapsed: got %zu steps, want %zu", n, LEN(want));
+		n = n < LEN(want) ? n : LEN(want);
+	}
+	for (size_t i = 0; i < n; i++) {
+		PkMacroStep got = out[i];
+		if (got.usec != want[i].usec || got.op != want[i].op || got.channel != want[i].channel
+				|| got.x != want[i].x || got.y != want[i].y) {
+			rc = 1;
+			jotf("step=%zu got={%lld %d %d %d %d} want={%lld %d %d %d %d}", i,
+					got.usec, got.op, got.channel, got.x, got.y,
+					want[i].usec, want[i].op, want[i].channel, want[i].x, want[i].y);
+		}
+	}
+	free(m.steps);
+	return rc;
+}
+
+int
+test_builddispatch()
+{
+	int rc = 0;
+	unsigned long w = 'w', a = 'a'; // Latin-1 keysyms are their codepoints.
+	unsigned int mod4 = 1<<6;
+	PkKey base[] = {
+		{0,    w, 0, nop, {.ui=PK_UP},   nop,  {.ui=PK_UP}},
+		{mod4, w, 0, nop, {0},        NULL, {0}},
+		{0,    a, 0, nop, {.ui=PK_LEFT}, nop,  {.ui=PK_LEFT}},
+		{0,    a, 0, nop, {0},        NULL, {0}},
+	};
+	PkKey layer[] = {
+		{0, w, 0, nop, {.ui=PK_DOWN}, nop, {.ui=PK_DOWN}},
+	};
+	unsigned long keysyms[PK_NKEYCODES] = {0};
+	keysyms[25] = w;
+	keysyms[38] = a;
+	keysyms[100] = a;  // Several keycodes can have the same keysym.
+	const PkKey *basetable[PK_NKEYCODES] = {0};
+	const PkKey *layertable[PK_NKEYCODES] = {0};
+	pk_builddispatch(basetable, keysyms, base, LEN(base));
+	pk_builddispatch(layertable, keysyms, layer, LEN(layer));
+	pk_builddispatch(layertable, keysyms, base, LEN(base));
+	struct test {
+		const PkKey **table;
+		int code;
+		const PkKey *want;
+	};
+	struct test tests[] = {
+		{basetable, 25, &base[0]},  // Modified bindings are skipped.
+		{basetable, 38, &base[2]},  // Earlier bindings win.
+		{basetable, 100, &base[2]},
+		{basetable, 26, NULL},
+		{layertable, 25, &layer[0]},
+		{layertable, 38, &base[2]}, // Falls through to the base bindings.
+	};
+	for (size_t i = 0; i < LEN(tests); i++) {
+		struct test test = tests[i];
+		if (test.table[test.code] != test.want) {
+			rc = 1;
+			jotf("test=%zu code=%d: got %p want %p", i, test.code,
+					(void *)test.table[test.code], (void *)test.want);
+		}
+	}
+	return rc;
+}
+
+int
+test_findchord()
+{
+	int rc = 0;
+	unsigned long j = 'j', k = 'k', l = 'l';
+	PkChord chords[] = {
+		{{j, k}, nop, {0}, NULL, {0}},
+		{{k, l}, nop, {0}, NULL, {0}},
+	};
+	struct test {
+		unsigned long a, b;
+		const PkChord *want;
+	};
+	struct test tests[] = {
+		{j, k, &chords[0]},
+		{k, j, &chords[0]}, // Either order.
+		{l, k, &chords[1]},
+		{j, l, NULL},
+		{k, 0, &chords[0]}, // Starts a chord.
+		{l, 0, &chords[1]},
+		{'x', 0, NULL},
+	};
+	for (size_t i = 0; i < LEN(tests); i++) {
+		struct test test = tests[i];
+		const PkChord *got = pk_findchord(chords, LEN(chords), test.a, test.b);
+		if (got != test.want) {
+			rc = 1;
+			jotf("test=%zu got=%p want=%p", i, (void *)got, (void *)test.want);
+		}
+	}
+	return rc;
+}
+
+int
+test_enginestep()
+{
+	int rc = 0;
+	PkProfileTable constant;
+	pk_buildprofile(&constant, &(PkProfile){1, 1, 0, NULL, 0});
+	PkEngine e = {.basespeed=100, .basescroll=10, .profiles=&constant, .nprofiles=1, .maxbacklog=8};
+	enginereset(&e, 2);
+	// Channel 0 moves, channel 1's pointer keys scroll along with its scroll
+	// keys, limited to 4 events per frame.
+	enginestartmove(&e, 0, PK_RIGHT);
+	enginesetm2s(&e, 1, 1);
+	enginestartmove(&e, 1, PK_DOWN);
+	enginestartscroll(&e, 1, PK_DOWN|PK_PROFILE(0));
+	PkFrame f;
+	if (!enginestep(&e, 1e6, 0, 4, &f)) {
+		rc = 1;
+		jot("not busy while moving");
+	}
+	if (f.ptr[0].dx != 100 || f.ptr[1].dx || f.ptr[1].dy) {
+		rc = 1;
+		jotf("got ptr {%d %d} {%d %d}, want {100 0} {0 0}",
+				f.ptr[0].dx, f.ptr[0].dy, f.ptr[1].dx, f.ptr[1].dy);
+	}
+	if (f.scroll[1].yevents != 4 || f.scroll[1].ybutton != PK_SCROLLDOWN
+	|| e.throttle[1].ybacklog != 8 || f.dropped != 8 || !f.isscrolling) {
+		rc = 1;
+		jotf("got %d scroll events backlog=%d dropped=%ld, want 4 backlog=8 dropped=8",
+				f.scroll[1].yevents, e.throttle[1].ybacklog, f.dropped);
+	}
+	// The backlog keeps the engine busy after the keys are released.
+	enginestopmove(&e, 0, PK_RIGHT);
+	enginestopmove(&e, 1, PK_DOWN);
+	enginestopscroll(&e, 1, PK_DOWN);
+	for (int i = 0; i < 2; i++) {
+		if (!enginestep(&e, 1e3, 0, 4, &f) || f.scroll[1].yevents != 4) {
+			rc = 1;
+			jotf("frame=%d: got %d scroll events, want 4", i, f.scroll[1].yevents);
+		}
+	}
+	if (enginestep(&e, 1e3, 0, 4, &f)) {
+		rc = 1;
+		jot("busy at rest");
+	}
+	return rc;
+}
+
+// Switching applications while a speed key is held keeps the key's
+// multiplier, so releasing it leaves the new application's speed.
+int
+test_enginesetspeeds()
+{
+	int rc = 0;
+	PkEngine e = {.basespeed=1000, .basescroll=10};
+	enginereset(&e, 2);
+	enginesetspeeds(&e, 1000, 10, 2);
+	enginemulspeed(&e, 0, 32);
+	enginesetspeeds(&e, 500, 10, 0.5);
+	enginemulspeed(&e, 0, 1.0 / 32);
+	enginestartmove(&e, 0, PK_RIGHT);
+	enginestartmove(&e, 1, PK_RIGHT);
+	PkFrame f;
+	enginestep(&e, 1e6, 0, 4, &f);
+	if (f.ptr[0].dx != 250 || f.ptr[1].dx != 250) {
+		rc = 1;
+		jotf("got dx=%d and %d, want 250", f.ptr[0].dx, f.ptr[1].dx);
+	}
+	// Resetting drops held multipliers along with the movement.
+	enginereset(&e, 2);
+	enginesetspeeds(&e, 500, 10, 0.5);
+	if (e.ptr.mul[0] != 0.5 || e.scroll.mul[1] != 0.5) {
+		rc = 1;
+		jotf("after reset: got mul=%g and %g, want 0.5", e.ptr.mul[0], e.scroll.mul[1]);
+	}
+	return rc;
+}
+
+int
+test_stallpolicy()
+{
+	int rc = 0;
+	// Moving right at 1000px/s with 10ms frames, a 1s stall, then 10ms
+	// frames again.
+	struct test {
+		int policy;
+		int want[4];
+	};
+	struct test tests[] = {
+		{PK_STALL_CLAMP,  {10, 100, 10, 10}},
+		{PK_STALL_SPREAD, {10, 100, 100, 100}},
+		{PK_STALL_DROP,   {10, 0,   10, 10}},
+	};
+	int steps[] = {10e3, 1e6, 10e3, 10e3};
+	for (size_t i = 0; i < LEN(tests); i++) {
+		struct test test = tests[i];
+		PkEngine e = {.basespeed=1000, .basescroll=10, .maxstepusec=100e3, .stallpolicy=test.policy};
+		enginereset(&e, 1);
+		enginestartmove(&e, 0, PK_RIGHT);
+		for (size_t j = 0; j < LEN(steps); j++) {
+			PkFrame f;
+			enginestep(&e, steps[j], 0, 4, &f);
+			if (f.ptr[0].dx != test.want[j]) {
+				rc = 1;
+				jotf("policy=%d step=%zu got dx=%d want %d", test.policy, j, f.ptr[0].dx, test.want[j]);
+			}
+		}
+		if (e.stalls != 1 || e.stalledusec != 900e3) {
+			rc = 1;
+			jotf("policy=%d stalls=%ld stalledusec=%lld, want 1 and 900000",
+					test.policy, e.stalls, e.stalledusec);
+		}
+	}
+	// Injected velocities follow the same policy.
+	for (size_t i = 0; i < LEN(tests); i++) {
+		struct test test = tests[i];
+		InjectRing *r = malloc(sizeof *r);
+		if (!r) die("out of memory");
+		injectinit(r);
+		unsigned int pos;
+		InjectEvent *ev = injectreserve(r, &pos);
+		unsigned int seq = ev->seq;
+		*ev = (InjectEvent){seq, INJECT_VELOCITY, 0, 0, 0, 0, 1000, 0};
+		injectcommit(r, ev, pos);
+		PkEngine e = {.basespeed=1000, .basescroll=10, .maxstepusec=100e3, .stallpolicy=test.policy, .inject=r};
+		enginereset(&e, 1);
+		long long now = 0;
+		for (size_t j = 0; j < LEN(steps); j++) {
+			PkFrame f;
+			now += steps[j];
+			enginestep(&e, steps[j], now, 4, &f);
+			if (f.ptr[0].dx != test.want[j]) {
+				rc = 1;
+				jotf("injected: policy=%d step=%zu got dx=%d want %d", test.policy, j, f.ptr[0].dx, test.want[j]);
+			}
+		}
+		free(r);
+	}
+	// Catching up stops with the movement.
+	PkEngine e = {.basespeed=1000, .basescroll=10, .maxstepusec=100e3, .stallpolicy=PK_STALL_SPREAD};
+	enginereset(&e, 1);
+	enginestartmove(&e, 0, PK_RIGHT);
+	PkFrame f;
+	enginestep(&e, 1e6, 0, 4, &f);
+	enginestopmove(&e, 0, PK_RIGHT);
+	enginestep(&e, 10e3, 0, 4, &f);
+	if (e.debt) {
+		rc = 1;
+		jotf("debt=%lld at rest, want 0", e.debt);
+	}
+	return rc;
+}
+
+int
+main()
+{
+	prove_init();
+	prove_run(test_pointerupdate);
+	prove_run(test_scrollupdate);
+	prove_run(test_channels);
+	prove_run(test_startdir_conflict);
+	prove_run(test_draininject);
+	prove_run(test_throttlescroll);
+	prove_run(test_profilefactor);
+	prove_run(test_pointerupdate_profile);
+	prove_run(test_gridcell);
+	prove_run(test_markwindow);
+	prove_run(test_macroplan);
+	prove_run(test_builddispatch);
+	prove_run(test_findchord);
+	prove_run(test_enginestep);
+	prove_run(test_enginesetspeeds);
+	prove_run(test_stallpolicy);
+	prove_exit();
+}
@@ -0,0 +1,888 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <X11/XKBlib.h>
+#include <X11/Xlib.h>
+#include <X11/extensions/XTest.h>
+#include <X11/keysym.h>
+#ifdef XINERAMA
+#include <X11/extensions/Xinerama.h>
+#endif
+#ifdef XI2
+#include <X11/extensions/XInput.h>
+#include <X11/extensions/XInput2.h>
+#endif
+#ifdef MITSHM
+#include <X11/extensions/XShm.h>
+#endif
+
+#include "fakex.h"
+#include "jot.h"
+
+#define ROOT 0x100
+#define MIN_KEYCODE 8
+#define MAX_KEYCODE 255
+#define MAX_DISPLAYS 16
+#define MAX_ATOMS 64
+
+// A FakeDisplay is a fake connection. Xlib's macros, such as ConnectionNumber
+// and DefaultRootWindow, read xdpy, which is what the client gets.
+typedef struct {
+	_XPrivDisplay xdpy;
+	Screen screen;
+	Visual visual;
+	XEvent queue[FAKEX_QUEUE_LEN];
+	long long due[FAKEX_QUEUE_LEN]; // When each event arrives, in monotonic usec.
+	size_t n;
+	char keys[32]; // Keys down as of the events dequeued, one bit per keycode.
+	XID nextid;
+	int ptrx, ptry;
+} FakeDisplay;
+
+static void request(Display *d, const char *name, int isroundtrip, int a, int b);
+static void fakeinput(Display *d, const char *name, int a, int b, unsigned long delay);
+static FakeDisplay *fake(Display *d);
+static KeySym keymap(KeyCode code);
+static long eventmask(int type);
+static void dequeue(FakeDisplay *f, size_t i, XEvent *ev);
+static size_t arrived(FakeDisplay *f);
+static void rearm(FakeDisplay *f);
+static void presskey(char *keys, const XEvent *ev);
+static void awaitevent(FakeDisplay *f, size_t i);
+static long long clockusec();
+
+FakeRequest fakexlog[FAKEX_LOG_LEN];
+size_t nfakexlog = 0;
+
+static FakeDisplay *displays[MAX_DISPLAYS];
+static size_t ndisplays = 0;
+static KeySym keysyms[MAX_KEYCODE + 1];
+static int iskeymapped = 0;
+static char atoms[MAX_ATOMS][64];
+static size_t natoms = 0;
+static XErrorHandler errorhandler = NULL;
+
+
+// fakexreset clears the log.
+void
+fakexreset()
+{
+	nfakexlog = 0;
+}
+
+// fakexcount returns how many logged requests name sent.
+size_t
+fakexcount(const char *name)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < nfakexlog; i++) n += !strcmp(fakexlog[i].name, name);
+	return n;
+}
+
+// fakexroundtrips returns how many of the logged requests from index from up
+// to to waited for a reply.
+size_t
+fakexroundtrips(size_t from, size_t to)
+{
+	size_t n = 0;
+	for (size_t i = from; i < to && i < nfakexlog; i++) n += fakexlog[i].isroundtrip;
+	return n;
+}
+
+// fakexfind returns the index of the first request sent by name at or after
+// from, or -1.
+long
+fakexfind(const char *name, size_t from)
+{
+	for (size_t i = from; i < nfakexlog; i++) {
+		if (!strcmp(fakexlog[i].name, name)) return i;
+	}
+	return -1;
+}
+
+// fakexevent queues ev for d's client to read.
+void
+fakexevent(Display *d, XEvent *ev)
+{
+	fakexeventafter(d, ev, 0);
+}
+
+// fakexeventafter queues ev to arrive ms from now, or after the events queued
+// before it, so a client waiting for it blocks until then.
+void
+fakexeventafter(Display *d, XEvent *ev, int ms)
+{
+	FakeDisplay *f = fake(d);
+	if (f->n == FAKEX_QUEUE_LEN) die("fakexevent: queue full");
+	ev->xany.display = d;
+	ev->xany.serial = NextRequest(d) - 1;
+	long long due = ms ? clockusec() + ms * 1000LL : 0;
+	if (f->n && f->due[f->n - 1] > due) due = f->due[f->n - 1];
+	f->due[f->n] = due;
+	f->queue[f->n++] = *ev;
+	rearm(f);
+}
+
+// fakexkeycode returns the keycode keysym is mapped to, or 0, without logging
+// a request.
+KeyCode
+fakexkeycode(KeySym keysym)
+{
+	for (int code = MIN_KEYCODE; code <= MAX_KEYCODE; code++) {
+		if (keymap(code) == keysym) return code;
+	}
+	return 0;
+}
+
+// fakexremap moves keysym to code, swapping it with the keysym there, as if
+// by xmodmap. Queue a MappingNotify to tell the client.
+void
+fakexremap(KeySym keysym, KeyCode code)
+{
+	KeyCode old = fakexkeycode(keysym);
+	if (!old) die("fakexremap: keysym not mapped");
+	keysyms[old] = keysyms[code];
+	keysyms[code] = keysym;
+}
+
+static void
+request(Display *d, const char *name, int isroundtrip, int a, int b)
+{
+	_XPrivDisplay x = (_XPrivDisplay)d;
+	x->request++;
+	if (nfakexlog == FAKEX_LOG_LEN) die("fakex: log full");
+	fakexlog[nfakexlog++] = (FakeRequest){name, d, x->request, isroundtrip, a, b, 0};
+}
+
+// fakeinput logs an XTest request, which the xserver runs delay ms after the
+// previous request on d.
+static void
+fakeinput(Display *d, const char *name, int a, int b, unsigned long delay)
+{
+	request(d, name, 0, a, b);
+	fakexlog[nfakexlog - 1].delay = delay;
+}
+
+static FakeDisplay *
+fake(Display *d)
+{
+	for (size_t i = 0; i < ndisplays; i++) {
+		if ((Display *)displays[i]->xdpy == d) return displays[i];
+	}
+	die("fakex: unknown display");
+	return NULL;
+}
+
+static KeySym
+keymap(KeyCode code)
+{
+	if (!iskeymapped) {
+		iskeymapped = 1;
+		for (int c = MIN_KEYCODE; c <= MAX_KEYCODE; c++) {
+			if (c <= 102) keysyms[c] = 0x20 + (c - 8);
+			else if (c <= 230) keysyms[c] = 0xff00 + (c - 103);
+			else keysyms[c] = 0xffe0 + (c - 231);
+		}
+	}
+	return code >= MIN_KEYCODE ? keysyms[code] : NoSymbol;
+}
+
+static long
+eventmask(int type)
+{
+	switch (type) {
+	case KeyPress: return KeyPressMask;
+	case KeyRelease: return KeyReleaseMask;
+	case PropertyNotify: return PropertyChangeMask;
+	case ConfigureNotify:
+	case DestroyNotify:
+	case MapNotify:
+	case UnmapNotify:
+	case ReparentNotify: return StructureNotifyMask|SubstructureNotifyMask;
+	}
+	return 0;
+}
+
+// dequeue removes the ith queued event of f to ev.
+static void
+dequeue(FakeDisplay *f, size_t i, XEvent *ev)
+{
+	*ev = f->queue[i];
+	memmove(&f->queue[i], &f->queue[i+1], (f->n - i - 1) * sizeof *f->queue);
+	memmove(&f->due[i], &f->due[i+1], (f->n - i - 1) * sizeof *f->due);
+	f->n--;
+	presskey(f->keys, ev);
+	rearm(f);
+}
+
+// presskey updates keys for a key event.
+static void
+presskey(char *keys, const XEvent *ev)
+{
+	if (ev->type != KeyPress && ev->type != KeyRelease) return;
+	KeyCode code = ev->xkey.keycode;
+	if (ev->type == KeyPress) keys[code/8] |= 1 << code%8;
+	else keys[code/8] &= ~(1 << code%8);
+}
+
+// rearm makes f's connection readable once its next queued event arrives, or
+// right away if there's none, so a test that has nothing left to send is
+// never left waiting.
+static void
+rearm(FakeDisplay *f)
+{
+	long long due = f->n ? f->due[0] : 0;
+	if (due <= 0) due = 1;
+	struct itimerspec its = {{0, 0}, {due / 1000000, due % 1000000 * 1000}};
+	if (timerfd_settime(f->xdpy->fd, TFD_TIMER_ABSTIME, &its, NULL)) die("fakex: timerfd_settime failed");
+}
+
+// arrived returns how many of f's queued events have arrived.
+static size_t
+arrived(FakeDisplay *f)
+{
+	long long now = clockusec();
+	size_t n = 0;
+	while (n < f->n && f->due[n] <= now) n++;
+	return n;
+}
+
+// awaitevent sleeps until f's ith queued event arrives.
+static void
+awaitevent(FakeDisplay *f, size_t i)
+{
+	long long wait = f->due[i] - clockusec();
+	if (wait <= 0) return;
+	struct timespec ts = {wait / 1000000, wait % 1000000 * 1000};
+	while (nanosleep(&ts, &ts)) {}
+}
+
+static long long
+clockusec()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// Connection and errors:
+
+Display *
+XOpenDisplay(_Xconst char *name)
+{
+	if (ndisplays == MAX_DISPLAYS) return NULL;
+	FakeDisplay *f = calloc(1, sizeof *f);
+	_XPrivDisplay x = calloc(1, sizeof *x);
+	if (!f || !x) die("XOpenDisplay: out of memory");
+	f->xdpy = x;
+	// Readable as described by rearm.
+	x->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (x->fd < 0) die("XOpenDisplay: timerfd_create failed");
+	x->display_name = strdup(name ? name : ":0");
+	x->nscreens = 1;
+	x->screens = &f->screen;
+	x->min_keycode = MIN_KEYCODE;
+	x->max_keycode = MAX_KEYCODE;
+	f->screen.display = (Display *)x;
+	f->screen.root = ROOT;
+	f->screen.width = 1920;
+	f->screen.height = 1080;
+	f->screen.root_depth = 24;
+	f->screen.root_visual = &f->visual;
+	f->nextid = ROOT + 1;
+	f->ptrx = 960;
+	f->ptry = 540;
+	displays[ndisplays++] = f;
+	rearm(f);
+	return (Display *)x;
+}
+
+char *
+XDisplayName(_Xconst char *name)
+{
+	if (name) return (char *)name;
+	const char *env = getenv("DISPLAY");
+	return (char *)(env ? env : "");
+}
+
+XErrorHandler
+XSetErrorHandler(XErrorHandler handler)
+{
+	XErrorHandler old = errorhandler;
+	errorhandler = handler;
+	return old;
+}
+
+int
+XSync(Display *d, Bool discard)
+{
+	(void)discard;
+	request(d, "XSync", 1, 0, 0);
+	return 1;
+}
+
+int
+XFlush(Display *d)
+{
+	(void)d;
+	return 1;
+}
+
+int
+XFree(void *data)
+{
+	free(data);
+	return 1;
+}
+
+Bool
+XQueryExtension(Display *d, _Xconst char *name, int *opcode, int *event, int *error)
+{
+	(void)name;
+	request(d, "XQueryExtension", 1, 0, 0);
+	*opcode = *event = *error = 0;
+	return False;
+}
+
+// Events:
+
+int
+XPending(Display *d)
+{
+	return arrived(fake(d));
+}
+
+int
+XNextEvent(Display *d, XEvent *ev)
+{
+	FakeDisplay *f = fake(d);
+	if (!f->n) die("XNextEvent: no events queued, would block forever");
+	awaitevent(f, 0);
+	dequeue(f, 0, ev);
+	return 0;
+}
+
+int
+XMaskEvent(Display *d, long mask, XEvent *ev)
+{
+	FakeDisplay *f = fake(d);
+	for (size_t i = 0; i < f->n; i++) {
+		if (eventmask(f->queue[i].type) & mask) {
+			awaitevent(f, i);
+			dequeue(f, i, ev);
+			return 0;
+		}
+	}
+	die("XMaskEvent: no matching events queued, would block forever");
+	return 0;
+}
+
+Bool
+XCheckMaskEvent(Display *d, long mask, XEvent *ev)
+{
+	FakeDisplay *f = fake(d);
+	for (size_t i = 0, n = arrived(f); i < n; i++) {
+		if (!(eventmask(f->queue[i].type) & mask)) continue;
+		dequeue(f, i, ev);
+		return True;
+	}
+	return False;
+}
+
+Bool
+XCheckTypedWindowEvent(Display *d, Window w, int type, XEvent *ev)
+{
+	FakeDisplay *f = fake(d);
+	for (size_t i = 0, n = arrived(f); i < n; i++) {
+		XEvent *e = &f->queue[i];
+		if (e->type != type || e->xany.window != w) continue;
+		dequeue(f, i, ev);
+		return True;
+	}
+	return False;
+}
+
+Bool
+XGetEventData(Display *d, XGenericEventCookie *cookie)
+{
+	(void)d;
+	(void)cookie;
+	return False;
+}
+
+void
+XFreeEventData(Display *d, XGenericEventCookie *cookie)
+{
+	(void)d;
+	(void)cookie;
+}
+
+int
+XSelectInput(Display *d, Window w, long mask)
+{
+	(void)w;
+	(void)mask;
+	request(d, "XSelectInput", 0, 0, 0);
+	return 1;
+}
+
+// Windows and properties:
+
+Window
+XCreateSimpleWindow(Display *d, Window parent, int x, int y, unsigned int w, unsigned int h,
+		unsigned int border, unsigned long bordercolor, unsigned long bg)
+{
+	(void)parent; (void)x; (void)y; (void)w; (void)h; (void)border; (void)bordercolor; (void)bg;
+	request(d, "XCreateSimpleWindow", 0, 0, 0);
+	return fake(d)->nextid++;
+}
+
+Atom
+XInternAtom(Display *d, _Xconst char *name, Bool onlyifexists)
+{
+	(void)onlyifexists;
+	request(d, "XInternAtom", 1, 0, 0);
+	for (size_t i = 0; i < natoms; i++) {
+		if (!strcmp(atoms[i], name)) return 1000 + i;
+	}
+	if (natoms == MAX_ATOMS) die("XInternAtom: too many atoms");
+	snprintf(atoms[natoms], sizeof atoms[natoms], "%s", name);
+	return 1000 + natoms++;
+}
+
+int
+XChangeProperty(Display *d, Window w, Atom property, Atom type, int format, int mode,
+		_Xconst unsigned char *data, int n)
+{
+	(void)type; (void)format; (void)mode; (void)data; (void)n;
+	request(d, "XChangeProperty", 0, 0, 0);
+	// The xserver has caught up as soon as it's asked.
+	XEvent ev = {0};
+	ev.xproperty.type = PropertyNotify;
+	ev.xproperty.window = w;
+	ev.xproperty.atom = property;
+	ev.xproperty.state = PropertyNewValue;
+	fakexevent(d, &ev);
+	return 1;
+}
+
+int
+XGetWindowProperty(Display *d, Window w, Atom property, long offset, long length, Bool delete,
+		Atom reqtype, Atom *type, int *format, unsigned long *n, unsigned long *after,
+		unsigned char **data)
+{
+	(void)w; (void)property; (void)offset; (void)length; (void)delete; (void)reqtype;
+	request(d, "XGetWindowProperty", 1, 0, 0);
+	*type = None;
+	*format = 0;
+	*n = *after = 0;
+	*data = NULL;
+	return Success;
+}
+
+Status
+XGetWindowAttributes(Display *d, Window w, XWindowAttributes *wa)
+{
+	(void)w;
+	request(d, "XGetWindowAttributes", 1, 0, 0);
+	memset(wa, 0, sizeof *wa);
+	wa->width = 1920;
+	wa->height = 1080;
+	wa->map_state = IsViewable;
+	wa->root = ROOT;
+	return 1;
+}
+
+Status
+XQueryTree(Display *d, Window w, Window *rootret, Window *parent, Window **children, unsigned int *n)
+{
+	request(d, "XQueryTree", 1, 0, 0);
+	*rootret = ROOT;
+	*parent = w == ROOT ? None : ROOT;
+	*children = NULL;
+	*n = 0;
+	return 1;
+}
+
+int
+XGetInputFocus(Display *d, Window *focus, int *revert)
+{
+	request(d, "XGetInputFocus", 1, 0, 0);
+	*focus = PointerRoot;
+	*revert = RevertToPointerRoot;
+	return 1;
+}
+
+XImage *
+XGetImage(Display *d, Drawable w, int x, int y, unsigned int width, unsigned int height,
+		unsigned long planes, int format)
+{
+	(void)w; (void)x; (void)y; (void)width; (void)height; (void)planes; (void)format;
+	request(d, "XGetImage", 1, 0, 0);
+	return NULL;
+}
+
+// Pointer:
+
+Bool
+XQueryPointer(Display *d, Window w, Window *rootret, Window *child, int *rootx, int *rooty,
+		int *winx, int *winy, unsigned int *mask)
+{
+	(void)w;
+	request(d, "XQueryPointer", 1, 0, 0);
+	FakeDisplay *f = fake(d);
+	*rootret = ROOT;
+	*child = None;
+	*rootx = *winx = f->ptrx;
+	*rooty = *winy = f->ptry;
+	*mask = 0;
+	return True;
+}
+
+int
+XWarpPointer(Display *d, Window src, Window dst, int srcx, int srcy, unsigned int srcw,
+		unsigned int srch, int dstx, int dsty)
+{
+	(void)src; (void)srcx; (void)srcy; (void)srcw; (void)srch;
+	request(d, "XWarpPointer", 0, dstx, dsty);
+	FakeDisplay *f = fake(d);
+	f->ptrx = dst == None ? f->ptrx + dstx : dstx;
+	f->ptry = dst == None ? f->ptry + dsty : dsty;
+	return 1;
+}
+
+// Keyboard:
+
+int
+XDisplayKeycodes(Display *d, int *min, int *max)
+{
+	(void)d;
+	*min = MIN_KEYCODE;
+	*max = MAX_KEYCODE;
+	return 1;
+}
+
+KeySym
+XkbKeycodeToKeysym(Display *d,
+#if NeedWidePrototypes
+		unsigned int code,
+#else
+		KeyCode code,
+#endif
+		int group, int level)
+{
+	(void)d;
+	return group || level ? NoSymbol : keymap(code);
+}
+
+KeyCode
+XKeysymToKeycode(Display *d, KeySym keysym)
+{
+	(void)d;
+	return fakexkeycode(keysym);
+}
+
+char *
+XKeysymToString(KeySym keysym)
+{
+	static char names[0x7f][2];
+	if (keysym < 0x21 || keysym > 0x7e) return NULL;
+	names[keysym][0] = keysym;
+	return names[keysym];
+}
+
+KeySym
+XStringToKeysym(_Xconst char *s)
+{
+	if (strlen(s) == 1 && s[0] > 0x20 && s[0] < 0x7f) return s[0];
+	return NoSymbol;
+}
+
+int
+XRefreshKeyboardMapping(XMappingEvent *ev)
+{
+	(void)ev;
+	return 1;
+}
+
+XModifierKeymap *
+XGetModifierMapping(Display *d)
+{
+	request(d, "XGetModifierMapping", 1, 0, 0);
+	XModifierKeymap *m = malloc(sizeof *m);
+	KeyCode *codes = calloc(8, sizeof *codes);
+	if (!m || !codes) die("XGetModifierMapping: out of memory");
+	m->max_keypermod = 1;
+	m->modifiermap = codes;
+	codes[ShiftMapIndex] = fakexkeycode(XK_Shift_L);
+	codes[ControlMapIndex] = fakexkeycode(XK_Control_L);
+	codes[Mod1MapIndex] = fakexkeycode(XK_Alt_L);
+	codes[Mod2MapIndex] = fakexkeycode(XK_Num_Lock);
+	codes[Mod4MapIndex] = fakexkeycode(XK_Super_L);
+	return m;
+}
+
+int
+XFreeModifiermap(XModifierKeymap *m)
+{
+	free(m->modifiermap);
+	free(m);
+	return 1;
+}
+
+int
+XGrabKey(Display *d, int code, unsigned int mods, Window w, Bool ownerevents, int ptrmode, int kbdmode)
+{
+	(void)w; (void)ownerevents; (void)ptrmode; (void)kbdmode;
+	request(d, "XGrabKey", 0, code, mods);
+	return 1;
+}
+
+int
+XUngrabKey(Display *d, int code, unsigned int mods, Window w)
+{
+	(void)w;
+	request(d, "XUngrabKey", 0, code, mods);
+	return 1;
+}
+
+int
+XGrabKeyboard(Display *d, Window w, Bool ownerevents, int ptrmode, int kbdmode, Time t)
+{
+	(void)w; (void)ownerevents; (void)ptrmode; (void)kbdmode; (void)t;
+	request(d, "XGrabKeyboard", 1, 0, 0);
+	return GrabSuccess;
+}
+
+int
+XUngrabKeyboard(Display *d, Time t)
+{
+	(void)t;
+	request(d, "XUngrabKeyboard", 0, 0, 0);
+	return 1;
+}
+
+// XQueryKeymap reports the keys down once the events that have arrived so
+// far are counted, whether the client has read them or not.
+int
+XQueryKeymap(Display *d, char keys[32])
+{
+	FakeDisplay *f = fake(d);
+	request(d, "XQueryKeymap", 1, 0, 0);
+	memcpy(keys, f->keys, sizeof f->keys);
+	for (size_t i = 0, n = arrived(f); i < n; i++) presskey(keys, &f->queue[i]);
+	return 1;
+}
+
+int
+XAutoRepeatOff(Display *d)
+{
+	request(d, "XAutoRepeatOff", 0, 0, 0);
+	return 1;
+}
+
+int
+XChangeKeyboardControl(Display *d, unsigned long mask, XKeyboardControl *values)
+{
+	request(d, "XChangeKeyboardControl", 0, mask & KBKey ? values->key : 0, values->auto_repeat_mode);
+	return 1;
+}
+
+Bool
+XkbSetServerInternalMods(Display *d, unsigned int device, unsigned int affectreal,
+		unsigned int realvalues, unsigned int affectvirtual, unsigned int virtualvalues)
+{
+	(void)device; (void)affectreal; (void)realvalues; (void)affectvirtual; (void)virtualvalues;
+	request(d, "XkbSetServerInternalMods", 0, 0, 0);
+	return True;
+}
+
+// XTest:
+
+int
+XTestFakeButtonEvent(Display *d, unsigned int button, Bool press, unsigned long delay)
+{
+	fakeinput(d, "XTestFakeButtonEvent", button, press, delay);
+	return 1;
+}
+
+int
+XTestFakeMotionEvent(Display *d, int screen, int x, int y, unsigned long delay)
+{
+	(void)screen;
+	fakeinput(d, "XTestFakeMotionEvent", x, y, delay);
+	return 1;
+}
+
+int
+XTestFakeRelativeMotionEvent(Display *d, int dx, int dy, unsigned long delay)
+{
+	fakeinput(d, "XTestFakeRelativeMotionEvent", dx, dy, delay);
+	return 1;
+}
+
+// Extensions, which the fake xserver doesn't have. They're only called once
+// their query fails, if at all, but pk.c needs them to link.
+
+#ifdef XINERAMA
+Bool
+XineramaIsActive(Display *d)
+{
+	request(d, "XineramaIsActive", 1, 0, 0);
+	return False;
+}
+
+XineramaScreenInfo *
+XineramaQueryScreens(Display *d, int *n)
+{
+	request(d, "XineramaQueryScreens", 1, 0, 0);
+	*n = 0;
+	return NULL;
+}
+#endif
+
+#ifdef XI2
+Status
+XIQueryVersion(Display *d, int *major, int *minor)
+{
+	(void)major; (void)minor;
+	request(d, "XIQueryVersion", 1, 0, 0);
+	return BadRequest;
+}
+
+XIDeviceInfo *
+XIQueryDevice(Display *d, int device, int *n)
+{
+	(void)device;
+	request(d, "XIQueryDevice", 1, 0, 0);
+	*n = 0;
+	return NULL;
+}
+
+void
+XIFreeDeviceInfo(XIDeviceInfo *info)
+{
+	free(info);
+}
+
+int
+XISelectEvents(Display *d, Window w, XIEventMask *masks, int n)
+{
+	(void)w; (void)masks; (void)n;
+	request(d, "XISelectEvents", 0, 0, 0);
+	return Success;
+}
+
+Bool
+XIGetClientPointer(Display *d, Window w, int *device)
+{
+	(void)w;
+	request(d, "XIGetClientPointer", 1, 0, 0);
+	*device = 0;
+	return False;
+}
+
+Status
+XISetClientPointer(Display *d, Window w, int device)
+{
+	(void)w;
+	request(d, "XISetClientPointer", 0, device, 0);
+	return Success;
+}
+
+Bool
+XIWarpPointer(Display *d, int device, Window src, Window dst, double srcx, double srcy,
+		unsigned int srcw, unsigned int srch, double dstx, double dsty)
+{
+	(void)device; (void)src; (void)dst; (void)srcx; (void)srcy; (void)srcw; (void)srch;
+	request(d, "XIWarpPointer", 0, dstx, dsty);
+	return True;
+}
+
+Bool
+XIQueryPointer(Display *d, int device, Window w, Window *rootret, Window *child,
+		double *rootx, double *rooty, double *winx, double *winy,
+		XIButtonState *buttons, XIModifierState *mods, XIGroupState *group)
+{
+	(void)device; (void)w; (void)mods; (void)group;
+	request(d, "XIQueryPointer", 1, 0, 0);
+	FakeDisplay *f = fake(d);
+	*rootret = ROOT;
+	*child = None;
+	*rootx = *winx = f->ptrx;
+	*rooty = *winy = f->ptry;
+	buttons->mask_len = 0;
+	buttons->mask = NULL;
+	return True;
+}
+
+XDevice *
+XOpenDevice(Display *d, XID id)
+{
+	(void)id;
+	request(d, "XOpenDevice", 1, 0, 0);
+	return NULL;
+}
+
+int
+XCloseDevice(Display *d, XDevice *dev)
+{
+	(void)dev;
+	request(d, "XCloseDevice", 1, 0, 0);
+	return Success;
+}
+
+int
+XTestFakeDeviceButtonEvent(Display *d, XDevice *dev, unsigned int button, Bool press,
+		int *axes, int naxes, unsigned long delay)
+{
+	(void)dev; (void)axes; (void)naxes;
+	fakeinput(d, "XTestFakeDeviceButtonEvent", button, press, delay);
+	return 1;
+}
+
+int
+XTestFakeDeviceMotionEvent(Display *d, XDevice *dev, Bool isrelative, int first,
+		int *axes, int naxes, unsigned long delay)
+{
+	(void)dev; (void)isrelative; (void)first; (void)naxes;
+	fakeinput(d, "XTestFakeDeviceMotionEvent", axes[0], axes[1], delay);
+	return 1;
+}
+#endif
+
+#ifdef MITSHM
+Bool
+XShmQueryExtension(Display *d)
+{
+	request(d, "XShmQueryExtension", 1, 0, 0);
+	return False;
+}
+
+XImage *
+XShmCreateImage(Display *d, Visual *visual, unsigned int depth, int format, char *data,
+		XShmSegmentInfo *info, unsigned int w, unsigned int h)
+{
+	(void)d; (void)visual; (void)depth; (void)format; (void)data; (void)info; (void)w; (void)h;
+	return NULL;
+}
+
+Bool
+XShmAttach(Display *d, XShmSegmentInfo *info)
+{
+	(void)info;
+	request(d, "XShmAttach", 0, 0, 0);
+	return False;
+}
+
+Bool
+XShmGetImage(Display *d, Drawable w, XImage *img, int x, int y, unsigned long planes)
+{
+	(void)w; (void)img; (void)x; (void)y; (void)planes;
+	request(d, "XShmGetImage", 1, 0, 0);
+	return False;
+}
+#endif
@@ -0,0 +1,44 @@
+#ifndef FAKEX_H
+#define FAKEX_H
+// A fake Xlib for tests that check which requests ptrkeys sends, without an
+// xserver. Link fakex.c instead of libX11 and the extension libraries: it
+// implements the calls pk.c makes, logging each request and round trip, and
+// delivers the events queued with fakexevent, or fakexeventafter for events
+// the client should block waiting for.
+//
+// The fake xserver has one 1920x1080 screen and none of the extensions. Its
+// keyboard maps keycodes 8 to 102 to the printable ASCII keysyms, 103 to 230
+// to 0xff00 to 0xff7f (XK_BackSpace, XK_Up, XK_Num_Lock...), and 231 to 255
+// to 0xffe0 to 0xfff8 (XK_Shift_L...), with Num_Lock on Mod2.
+
+#include <stddef.h>
+#include <X11/Xlib.h>
+
+#define FAKEX_LOG_LEN 4096
+#define FAKEX_QUEUE_LEN 64
+
+// A FakeRequest is a logged request. Calls that Xlib handles on the client
+// side, such as XFlush and keysym lookups, aren't logged.
+typedef struct {
+	const char *name; // Xlib function that sent it.
+	Display *dpy;
+	unsigned long serial;
+	int isroundtrip; // The caller waited for a reply.
+	int a, b; // Keycode and modifiers for key grabs, dx and dy for warps.
+	unsigned long delay; // Milliseconds the xserver waits first, for XTest fakes.
+} FakeRequest;
+
+extern FakeRequest fakexlog[FAKEX_LOG_LEN];
+extern size_t nfakexlog;
+
+void fakexreset();
+size_t fakexcount(const char *name);
+size_t fakexroundtrips(size_t from, size_t to);
+long fakexfind(const char *name, size_t from);
+
+void fakexevent(Display *d, XEvent *ev);
+void fakexeventafter(Display *d, XEvent *ev, int ms);
+KeyCode fakexkeycode(KeySym keysym);
+void fakexremap(KeySym keysym, KeyCode code);
+
+#endif
@@ -0,0 +1,119 @@
+// For memfd_create(2).
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "handover.h"
+
+static void savemovements(HandoverMovement *hm, const PkMovements *m, const PkEngine *e);
+static void restoremovements(PkMovements *m, const HandoverMovement *hm, size_t n, const PkEngine *e);
+
+
+// handoverwrite writes h to a new memfd, which is left open across exec, and
+// returns it rewound for handoverread. Returns -1 and sets errno on error.
+int
+handoverwrite(Handover *h)
+{
+	h->magic = HANDOVER_MAGIC;
+	h->version = HANDOVER_VERSION;
+	h->size = sizeof *h;
+	int fd = memfd_create("ptrkeys-handover", 0);
+	if (fd < 0) return -1;
+	const char *p = (const char *)h;
+	for (size_t done = 0; done < sizeof *h;) {
+		ssize_t n = write(fd, p + done, sizeof *h - done);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) goto fail;
+		done += n;
+	}
+	if (lseek(fd, 0, SEEK_SET) < 0) goto fail;
+	return fd;
+fail:;
+	int err = errno;
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+// handoverread reads a Handover written by handoverwrite from fd and closes
+// it. Returns 1 if only its conns could be read, because it was written by an
+// incompatible version of ptrkeys, or -1 and sets errno on error.
+int
+handoverread(int fd, Handover *h)
+{
+	char *p = (char *)h;
+	size_t done = 0;
+	int err = EINVAL;
+	while (done < sizeof *h) {
+		ssize_t n = read(fd, p + done, sizeof *h - done);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) err = errno;
+		if (n <= 0) break;
+		done += n;
+	}
+	close(fd);
+	if (done < offsetof(Handover, sessions) || h->magic != HANDOVER_MAGIC
+			|| h->nsessions > HANDOVER_MAX_SESSIONS) {
+		errno = err;
+		return -1;
+	}
+	return done < sizeof *h || h->version != HANDOVER_VERSION || h->size != sizeof *h;
+}
+
+// handoversave saves e's movement to s.
+void
+handoversave(HandoverSession *s, const PkEngine *e)
+{
+	s->nchannels = e->ptr.n;
+	savemovements(s->ptr, &e->ptr, e);
+	savemovements(s->scroll, &e->scroll, e);
+}
+
+// handoverrestore resumes the movement saved in s on e, which must already be
+// reset. Base speeds are left alone, since they come from the config, and
+// channels that e doesn't have are dropped.
+void
+handoverrestore(PkEngine *e, const HandoverSession *s)
+{
+	size_t n = s->nchannels < e->ptr.n ? s->nchannels : e->ptr.n;
+	for (size_t i = 0; i < n; i++) enginesetm2s(e, i, s->ptr[i].isscroll);
+	restoremovements(&e->ptr, s->ptr, n, e);
+	restoremovements(&e->scroll, s->scroll, n, e);
+}
+
+static void
+savemovements(HandoverMovement *hm, const PkMovements *m, const PkEngine *e)
+{
+	for (size_t i = 0; i < m->n; i++) {
+		hm[i] = (HandoverMovement){
+			.dir = m->dir[i],
+			.mul = m->mul[i],
+			.xrem = m->xrem[i],
+			.yrem = m->yrem[i],
+			.xcont = m->xcont[i],
+			.ycont = m->ycont[i],
+			.profile = m->profile[i] ? (int)(m->profile[i] - e->profiles) : -1,
+			.held = m->held[i],
+			.isscroll = m->isscroll[i],
+		};
+	}
+}
+
+static void
+restoremovements(PkMovements *m, const HandoverMovement *hm, size_t n, const PkEngine *e)
+{
+	for (size_t i = 0; i < n; i++) {
+		m->dir[i] = hm[i].dir & PK_DIRMASK;
+		m->mul[i] = hm[i].mul;
+		m->xrem[i] = hm[i].xrem;
+		m->yrem[i] = hm[i].yrem;
+		m->xcont[i] = hm[i].xcont;
+		m->ycont[i] = hm[i].ycont;
+		int p = hm[i].profile;
+		m->profile[i] = p >= 0 && (size_t)p < e->nprofiles ? &e->profiles[p] : NULL;
+		m->held[i] = hm[i].held;
+	}
+}
@@ -0,0 +1,64 @@
+#ifndef HANDOVER_H
+#define HANDOVER_H
+// Handing a running ptrkeys' state over to the binary that replaces it.
+//
+// On restart, ptrkeys writes a Handover to a memfd and execs itself with the
+// fd in $PTRKEYS_HANDOVER. The connections to the xservers are left open
+// across the exec, so their grabs stay in place until the new process is
+// ready to close them and grab the keys itself. So are the injection rings
+// and state files, which the new process adopts.
+
+#include "engine.h"
+
+#define HANDOVER_MAGIC 0x706b686f // "pkho"
+#define HANDOVER_VERSION 2
+#define HANDOVER_ENV "PTRKEYS_HANDOVER"
+#define HANDOVER_MAX_SESSIONS 8 // Same as ptrkeys' MAX_DISPLAYS.
+#define HANDOVER_MAX_LAYERS 8 // Same as ptrkeys' MAX_LAYER_DEPTH.
+#define HANDOVER_NAME_LEN 64
+
+// A HandoverMovement is a channel's movement, with its profile as an index
+// instead of a pointer.
+typedef struct {
+	unsigned int dir;
+	double mul;
+	double xrem, yrem;
+	int xcont, ycont;
+	int profile; // Index into the engine's profiles, or -1 for none.
+	long held;
+	int isscroll;
+} HandoverMovement;
+
+// A HandoverConn is a connection to an xserver left open across the exec.
+typedef struct {
+	char display[HANDOVER_NAME_LEN]; // Its DisplayString.
+	int xfd;
+	unsigned long probewin; // A window of the connection's, to watch close.
+} HandoverConn;
+
+typedef struct {
+	int iskeyboardgrabbed;
+	char layers[HANDOVER_MAX_LAYERS][HANDOVER_NAME_LEN]; // Pushed, by name.
+	unsigned int nlayers;
+	int islatched;
+	unsigned int nchannels, selchan;
+	HandoverMovement ptr[PK_MAX_CHANNELS], scroll[PK_MAX_CHANNELS];
+	unsigned char keychan[PK_NKEYCODES];
+	int injectfd, statefd; // Left open across the exec, or -1.
+} HandoverSession;
+
+typedef struct {
+	// Any version can read up to sessions, to release the old grabs.
+	unsigned int magic, version;
+	unsigned int size;
+	unsigned int nsessions;
+	HandoverConn conns[HANDOVER_MAX_SESSIONS];
+	HandoverSession sessions[HANDOVER_MAX_SESSIONS];
+} Handover;
+
+int handoverwrite(Handover *h);
+int handoverread(int fd, Handover *h);
+void handoversave(HandoverSession *s, const PkEngine *e);
+void handoverrestore(PkEngine *e, const HandoverSession *s);
+
+#endif
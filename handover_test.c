@@ -0,0 +1,136 @@
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "handover.h"
+#include "prove.h"
+#include "jot.h"
+
+int jottrace = 1;
+
+static Handover *
+newhandover()
+{
+	Handover *h = calloc(1, sizeof *h);
+	if (!h) die("newhandover: out of memory");
+	h->nsessions = 2;
+	h->conns[1] = (HandoverConn){":1", 7, 0x400001};
+	h->sessions[1].iskeyboardgrabbed = 1;
+	strcpy(h->sessions[1].layers[0], "scroll");
+	h->sessions[1].nlayers = 1;
+	h->sessions[1].keychan[38] = 3;
+	return h;
+}
+
+int
+test_handover_roundtrip()
+{
+	int rc = 0;
+	Handover *want = newhandover();
+	Handover *got = calloc(1, sizeof *got);
+	if (!got) die("out of memory");
+	int fd = handoverwrite(want);
+	if (fd < 0) {
+		jot("write failed");
+		rc = 1;
+	} else if (handoverread(fd, got)) {
+		jot("read failed");
+		rc = 1;
+	} else if (memcmp(got, want, sizeof *got)) {
+		jotf("got display=%s layer=%s", got->conns[1].display, got->sessions[1].layers[0]);
+		rc = 1;
+	}
+	free(want);
+	free(got);
+	return rc;
+}
+
+// The conns are still read from a handover by another version, so its grabs
+// can be released, but not the sessions.
+int
+test_handover_version()
+{
+	int rc = 0;
+	Handover *h = newhandover();
+	int fd = handoverwrite(h);
+	unsigned int version = HANDOVER_VERSION + 1;
+	if (fd < 0 || pwrite(fd, &version, sizeof version, offsetof(Handover, version)) != sizeof version) {
+		die("write failed");
+	}
+	memset(h, 0, sizeof *h);
+	int got = handoverread(fd, h);
+	if (got != 1 || h->nsessions != 2 || h->conns[1].xfd != 7) {
+		jotf("got=%d nsessions=%u xfd=%d", got, h->nsessions, h->conns[1].xfd);
+		rc = 1;
+	}
+
+	// Truncated in the conns.
+	fd = memfd_create("test", 0);
+	if (fd < 0 || write(fd, h, offsetof(Handover, conns[1])) < 0 || lseek(fd, 0, SEEK_SET)) {
+		die("write failed");
+	}
+	got = handoverread(fd, h);
+	if (got != -1) {
+		jotf("truncated: got=%d", got);
+		rc = 1;
+	}
+	free(h);
+	return rc;
+}
+
+// A movement carries on after a handover as if there'd been none.
+int
+test_handover_movement()
+{
+	int rc = 0;
+	PkProfileTable profiles[2];
+	pk_buildprofile(&profiles[0], &(PkProfile){1, 1, 0, NULL, 0});
+	pk_buildprofile(&profiles[1], &(PkProfile){0.1, 1, 500, NULL, 0});
+	PkEngine old = {.basespeed=1000, .basescroll=10, .profiles=profiles, .nprofiles=2};
+	PkEngine new = old;
+	enginereset(&old, 2);
+	enginereset(&new, 2);
+	enginemulspeed(&old, 1, 4);
+	enginestartmove(&old, 1, PK_RIGHT|PK_UP|PK_PROFILE(1));
+	enginesetm2s(&old, 0, 1);
+	enginestartmove(&old, 0, PK_DOWN);
+	PkFrame f;
+	enginestep(&old, 123456, 0, 100, &f);
+
+	HandoverSession s;
+	memset(&s, 0, sizeof s);
+	handoversave(&s, &old);
+	handoverrestore(&new, &s);
+	for (int i = 0; i < 3; i++) {
+		PkFrame want, got;
+		enginestep(&old, 16667, 0, 100, &want);
+		enginestep(&new, 16667, 0, 100, &got);
+		for (size_t ch = 0; ch < 2; ch++) {
+			PkPointerUpdate w = want.ptr[ch], g = got.ptr[ch];
+			PkScrollUpdate ws = want.scroll[ch], gs = got.scroll[ch];
+			if (g.dx != w.dx || g.dy != w.dy || gs.yevents != ws.yevents) {
+				jotf("step=%d ch=%zu got=%d,%d,%d want=%d,%d,%d",
+						i, ch, g.dx, g.dy, gs.yevents, w.dx, w.dy, ws.yevents);
+				rc = 1;
+			}
+		}
+	}
+	if (new.ptr.profile[1] != &profiles[1] || new.ptr.basespeed[0] != 10) {
+		jot("profile or move2scroll speed not restored");
+		rc = 1;
+	}
+	return rc;
+}
+
+int
+main()
+{
+	prove_init();
+	prove_run(test_handover_roundtrip);
+	prove_run(test_handover_version);
+	prove_run(test_handover_movement);
+	prove_exit();
+}
@@ -0,0 +1,232 @@
+// For robust mutexes.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "inject.h"
+
+// The ring is a bounded queue in the style of Dmitry Vyukov's: each slot's seq
+// says whether it's free for the producer reserving position pos (seq == pos)
+// or holds an event for the consumer draining position pos (seq == pos + 1).
+// Producers claim positions by advancing head with compare-and-swap, so any
+// number of them can share a ring.
+
+#define MASK (INJECT_RING_LEN - 1)
+
+
+// injectcreate creates and maps the ring with the given shm_open(3) name,
+// replacing any left by a previous run. Returns NULL and sets errno on error.
+InjectRing *
+injectcreate(const char *name)
+{
+	shm_unlink(name);
+	int fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600);
+	if (fd < 0) return NULL;
+	if (ftruncate(fd, sizeof(InjectRing))) goto fail;
+	InjectRing *r = mmap(NULL, sizeof *r, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (r == MAP_FAILED) goto fail;
+	close(fd);
+	injectinit(r);
+	if (injectown(r)) {
+		int err = errno;
+		munmap(r, sizeof *r);
+		shm_unlink(name);
+		errno = err;
+		return NULL;
+	}
+	return r;
+fail:;
+	int err = errno;
+	close(fd);
+	shm_unlink(name);
+	errno = err;
+	return NULL;
+}
+
+// injectadopt maps the ring open at fd, which a consumer that died or exec'd
+// created, and takes it over. Producers attached to it carry on. Returns NULL
+// and sets errno on error.
+InjectRing *
+injectadopt(int fd)
+{
+	struct stat st;
+	if (fstat(fd, &st)) return NULL;
+	if (st.st_size < (off_t)sizeof(InjectRing)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	InjectRing *r = mmap(NULL, sizeof *r, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (r == MAP_FAILED) return NULL;
+	int err = EINVAL;
+	if (r->magic != INJECT_MAGIC || r->version != INJECT_VERSION) goto fail;
+	if (injectown(r)) {
+		err = errno;
+		goto fail;
+	}
+	return r;
+fail:
+	munmap(r, sizeof *r);
+	errno = err;
+	return NULL;
+}
+
+// injectdestroy gives up ownership of the ring, so producers still attached
+// stop signalling, and unmaps it.
+void
+injectdestroy(InjectRing *r, const char *name)
+{
+	__atomic_store_n(&r->pid, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&r->owner);
+	munmap(r, sizeof *r);
+	if (name) shm_unlink(name);
+}
+
+// injectown makes the calling thread the ring's consumer, taking over from
+// one that died or exec'd. Returns nonzero and sets errno on error.
+int
+injectown(InjectRing *r)
+{
+	int err = pthread_mutex_lock(&r->owner);
+	if (err == EOWNERDEAD) err = pthread_mutex_consistent(&r->owner);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+	__atomic_store_n(&r->pid, getpid(), __ATOMIC_RELEASE);
+	return 0;
+}
+
+// injectattach maps an existing ring whose consumer is running. Returns NULL
+// and sets errno on error.
+InjectRing *
+injectattach(const char *name)
+{
+	int fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0) return NULL;
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(InjectRing)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	InjectRing *r = mmap(NULL, sizeof *r, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (r == MAP_FAILED) return NULL;
+	if (r->magic != INJECT_MAGIC || r->version != INJECT_VERSION) {
+		munmap(r, sizeof *r);
+		errno = EINVAL;
+		return NULL;
+	}
+	if (!injectisowned(r)) {
+		munmap(r, sizeof *r);
+		errno = ESRCH;
+		return NULL;
+	}
+	return r;
+}
+
+void
+injectinit(InjectRing *r)
+{
+	memset(r, 0, sizeof *r);
+	for (unsigned int i = 0; i < INJECT_RING_LEN; i++) r->ev[i].seq = i;
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&r->owner, &attr);
+	pthread_mutexattr_destroy(&attr);
+	r->version = INJECT_VERSION;
+	__atomic_store_n(&r->magic, INJECT_MAGIC, __ATOMIC_RELEASE);
+}
+
+// injectreserve returns a slot for the caller to fill in and pass to
+// injectcommit, or NULL if the ring is full.
+InjectEvent *
+injectreserve(InjectRing *r, unsigned int *pos)
+{
+	unsigned int p = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+	for (;;) {
+		InjectEvent *ev = &r->ev[p & MASK];
+		unsigned int seq = __atomic_load_n(&ev->seq, __ATOMIC_ACQUIRE);
+		int diff = (int)(seq - p);
+		if (diff < 0) return NULL;
+		if (diff > 0) {
+			p = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+			continue;
+		}
+		if (__atomic_compare_exchange_n(&r->head, &p, p + 1, 0,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			*pos = p;
+			return ev;
+		}
+	}
+}
+
+// injectisowned returns nonzero if a live consumer owns the ring. If the last
+// one died, its pid is cleared. It makes no system calls unless it has to
+// clean up after a dead owner.
+int
+injectisowned(InjectRing *r)
+{
+	int err = pthread_mutex_trylock(&r->owner);
+	if (err == EBUSY) return 1;
+	if (err == EOWNERDEAD) {
+		__atomic_store_n(&r->pid, 0, __ATOMIC_RELEASE);
+		err = pthread_mutex_consistent(&r->owner);
+	}
+	if (!err) pthread_mutex_unlock(&r->owner);
+	return 0;
+}
+
+// injectcommit publishes a reserved slot, waking the consumer if it's asleep.
+void
+injectcommit(InjectRing *r, InjectEvent *ev, unsigned int pos)
+{
+	__atomic_store_n(&ev->seq, pos + 1, __ATOMIC_RELEASE);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&r->sleeping, __ATOMIC_RELAXED) || !injectisowned(r)) return;
+	pid_t pid = __atomic_load_n(&r->pid, __ATOMIC_ACQUIRE);
+	if (pid > 0) kill(pid, SIGUSR1);
+}
+
+// injectpeek returns the next committed event without removing it, or NULL if
+// there isn't one. Only the consumer may call it.
+InjectEvent *
+injectpeek(InjectRing *r)
+{
+	InjectEvent *ev = &r->ev[r->tail & MASK];
+	unsigned int seq = __atomic_load_n(&ev->seq, __ATOMIC_ACQUIRE);
+	return seq == r->tail + 1 ? ev : NULL;
+}
+
+// injectrelease frees the slot returned by injectpeek.
+void
+injectrelease(InjectRing *r)
+{
+	InjectEvent *ev = &r->ev[r->tail & MASK];
+	__atomic_store_n(&ev->seq, r->tail + INJECT_RING_LEN, __ATOMIC_RELEASE);
+	__atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELAXED);
+}
+
+// injectsleep asks producers to signal the consumer when they commit, and
+// returns nonzero if there's already an event to drain, in which case the
+// consumer shouldn't sleep.
+int
+injectsleep(InjectRing *r)
+{
+	__atomic_store_n(&r->sleeping, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return injectpeek(r) != NULL;
+}
+
+void
+injectwake(InjectRing *r)
+{
+	__atomic_store_n(&r->sleeping, 0, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,71 @@
+#ifndef INJECT_H
+#define INJECT_H
+// Shared-memory ring for injecting motion and clicks from other programs.
+//
+// ptrkeys -i creates a ring named "/ptrkeys-DISPLAY" for each display it
+// serves. Producers attach with injectattach(), write events straight into
+// slots they reserve, and commit them. Each frame ptrkeys drains the ring
+// into the same integrator used for key movement, so a producer never waits
+// on ptrkeys or the xserver and costs no syscalls while ptrkeys is awake.
+//
+// While it's asleep, producers wake ptrkeys with SIGUSR1, but only while it
+// holds the ring's owner lock. The lock is a robust mutex, so if ptrkeys dies
+// its pid is never signalled again, even once it's been reused. Exec releases
+// it the same way, so ptrkeys can adopt its ring again after restarting
+// without producers having to attach again.
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#define INJECT_MAGIC 0x706b696e // "pkin"
+#define INJECT_VERSION 2
+#define INJECT_RING_LEN 1024 // Must be a power of two.
+
+enum InjectType {
+	INJECT_VELOCITY = 1, // Move at x, y px/s from usec until the next velocity.
+	INJECT_DISPLACEMENT, // Move by x, y px.
+	INJECT_BUTTON, // Press or release button.
+};
+
+typedef struct {
+	unsigned int seq; // Owned by the ring functions.
+	unsigned char type; // From enum InjectType.
+	unsigned char channel; // Pointer to move; see ptrkeys(1).
+	unsigned char button;
+	unsigned char press;
+	long long usec; // CLOCK_MONOTONIC time of the sample.
+	double x, y;
+} InjectEvent;
+
+typedef struct {
+	unsigned int magic, version;
+	pid_t pid; // Consumer, signalled with SIGUSR1 while it's sleeping.
+	int sleeping;
+	pthread_mutex_t owner; // Held by the consumer while pid is valid.
+	char pad0[64];
+	unsigned int head; // Next slot to reserve. Shared by producers.
+	char pad1[60];
+	unsigned int tail; // Next slot to drain. Only the consumer writes it.
+	char pad2[60];
+	InjectEvent ev[INJECT_RING_LEN];
+} InjectRing;
+
+// Consumer side.
+InjectRing *injectcreate(const char *name);
+InjectRing *injectadopt(int fd);
+void injectdestroy(InjectRing *r, const char *name);
+int injectown(InjectRing *r);
+InjectEvent *injectpeek(InjectRing *r);
+void injectrelease(InjectRing *r);
+int injectsleep(InjectRing *r);
+void injectwake(InjectRing *r);
+
+// Producer side.
+InjectRing *injectattach(const char *name);
+InjectEvent *injectreserve(InjectRing *r, unsigned int *pos);
+void injectcommit(InjectRing *r, InjectEvent *ev, unsigned int pos);
+
+void injectinit(InjectRing *r);
+int injectisowned(InjectRing *r);
+
+#endif
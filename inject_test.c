@@ -0,0 +1,232 @@
+// For MAP_ANONYMOUS.
+#define _DEFAULT_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "inject.h"
+#include "prove.h"
+#include "jot.h"
+
+int jottrace = 1;
+
+static InjectRing *
+newring()
+{
+	InjectRing *r = malloc(sizeof *r);
+	if (!r) die("newring: out of memory");
+	injectinit(r);
+	return r;
+}
+
+int
+test_inject_order()
+{
+	int rc = 0;
+	InjectRing *r = newring();
+	// Go around the ring a few times, with a few events outstanding.
+	int next = 0, want = 0;
+	for (int round = 0; round < 3 * INJECT_RING_LEN; round++) {
+		for (int i = 0; i < 3; i++) {
+			unsigned int pos;
+			InjectEvent *ev = injectreserve(r, &pos);
+			if (!ev) {
+				rc = 1;
+				jotf("round=%d: ring full", round);
+				goto done;
+			}
+			ev->x = next++;
+			injectcommit(r, ev, pos);
+		}
+		for (int i = 0; i < 3; i++) {
+			InjectEvent *ev = injectpeek(r);
+			if (!ev || ev->x != want) {
+				rc = 1;
+				jotf("round=%d: got %g want %d", round, ev ? ev->x : -1, want);
+				goto done;
+			}
+			want++;
+			injectrelease(r);
+		}
+	}
+	if (injectpeek(r)) {
+		rc = 1;
+		jot("event left after draining");
+	}
+done:
+	free(r);
+	return rc;
+}
+
+int
+test_inject_full()
+{
+	int rc = 0;
+	InjectRing *r = newring();
+	unsigned int pos;
+	for (int i = 0; i < INJECT_RING_LEN; i++) {
+		InjectEvent *ev = injectreserve(r, &pos);
+		if (!ev) {
+			rc = 1;
+			jotf("full after %d events, want %d", i, INJECT_RING_LEN);
+			goto done;
+		}
+		injectcommit(r, ev, pos);
+	}
+	if (injectreserve(r, &pos)) {
+		rc = 1;
+		jot("reserved a slot in a full ring");
+	}
+	// Draining one frees one.
+	injectrelease(r);
+	if (!injectreserve(r, &pos)) {
+		rc = 1;
+		jot("no slot after draining one");
+	}
+done:
+	free(r);
+	return rc;
+}
+
+int
+test_inject_uncommitted()
+{
+	int rc = 0;
+	InjectRing *r = newring();
+	// A slot reserved but not yet committed holds up later ones.
+	unsigned int pos1, pos2;
+	InjectEvent *ev1 = injectreserve(r, &pos1);
+	InjectEvent *ev2 = injectreserve(r, &pos2);
+	injectcommit(r, ev2, pos2);
+	if (injectpeek(r)) {
+		rc = 1;
+		jot("peeked past an uncommitted slot");
+	}
+	if (injectsleep(r)) {
+		rc = 1;
+		jot("injectsleep reported an event before it was committed");
+	}
+	injectcommit(r, ev1, pos1);
+	if (injectpeek(r) != ev1 || !injectsleep(r)) {
+		rc = 1;
+		jot("committed event not seen");
+	}
+	injectwake(r);
+	free(r);
+	return rc;
+}
+
+static volatile sig_atomic_t woken;
+
+static void
+onwake(int sig)
+{
+	(void)sig;
+	woken = 1;
+}
+
+static void
+commitone(InjectRing *r)
+{
+	unsigned int pos;
+	InjectEvent *ev = injectreserve(r, &pos);
+	if (!ev) die("commitone: ring full");
+	injectcommit(r, ev, pos);
+}
+
+// Only a consumer that still owns the ring is signalled, so the pid of one
+// that died is never signalled, even once it's been reused.
+int
+test_inject_owner()
+{
+	int rc = 0;
+	InjectRing *r = mmap(NULL, sizeof *r, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (r == MAP_FAILED) die("mmap failed");
+	injectinit(r);
+	signal(SIGUSR1, onwake);
+
+	pid_t child = fork();
+	if (child < 0) die("fork failed");
+	if (!child) {
+		if (injectown(r)) _exit(1);
+		injectsleep(r);
+		_exit(0);
+	}
+	int status;
+	if (waitpid(child, &status, 0) != child || status) die("consumer failed");
+	// As if this process had been given the dead consumer's pid.
+	r->pid = getpid();
+	commitone(r);
+	commitone(r);
+	if (woken || r->pid || injectisowned(r)) {
+		rc = 1;
+		jotf("dead consumer: woken=%d pid=%d", (int)woken, (int)r->pid);
+	}
+
+	if (injectown(r)) die("injectown failed");
+	injectsleep(r);
+	commitone(r);
+	if (!woken || !injectisowned(r)) {
+		rc = 1;
+		jot("live consumer not woken");
+	}
+	injectdestroy(r, NULL);
+	return rc;
+}
+
+// After its consumer execs, the ring can be adopted from the fd it kept, with
+// events committed meanwhile and producers still attached.
+int
+test_inject_adopt()
+{
+	int rc = 0;
+	FILE *tmp = tmpfile();
+	if (!tmp || ftruncate(fileno(tmp), sizeof(InjectRing))) die("tmpfile failed");
+	int fd = fileno(tmp);
+	InjectRing *p = mmap(NULL, sizeof *p, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) die("mmap failed");
+	injectinit(p);
+	pid_t child = fork();
+	if (child < 0) die("fork failed");
+	if (!child) _exit(injectown(p) ? 1 : 0);
+	int status;
+	if (waitpid(child, &status, 0) != child || status) die("consumer failed");
+	commitone(p);
+
+	InjectRing *r = injectadopt(fd);
+	if (!r) die("injectadopt failed");
+	if (!injectisowned(p) || r->pid != getpid()) {
+		rc = 1;
+		jotf("not owned after adopting: pid=%d", (int)r->pid);
+	}
+	if (!injectpeek(r)) {
+		rc = 1;
+		jot("event committed before adopting lost");
+	} else {
+		injectrelease(r);
+	}
+	commitone(p);
+	if (!injectpeek(r)) {
+		rc = 1;
+		jot("event committed after adopting not seen");
+	}
+	injectdestroy(r, NULL);
+	munmap(p, sizeof *p);
+	fclose(tmp);
+	return rc;
+}
+
+int
+main()
+{
+	prove_init();
+	prove_run(test_inject_order);
+	prove_run(test_inject_full);
+	prove_run(test_inject_uncommitted);
+	prove_run(test_inject_owner);
+	prove_run(test_inject_adopt);
+	prove_exit();
+}
@@ -1,15 +1,43 @@
-#include <assert.h>
+// For setenv(3), which the handover on restart uses.
+#define _DEFAULT_SOURCE
 #include <errno.h>
 #include <math.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
 #include <X11/XKBlib.h>
 #include <X11/Xlib.h>
 #include <X11/Xproto.h>
+#include <X11/Xatom.h>
 #include <X11/extensions/XTest.h>
 #include <X11/keysym.h>
+#ifdef XINERAMA
+#include <X11/extensions/Xinerama.h>
+#endif
+#ifdef XI2
+#include <X11/extensions/XInput.h>
+#include <X11/extensions/XInput2.h>
+#endif
+#ifdef MITSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#endif
 
 #ifndef _POSIX_MONOTONIC_CLOCK
 #error CLOCK_MONOTONIC not available
@@ -18,218 +46,541 @@
 #include "jot.h"
 #include "pk.h"
 #include "command.h"
+#include "conf.h"
+#include "edge.h"
+#include "engine.h"
+#include "handover.h"
+#include "inject.h"
+#include "state.h"
 
 
 #define LEN(X) (sizeof X / sizeof X[0])
-#define NOLOCKMASK(mask) (mask & ~(numlockmask|LockMask) & (ShiftMask|ControlMask|Mod1Mask|Mod2Mask|Mod3Mask|Mod4Mask|Mod5Mask))
+#define NOLOCKMASK(mask) (mask & ~(sel->numlockmask|LockMask) & (ShiftMask|ControlMask|Mod1Mask|Mod2Mask|Mod3Mask|Mod4Mask|Mod5Mask))
+
+#define ROOTMASK (MappingNotify|KeyPressMask|KeyReleaseMask|PropertyChangeMask)
 
 #define MAX_KEYSYM_DESC_LEN 100
+#define MAX_LAYER_DEPTH 8
+#define MAX_DISPLAYS 8
+#define MAX_GRAB_ERRORS 64
+#define MAX_CHORD_MS 100 // Longest a key press can be held back.
+#define CLASS_CACHE_LEN 32
 #define GRAB_KEYBOARD_TIMEOUT_MS 200
+#define HANDOVER_TIMEOUT_MS 1000 // For the old process's grabs to be released.
 
 
 static void handle_pending_events();
-static void request_scrolling(ScrollUpdate su);
+static int request_scrolling(Display *d, const PkFrame *f, int framems, int ms, unsigned long delay);
+static int notchesbefore(int events, int framems, int ms);
+static long long nowusec();
+static void setupchannels();
+static void warpby(size_t ch, int dx, int dy);
+static void warpto(size_t ch, int x, int y);
+static void fakebutton(size_t ch, unsigned int button, Bool press, unsigned long delay);
+static void fakebuttonon(Display *d, size_t ch, unsigned int button, Bool press, unsigned long delay);
+static int gridkeypress(KeySym keysym);
+static void warptocenter(PkRegion r);
+static PkRegion pointermonitor();
+static void pointerposition(size_t ch, int *x, int *y);
+static Window toplevel(Window w);
+static PkMark *markslot(const Arg *slot, const char *caller);
+static void updatekeysyms();
+static void builddispatches();
+static void resetlayers();
 static void keypress(XEvent *e);
 static void keyrelease(XEvent *e);
 static void grabkeys();
-static int grabkey(Key *key);
+static void keygrabs(Config *c, Grab **grabs, size_t *ngrabs, Grab **norepeats, size_t *nnorepeats);
+static int regrab(Grab *newgrabs, size_t nnewgrabs, Grab *newnorepeats, size_t nnewnorepeats);
+static int grabkeyset(Grab *g, size_t n);
+static void ungrabkey(Grab *g);
 static void setkeyrepeat(int mode);
+static void setrepeat(KeyCode code, int mode);
+static void defaultconfig(Config *c);
+static void watchconfig();
+static int configchanged();
+static void reloadconfig();
+static void waitforwork(int timeout, int isbusy);
 static void updatenumlockmask();
+static void refreshmapping(XMappingEvent *ev);
 static void cleanup();
 static int saveerror(Display *dpy, XErrorEvent *ee);
 static void msleep(long ms);
+#ifdef XI2
+static void closechannels();
+static void xievent(XGenericEventCookie *cookie);
+#endif
 
 
 #include "config.h"
 
 
+// Dispatch tables map keycodes to bindings while the keyboard is grabbed, one
+// for the base bindings followed by one for each layer, so switching layers
+// only swaps the dispatch pointer.
+typedef const Key *Dispatch[PK_NKEYCODES];
+
+// A Channel is a pointer that ptrkeys moves, with the keyboard that drives it.
+// With XI2 there's one for each master pointer, otherwise only the core
+// pointer.
+typedef struct {
+	int ptr, kbd; // XI2 device ids, or 0 for the core devices.
+#ifdef XI2
+	XDevice *xtest; // XTEST slave of ptr, for button events.
+#endif
+} Channel;
+
+// A ClassEntry caches which of appprofiles[] a window uses, or -1 for none,
+// so refocusing a window costs no round trips for its WM_CLASS.
+typedef struct {
+	Window win;
+	int app;
+} ClassEntry;
+
+// A Session is the state kept for each X display.
+typedef struct {
+	const char *name; // NULL for $DISPLAY.
+	Display *dpy;
+	Window root;
+	int numlockmask;
+	Grab *grabs, *norepeats; // Currently grabbed keys and NOREPEAT keys.
+	size_t ngrabs, nnorepeats;
+	Dispatch *dispatches;
+	const Key **dispatch;
+	size_t layerstack[MAX_LAYER_DEPTH]; // Indexes into dispatches.
+	size_t nlayerstack;
+	int islatched;
+	KeySym keysyms[PK_NKEYCODES]; // Unshifted keysym of each keycode.
+	const Key *pressed[PK_NKEYCODES]; // Binding each held key was pressed with.
+	unsigned char swallowed[32]; // Keycodes whose release is ignored.
+	PkMark marks[NMARKS];
+	int istrackingwindows;
+	Channel channels[PK_MAX_CHANNELS];
+	size_t nchannels;
+	size_t selchan; // Channel of the keyboard that pressed the last key.
+	unsigned char keychan[PK_NKEYCODES]; // Channel each held key was pressed on.
+	int xiopcode;
+	PkEngine engine;
+	int iskeyboardgrabbed;
+	int isgridding;
+	PkRegion gridregion;
+	char injectname[64]; // Ring for engine.inject, if injection is enabled.
+	int injectfd; // The ring's, kept to hand over on restart, or -1.
+	// Lag is measured by changing a property on probewin and timing the
+	// PropertyNotify, which the xserver sends once it's caught up.
+	Window probewin;
+	Atom probeatom;
+	int isprobing;
+	long long probesent, lag; // Microseconds.
+	Display *watchdpy; // The watchdog's connection.
+	// Connection for scroll events spread over a frame and macro playback.
+	// The xserver holds up a connection's later requests while a delayed one
+	// waits.
+	Display *delaydpy;
+	long long stepped; // When the engine was last stepped.
+	Atom netactivewindow;
+	Window active; // Focused window.
+	int app; // Index into appprofiles of the focused window, or -1.
+	ClassEntry classes[CLASS_CACHE_LEN];
+	size_t nextclass; // Entry to replace next.
+	TopLevel *tops; // Children of the root window, once snapping is used.
+	size_t ntops, topscap;
+	int istopsindexed;
+	int keyx, keyy; // Pointer position at the last key press.
+	PkMacro macro;
+	int isrecording;
+	long long recordstart;
+	int recx[PK_MAX_CHANNELS], recy[PK_MAX_CHANNELS]; // Pointer positions while recording.
+	PkMacroStep *plan; // Macro being played back, or NULL.
+	size_t nplan, played;
+	long long playstart;
+	KeyCode chordcode; // Key press held back for a chord, or 0.
+	long long chordpressed, chorddue; // When it was pressed and dispatches anyway.
+	const Chord *chorded; // Chord being held, or NULL.
+	KeyCode chordcodes[2]; // Its keys.
+	long chordwaits; // Key presses held back for chords that didn't come.
+	long long chordwaitusec, chordwaitmax; // How long, in total and at most.
+#ifdef MITSHM
+	XImage *shmimage; // Shared image snapedge captures into.
+	XShmSegmentInfo shminfo;
+	int isshmtried;
+#endif
+	PkStateFile *state; // Where the state is exported, if it is.
+	char statename[64];
+	int statefd; // Like injectfd.
+	PkState exported; // Last state published.
+} Session;
+
+static void setupsession(Session *s);
+static void selectsession(Session *s);
+static int updatesession(long long now, int spread);
+static void click(unsigned int button, Bool press);
+static void setupinject(Session *s, int fd);
+static void setupstate(Session *s, int fd);
+static void setfdflags(int flags);
+static void shmname(char *dst, size_t len, const char *prefix, Display *d);
+static void exportstate();
+static long long lap(int phase, long long since);
+static void notifyready();
+static void onrestart(int sig);
+static void reexec();
+static void takeover();
+static int handoverindex();
+static void releaseold(HandoverConn *c);
+static void resumesession(const HandoverSession *hs);
+static void onwake(int sig);
+static void startwatchdog();
+static void *watchdog(void *arg);
+static void releasestalled(Session *s);
+static void focuschanged();
+static Window activewindow();
+static int appofwindow(Window win);
+static void forgetwindow(Window win);
+static void applyapp();
+static void indextoplevels();
+static void querytoplevel(Window win);
+static TopLevel *findtoplevel(Window win);
+static void addtoplevel(Window win, PkRegion r, int ismapped);
+static void removetoplevel(Window win);
+static void record(PkMacroStep s);
+static void startplayback(const Arg *speed, int collapse);
+static void stopplayback();
+static int replay(long long now, int framems);
+static void playstep(Display *d, const PkMacroStep *s, unsigned long delay);
+static XImage *capture(int x, int y, int *ox, int *oy);
+static void releasecapture(XImage *img);
+#ifdef MITSHM
+static int setupshm();
+#endif
+static int edgedistance(XImage *img, int x, int y, int sx, int sy);
+static uint32_t pixelat(XImage *img, int x, int y);
+static void dispatchpress(KeyCode code);
+static int chordpress(KeyCode code, KeySym keysym, long long now);
+static int chordrelease(KeyCode code);
+static void flushchord(long long now);
+static void onalarm(int sig);
+static double cpuusec(const struct rusage *ru);
+
+
+// The display of the selected session, which Xlib calls use.
 Display *dpy = NULL;
 Window root;
-Movement mvptr = {.mul=1, .basespeed=BASE_SPEED};
-Movement mvscroll = {.mul=1, .basespeed=BASE_SCROLL};
-int iskeyboardgrabbed = 0;
 int quitting = 0;
 int interuptted = 0;
-int ismove2scroll = 0;
-
-static int numlockmask = Mod2Mask;
-static XErrorEvent savederror = {0};
 
-
-// setup connects to the xserver, configures the keyboard, and registers exit
-// and signal functions.
+static Config compiledcfg = {keys, LEN(keys), 0, FPS, BASE_SPEED, BASE_SCROLL, layers, LEN(layers)};
+Config *cfg = &compiledcfg;
+
+static Session sessions[MAX_DISPLAYS];
+static size_t nsessions = 0;
+static Session *sel = NULL; // Session whose event is being handled.
+static const char *configpath = NULL;
+static int inotifyfd = -1;
+static int isinjecting = 0;
+static int isexporting = 0;
+static int readyfd = -1;
+static int isready = 0;
+// Startup phases, timed for every display together.
+enum {
+	STARTUP_CONNECT,
+	STARTUP_MODIFIERS, // Modifier and keyboard mappings.
+	STARTUP_GRABS, // Until the xserver has confirmed them.
+	STARTUP_OTHER,
+	STARTUP_FIRSTTICK, // From setup until the event loop's first iteration.
+	NSTARTUP,
+};
+static const char *startupnames[NSTARTUP] = {"connect", "modifiers", "grabs", "other", "first tick"};
+static long long startupusec[NSTARTUP];
+static long long setupdone;
+static char **restartargv = NULL; // What to exec on restart, if restarting is enabled.
+static volatile sig_atomic_t isrestarting = 0;
+static Handover *handover = NULL; // From the process this one replaced.
+static int canresume = 0; // Whether handover's sessions are readable.
+static int wakepipe[2] = {-1, -1}; // Written by the SIGUSR1 handler.
+static PkProfileTable profiletables[LEN(profiles)];
+static XErrorEvent savederrors[MAX_GRAB_ERRORS];
+static int nsavederrors = 0;
+// The event loop bumps heartbeat each iteration and sets isidle while it's
+// waiting for work, and the watchdog thread reads them without locking.
+static unsigned long heartbeat = 0;
+static int isidle = 0;
+
+// loadconfig replaces the compiled-in config with the one in the file at path,
+// which setup will watch for changes. Exits if the file has errors.
 void
-setup()
+loadconfig(const char *path)
 {
-	dpy = XOpenDisplay(NULL);
-	if (!dpy) die("connect to xserver: failed");
-	root = DefaultRootWindow(dpy);
-
-	XSelectInput(dpy, root, MappingNotify|KeyPressMask|KeyReleaseMask);
-	updatenumlockmask();
-	grabkeys();
-	setkeyrepeat(AutoRepeatModeOff);
-	if (atexit(cleanup)) dief("atexit: %s", strerror(errno));
+	Config *c = malloc(sizeof *c);
+	if (!c) die("load config: out of memory");
+	defaultconfig(c);
+	if (loadconfigfile(c, path)) exit(1);
+	cfg = c;
+	configpath = path;
 }
 
-// runeventloop handles events from the xserver and scrolls and moves the
-// pointer until the quitting global is nonzero.
+// adddisplay makes setup connect to the named display as well as any others
+// added. With none added, setup uses $DISPLAY.
 void
-runeventloop()
+adddisplay(const char *name)
 {
-	struct timespec then;
-	if (clock_gettime(CLOCK_MONOTONIC, &then)) {
-		dief("get time: %s", strerror(errno));
-	}
-	for (; !quitting;) {
-		handle_pending_events();
+	if (nsessions == MAX_DISPLAYS) dief("add display %s: more than %d displays", name, MAX_DISPLAYS);
+	sessions[nsessions++].name = name;
+}
 
-		struct timespec now;
-		clock_gettime(CLOCK_MONOTONIC, &now);
-		int usec = (now.tv_sec - then.tv_sec) * 1000000 \
-				 + (now.tv_nsec - then.tv_nsec) / 1000;
-		then = now;
+// enableinject makes setup create an injection ring for each display.
+void
+enableinject()
+{
+	isinjecting = 1;
+}
 
-		request_scrolling(scrollupdate(&mvscroll, usec));
-		if (ismove2scroll) {
-			request_scrolling(scrollupdate(&mvptr, usec));
-		} else {
-			PointerUpdate pu = pointerupdate(&mvptr, usec);
-			XWarpPointer(dpy, None, None, 0, 0, 0, 0, pu.dx, pu.dy);
-		}
-		XFlush(dpy);
+// enablestate makes setup export the state of each display for status bars.
+void
+enablestate()
+{
+	isexporting = 1;
+}
 
-		// Don't use CPU unless there's work to do.
-		if (mvptr.dir || mvscroll.dir) {
-			msleep(1000/FPS);
-		} else {
-			XEvent ev;
-			XPeekEvent(dpy, &ev);
-			clock_gettime(CLOCK_MONOTONIC, &then);
-		}
-	}
+// notifywhenready makes ptrkeys write a newline to fd and close it once its
+// hotkeys work.
+void
+notifywhenready(int fd)
+{
+	readyfd = fd;
 }
 
+// restartwith makes ptrkeys exec argv on SIGUSR2 or the restart command,
+// handing its grabs and state over to the new process.
 void
-dieifbadbindings()
+restartwith(char *argv[])
 {
-	Key *localkeys = keys;
-	size_t len = LEN(keys);
-	if (modified_ungrabbed_keys_exist(localkeys, len)
-	|| modified_key_with_release_func_exists(localkeys, len)
-	|| duplicate_bindings_exist(localkeys, len)) {
-		exit(1);
-	}
+	restartargv = argv;
 }
 
-// waitforrelease waits for a KeyRelease event for the given keycode,
-// discarding other KeyPress and KeyRelease events until then.
+// setup connects to the xservers, configures their keyboards, and registers
+// exit and signal functions.
 void
-waitforrelease(KeyCode keycode)
+setup()
 {
-	tracef("wait for release: %d", keycode);
-	for (;;) {
-		XEvent ev;
-		XMaskEvent(dpy, KeyPressMask|KeyReleaseMask, &ev);
-		if (ev.xkey.keycode == keycode) {
-			tracef("released %d", keycode);
-			return;
+	compiledcfg.internalmods = internalmods;
+	for (size_t i = 0; i < LEN(profiles); i++) {
+		pk_buildprofile(&profiletables[i], &profiles[i]);
+	}
+	if (!nsessions) adddisplay(NULL);
+	if (isinjecting) {
+		// Producers signal ptrkeys while it's asleep, and the handler wakes
+		// poll by writing to a pipe.
+		if (pipe(wakepipe)) dief("pipe: %s", strerror(errno));
+		for (int i = 0; i < 2; i++) {
+			fcntl(wakepipe[i], F_SETFL, O_NONBLOCK);
+			fcntl(wakepipe[i], F_SETFD, FD_CLOEXEC);
+		}
+		struct sigaction sa = {.sa_handler = onwake};
+		sigemptyset(&sa.sa_mask);
+		sa.sa_flags = SA_RESTART;
+		if (sigaction(SIGUSR1, &sa, NULL)) dief("sigaction: %s", strerror(errno));
+	}
+	if (restartargv) {
+		// Without SA_RESTART, so the signal interrupts poll.
+		struct sigaction sa = {.sa_handler = onrestart};
+		sigemptyset(&sa.sa_mask);
+		if (sigaction(SIGUSR2, &sa, NULL)) dief("sigaction: %s", strerror(errno));
+	}
+	takeover();
+	for (size_t i = 0; i < nsessions; i++) setupsession(&sessions[i]);
+	if (handover) {
+		// Those of displays this process doesn't serve.
+		for (size_t i = 0; i < handover->nsessions; i++) {
+			if (handover->conns[i].xfd >= 0) close(handover->conns[i].xfd);
+			if (!canresume) continue;
+			if (handover->sessions[i].injectfd >= 0) close(handover->sessions[i].injectfd);
+			if (handover->sessions[i].statefd >= 0) close(handover->sessions[i].statefd);
 		}
+		free(handover);
+		handover = NULL;
 	}
+	long long t = nowusec();
+	if (configpath) watchconfig();
+	if (atexit(cleanup)) dief("atexit: %s", strerror(errno));
+	if (WATCHDOG_MS > 0) startwatchdog();
+	setupdone = lap(STARTUP_OTHER, t);
+}
+
+// runeventloop handles events from the xservers and scrolls and moves their
+// pointers until the quitting global is nonzero.
+void
+runeventloop()
+{
+	for (; !quitting;) runonce();
 }
 
+// runonce is an iteration of the event loop: it handles pending events, steps
+// every session's engine, then sleeps until the next frame if any is busy, or
+// else until there's work to do.
 void
-startdir(Movement *m, unsigned int dir)
+runonce()
 {
-	if (dir & UP && dir & DOWN) {
-		die("startdir: both UP and DOWN given");
+	__atomic_store_n(&heartbeat, heartbeat + 1, __ATOMIC_RELAXED);
+	if (isrestarting) reexec();
+	if (inotifyfd >= 0 && configchanged()) reloadconfig();
+	for (size_t i = 0; i < nsessions; i++) {
+		selectsession(&sessions[i]);
+		handle_pending_events();
+		if (sel->state) exportstate();
 	}
-	if (dir & LEFT && dir & RIGHT) {
-		die("startdir: both LEFT and RIGHT given");
+
+	long long now = nowusec();
+	int busy = 0;
+	int timeout = -1; // Until the next held-back key press is due, in ms.
+	for (size_t i = 0; i < nsessions; i++) {
+		selectsession(&sessions[i]);
+		if (sel->chordcode && now >= sel->chorddue) flushchord(now);
+		busy |= updatesession(now, 1);
+		if (!sel->chordcode) continue;
+		int due = (sel->chorddue - now + 999) / 1000;
+		if (timeout < 0 || due < timeout) timeout = due;
 	}
-	if (dir & (UP|DOWN)) {
-		m->yrem = 0;
-		m->ycont = 0;
+	if (!isready) {
+		lap(STARTUP_FIRSTTICK, setupdone);
+		notifyready();
 	}
-	if (dir & UP) {
-		m->dir &= ~DOWN;
-		m->dir |= UP;
+
+	// Don't use CPU unless there's work to do.
+	if (!busy) {
+		waitforwork(timeout, 0);
+		now = nowusec();
+		for (size_t i = 0; i < nsessions; i++) sessions[i].stepped = now;
+		return;
 	}
-	if (dir & DOWN) {
-		m->dir &= ~UP;
-		m->dir |= DOWN;
+	// Handle events as they arrive until the next frame, so a click goes out
+	// right away instead of waiting out the frame.
+	int frame = 1000/cfg->fps;
+	long long next = now + 1000LL * (timeout >= 0 && timeout < frame ? timeout : frame);
+	for (long long left; (left = next - nowusec()) > 0;) {
+		waitforwork((left + 999) / 1000, 1);
+		for (size_t i = 0; i < nsessions; i++) {
+			selectsession(&sessions[i]);
+			handle_pending_events();
+		}
 	}
-	if (dir & (LEFT|RIGHT)) {
-		m->xrem = 0;
-		m->xcont = 0;
+}
+
+void
+dieifbadbindings()
+{
+	if (badconfig(cfg)) exit(1);
+	if (!GRID_COLS || LEN(gridkeys) % GRID_COLS) {
+		jotf("gridkeys has %zu keys, which isn't a multiple of GRID_COLS=%d",
+				LEN(gridkeys), GRID_COLS);
+		exit(1);
 	}
-	if (dir & LEFT) {
-		m->dir &= ~RIGHT;
-		m->dir |= LEFT;
+	if (CHORD_MS > MAX_CHORD_MS) {
+		jotf("CHORD_MS=%d is over the limit of %dms", CHORD_MS, MAX_CHORD_MS);
+		exit(1);
 	}
-	if (dir & RIGHT) {
-		m->dir &= ~LEFT;
-		m->dir |= RIGHT;
+	if (PTR_PROFILE >= LEN(profiles) || SCROLL_PROFILE >= LEN(profiles)) {
+		jotf("default profile out of range: ptr=%d scroll=%d profiles=%zu",
+				PTR_PROFILE, SCROLL_PROFILE, LEN(profiles));
+		exit(1);
 	}
 }
 
+// A Phase is a state the benchmark holds ptrkeys in while measuring it.
+typedef struct {
+	const char *name;
+	void (*start)(const Arg *);
+	void (*stop)(const Arg *);
+	const Arg arg;
+} Phase;
+
+static const Phase phases[] = {
+	{"idle",    NULL,         NULL,           {0}},
+	{"move",    movestart,    movestop,       {.ui=RIGHT}},
+	{"scroll",  scrollstart,  scrollstop,     {.ui=DOWN}},
+	{"grabbed", grabkeyboard, ungrabkeyboard, {0}},
+};
+
+// runbenchmark runs the event loop for the given number of seconds in each
+// phase on the first display, and prints what it cost. Wakeups are voluntary
+// context switches, each of which is a sleep that ended, and include the
+// watchdog's.
 void
-stopdir(Movement *m, unsigned int dir)
+runbenchmark(int seconds)
 {
-	m->dir &= ~dir;
+	struct sigaction sa = {.sa_handler = onalarm};
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGALRM, &sa, NULL)) dief("sigaction: %s", strerror(errno));
+	printf("%-8s %10s %10s %10s\n", "phase", "cpu ms/s", "csw/s", "wakeups/s");
+	for (size_t i = 0; i < LEN(phases); i++) {
+		const Phase *p = &phases[i];
+		selectsession(&sessions[0]);
+		if (p->start) p->start(&p->arg);
+		XSync(dpy, False);
+		// Repeat the alarm in case it arrives just before the event loop
+		// goes to sleep.
+		struct itimerval timer = {{0, 100000}, {seconds, 0}};
+		struct rusage before, after;
+		getrusage(RUSAGE_SELF, &before);
+		long long start = nowusec();
+		quitting = 0;
+		setitimer(ITIMER_REAL, &timer, NULL);
+		runeventloop();
+		setitimer(ITIMER_REAL, &(struct itimerval){{0, 0}, {0, 0}}, NULL);
+		double secs = (nowusec() - start) / 1e6;
+		getrusage(RUSAGE_SELF, &after);
+		selectsession(&sessions[0]);
+		if (p->stop) p->stop(&p->arg);
+		XSync(dpy, False);
+		long vcsw = after.ru_nvcsw - before.ru_nvcsw;
+		long ivcsw = after.ru_nivcsw - before.ru_nivcsw;
+		printf("%-8s %10.3f %10.1f %10.1f\n", p->name,
+				(cpuusec(&after) - cpuusec(&before)) / 1e3 / secs,
+				(vcsw + ivcsw) / secs, vcsw / secs);
+		fflush(stdout);
+	}
+	quitting = 0;
 }
 
-PointerUpdate
-pointerupdate(Movement *m, int usec)
+static void
+onalarm(int sig)
 {
-	PointerUpdate pu = {0};
-	if (!m->dir) return pu;
-	// xsign and ysign can be one of -1, 0, 1.
-	double xsign = ((m->dir & RIGHT) ? 1 : 0) - ((m->dir & LEFT) ? 1 : 0);
-	double ysign = ((m->dir & UP) ? 1 : 0) - ((m->dir & DOWN) ? 1 : 0);
-	double dx = m->basespeed * xsign * m->mul * usec / 1e6 + m->xrem;
-	double dy = - m->basespeed * ysign * m->mul * usec / 1e6 + m->yrem;
-	double dummy;
-	m->xrem = modf(dx, &dummy);
-	m->yrem = modf(dy, &dummy);
-	pu.dx = (int)dx;
-	pu.dy = (int)dy;
-	return pu;
+	(void)sig;
+	quitting = 1;
 }
 
-ScrollUpdate
-scrollupdate(Movement *m, int usec)
+static double
+cpuusec(const struct rusage *ru)
 {
-	ScrollUpdate su = {0};
-	if (!m->dir) return su;
-	// xsign and ysign can be one of 0, 1.
-	double xsign = ((m->dir & (LEFT|RIGHT)) ? 1 : 0);
-	double ysign = ((m->dir & (UP|DOWN)) ? 1 : 0);
-	double dx = m->basespeed * xsign * m->mul * usec / 1e6 + m->xrem;
-	double dy = m->basespeed * ysign * m->mul * usec / 1e6 + m->yrem;
-	double dummy;
-	m->xrem = modf(dx, &dummy);
-	m->yrem = modf(dy, &dummy);
-
-	su.xbutton = (m->dir & LEFT) ? SCROLLLEFT : SCROLLRIGHT;
-	su.ybutton = (m->dir & UP) ? SCROLLUP : SCROLLDOWN;
+	return ru->ru_utime.tv_sec * 1e6 + ru->ru_utime.tv_usec
+		+ ru->ru_stime.tv_sec * 1e6 + ru->ru_stime.tv_usec;
+}
 
-	su.xevents = abs((int)dx);
-	su.yevents = abs((int)dy);
-	// Scroll immediately after a scroll key is pressed, but adjust the
-	// remainder so the configured number of scroll events occur in the first
-	// second.
-	if (!su.xevents && (m->dir & (LEFT|RIGHT)) && !m->xcont) {
-		su.xevents += 1;
-		m->xrem -= 1;
-	}
-	if (!su.yevents && (m->dir & (UP|DOWN)) && !m->ycont) {
-		su.yevents += 1;
-		m->yrem -= 1;
+// waitforrelease waits for a KeyRelease event for the given keycode,
+// discarding other KeyPress and KeyRelease events until then.
+void
+waitforrelease(KeyCode keycode)
+{
+	tracef("wait for release: %d", keycode);
+	// The key may be held for longer than the watchdog allows, so the
+	// heartbeat goes on while it's still down. If its release is lost, the
+	// watchdog can still step in.
+	int interval = WATCHDOG_MS > 0 ? (WATCHDOG_MS / 4 ? WATCHDOG_MS / 4 : 1) : -1;
+	for (;;) {
+		XEvent ev;
+		if (XCheckMaskEvent(dpy, KeyPressMask|KeyReleaseMask, &ev)) {
+			if (ev.xkey.keycode != keycode) continue;
+			tracef("released %d", keycode);
+			return;
+		}
+		struct pollfd fd = {ConnectionNumber(dpy), POLLIN, 0};
+		if (poll(&fd, 1, interval) < 0 && errno != EINTR) dief("poll: %s", strerror(errno));
+		if (interval < 0) continue;
+		char keys[32];
+		XQueryKeymap(dpy, keys);
+		if (keys[keycode/8] & 1 << keycode%8) {
+			__atomic_store_n(&heartbeat, heartbeat + 1, __ATOMIC_RELAXED);
+		}
 	}
-	m->xcont = 1;
-	m->ycont = 1;
-	return su;
 }
 
 // sprintkeysym prints a representation of the given keysym and modifiers to
@@ -259,10 +610,10 @@ sprintkeysym(char *dst, size_t dstlen, KeySym keysym, int mods)
 		if (strappend(dst, dstlen, "+")) goto toolong;
 	}
 	char *keystr = XKeysymToString(keysym);
+	char hex[32];
 	if (!keystr) {
-		int n = snprintf(dst, dstlen, "%s%lx", dst, keysym);
-		assert(n >= 0);
-		if ((unsigned)n >= dstlen) goto toolong;
+		snprintf(hex, sizeof hex, "0x%lx", keysym);
+		keystr = hex;
 	}
 	if (strappend(dst, dstlen, keystr)) goto toolong;
 	return;
@@ -294,24 +645,82 @@ cleanup:
 	return err;
 }
 
+// grabdiff writes the grabs in a that aren't in b to out, which must have room
+// for alen grabs, and returns how many there are.
+size_t
+grabdiff(const Grab *a, size_t alen, const Grab *b, size_t blen, Grab *out)
+{
+	size_t n = 0;
+	for (size_t i = 0; i < alen; i++) {
+		size_t j = 0;
+		for (; j < blen; j++) {
+			if (a[i].code == b[j].code && a[i].mod == b[j].mod) break;
+		}
+		if (j == blen) out[n++] = a[i];
+	}
+	return n;
+}
+
+// badconfig reports problems with c's bindings. Returns nonzero if there are
+// any.
+int
+badconfig(Config *c)
+{
+	if (badbindings(c->keys, c->nkeys, c->nlayers)) return 1;
+	for (size_t i = 0; i < c->nlayers; i++) {
+		Layer *layer = &c->layers[i];
+		if (modified_layer_keys_exist(layer)
+		|| badbindings(layer->keys, layer->nkeys, c->nlayers)) {
+			jotf("in layer %s", layer->name);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// badbindings reports problems with a set of bindings. Returns nonzero if
+// there are any.
+int
+badbindings(Key *localkeys, size_t len, size_t nlayers)
+{
+	return modified_ungrabbed_keys_exist(localkeys, len)
+		|| modified_key_with_release_func_exists(localkeys, len)
+		|| duplicate_bindings_exist(localkeys, len)
+		|| bad_profile_exists(localkeys, len, LEN(profiles))
+		|| bad_layer_exists(localkeys, len, nlayers)
+		|| bad_mark_exists(localkeys, len, NMARKS);
+}
+
+// duplicate_bindings_exist reports keys bound more than once with the same
+// modifiers and GRAB option, using a hash table so that large configs are
+// checked in linear time.
 int
 duplicate_bindings_exist(Key *localkeys, size_t len)
 {
-	for (size_t i = 0; i < len; i++) {
-		Key a = localkeys[i];
-		for (size_t j = 0; j < len; j++) {
-			if (i == j) continue;
-			Key b = localkeys[j];
-			if (a.keysym != b.keysym) continue;
-			if ((a.opts & GRAB) != (b.opts & GRAB)) continue;
-			if (a.mod != b.mod) continue;
+	size_t cap = 16;
+	while (cap < 2 * len) cap *= 2;
+	Key **table = calloc(cap, sizeof *table);
+	if (!table) die("duplicate_bindings_exist: out of memory");
+	int found = 0;
+	for (size_t i = 0; i < len && !found; i++) {
+		Key *a = &localkeys[i];
+		unsigned long hash = (a->keysym * 2654435761UL) ^ (a->mod << 1) ^ (a->opts & GRAB);
+		size_t h = hash & (cap - 1);
+		for (; table[h]; h = (h + 1) & (cap - 1)) {
+			Key *b = table[h];
+			if (a->keysym != b->keysym) continue;
+			if ((a->opts & GRAB) != (b->opts & GRAB)) continue;
+			if (a->mod != b->mod) continue;
 			char keystr[MAX_KEYSYM_DESC_LEN] = {0};
-			sprintkeysym(keystr, LEN(keystr), a.keysym, a.mod);
+			sprintkeysym(keystr, LEN(keystr), a->keysym, a->mod);
 			jotf("multiple bindings for %s", keystr);
-			return 1;
+			found = 1;
+			break;
 		}
+		table[h] = a;
 	}
-	return 0;
+	free(table);
+	return found;
 }
 
 int
@@ -341,42 +750,1331 @@ modified_ungrabbed_keys_exist(Key *localkeys, size_t len)
 			return 1;
 		}
 	}
-	return 0;
+	return 0;
+}
+
+// bad_profile_exists reports movestart and scrollstart bindings that select a
+// profile beyond the first nprofiles.
+int
+bad_profile_exists(Key *localkeys, size_t len, size_t nprofiles)
+{
+	for (size_t i = 0; i < len; i++) {
+		Key key = localkeys[i];
+		const Arg *args[] = {&key.pressarg, &key.releasearg};
+		void (*funcs[])(const Arg *) = {key.pressfunc, key.releasefunc};
+		for (size_t j = 0; j < LEN(funcs); j++) {
+			if (funcs[j] != movestart && funcs[j] != scrollstart) continue;
+			unsigned int n = args[j]->ui >> PK_PROFILE_SHIFT;
+			if (n <= nprofiles) continue;
+			char keystr[MAX_KEYSYM_DESC_LEN] = {0};
+			sprintkeysym(keystr, LEN(keystr), key.keysym, key.mod);
+			jotf("binding for %s uses undefined profile %u", keystr, n - 1);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// bad_layer_exists reports layer bindings that refer to a layer beyond the
+// first nlayers.
+int
+bad_layer_exists(Key *localkeys, size_t len, size_t nlayers)
+{
+	for (size_t i = 0; i < len; i++) {
+		Key key = localkeys[i];
+		const Arg *args[] = {&key.pressarg, &key.releasearg};
+		void (*funcs[])(const Arg *) = {key.pressfunc, key.releasefunc};
+		for (size_t j = 0; j < LEN(funcs); j++) {
+			if (funcs[j] != pushlayer && funcs[j] != latchlayer) continue;
+			if (args[j]->i >= 0 && (size_t)args[j]->i < nlayers) continue;
+			char keystr[MAX_KEYSYM_DESC_LEN] = {0};
+			sprintkeysym(keystr, LEN(keystr), key.keysym, key.mod);
+			jotf("binding for %s uses undefined layer %d", keystr, args[j]->i);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// bad_mark_exists reports mark bindings that refer to a slot beyond the first
+// nmarks.
+int
+bad_mark_exists(Key *localkeys, size_t len, size_t nmarks)
+{
+	for (size_t i = 0; i < len; i++) {
+		Key key = localkeys[i];
+		const Arg *args[] = {&key.pressarg, &key.releasearg};
+		void (*funcs[])(const Arg *) = {key.pressfunc, key.releasefunc};
+		for (size_t j = 0; j < LEN(funcs); j++) {
+			if (funcs[j] != setmark && funcs[j] != setwinmark && funcs[j] != gotomark) continue;
+			if (args[j]->i >= 0 && (size_t)args[j]->i < nmarks) continue;
+			char keystr[MAX_KEYSYM_DESC_LEN] = {0};
+			sprintkeysym(keystr, LEN(keystr), key.keysym, key.mod);
+			jotf("binding for %s uses undefined mark %d", keystr, args[j]->i);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// modified_layer_keys_exist reports layer bindings with modifiers, which can
+// never be used since layers are only active while the keyboard is grabbed.
+int
+modified_layer_keys_exist(Layer *layer)
+{
+	for (size_t i = 0; i < layer->nkeys; i++) {
+		Key key = layer->keys[i];
+		if (!key.mod) continue;
+		char keystr[MAX_KEYSYM_DESC_LEN] = {0};
+		sprintkeysym(keystr, LEN(keystr), key.keysym, key.mod);
+		jotf("binding with modifiers in layer %s: %s", layer->name, keystr);
+		return 1;
+	}
+	return 0;
+}
+
+// setupsession connects to s's display and configures its keyboard.
+static void
+setupsession(Session *s)
+{
+	long long t = nowusec();
+	s->dpy = XOpenDisplay(s->name);
+	if (!s->dpy) dief("connect to xserver %s: failed", XDisplayName(s->name));
+	t = lap(STARTUP_CONNECT, t);
+	s->root = DefaultRootWindow(s->dpy);
+	s->numlockmask = Mod2Mask;
+	s->nchannels = 1;
+	s->xiopcode = -1;
+	selectsession(s);
+
+	XSelectInput(dpy, root, ROOTMASK);
+	s->probewin = XCreateSimpleWindow(dpy, root, -1, -1, 1, 1, 0, 0, 0);
+	XSelectInput(dpy, s->probewin, PropertyChangeMask);
+	s->probeatom = XInternAtom(dpy, "_PTRKEYS_PROBE", False);
+	s->netactivewindow = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", False);
+	s->app = -1;
+	s->engine.profiles = profiletables;
+	s->engine.nprofiles = LEN(profiletables);
+	s->engine.ptrprofile = PTR_PROFILE;
+	s->engine.scrollprofile = SCROLL_PROFILE;
+	s->engine.maxbacklog = SCROLL_MAX_BACKLOG;
+	s->engine.maxstepusec = MAX_STEP_MS * 1000;
+	s->engine.stallpolicy = STALL_POLICY;
+	setupchannels();
+	t = lap(STARTUP_OTHER, t);
+	updatenumlockmask();
+	updatekeysyms();
+	t = lap(STARTUP_MODIFIERS, t);
+	builddispatches();
+	int old = handoverindex();
+	if (old >= 0) releaseold(&handover->conns[old]);
+	grabkeys();
+	t = lap(STARTUP_GRABS, t);
+	resetmovement(NULL);
+	focuschanged();
+	int injectfd = -1, statefd = -1;
+	if (old >= 0 && canresume) {
+		HandoverSession *hs = &handover->sessions[old];
+		resumesession(hs);
+		injectfd = hs->injectfd;
+		statefd = hs->statefd;
+		hs->injectfd = hs->statefd = -1;
+	}
+	s->stepped = nowusec();
+	s->injectfd = s->statefd = -1;
+	if (isinjecting) setupinject(s, injectfd);
+	else if (injectfd >= 0) close(injectfd);
+	if (isexporting) setupstate(s, statefd);
+	else if (statefd >= 0) close(statefd);
+	if (WATCHDOG_MS > 0) {
+		s->watchdpy = XOpenDisplay(s->name);
+		if (!s->watchdpy) jotf("watchdog: connect to %s: failed", XDisplayName(s->name));
+	}
+	s->delaydpy = XOpenDisplay(s->name);
+	if (!s->delaydpy) jotf("scroll: connect to %s: failed, not spreading scrolls", XDisplayName(s->name));
+	lap(STARTUP_OTHER, t);
+}
+
+// lap adds the time since since to the startup phase and returns the current
+// time.
+static long long
+lap(int phase, long long since)
+{
+	long long now = nowusec();
+	startupusec[phase] += now - since;
+	return now;
+}
+
+// notifyready reports that the hotkeys work, and how long startup took, by
+// writing a newline to the fd given to notifywhenready, as s6 expects, and
+// sending READY=1 to $NOTIFY_SOCKET, as systemd does.
+static void
+notifyready()
+{
+	isready = 1;
+	char status[256] = "startup";
+	long long total = 0;
+	for (int i = 0; i < NSTARTUP; i++) {
+		size_t n = strlen(status);
+		snprintf(status + n, sizeof status - n, "%s %s %.1fms", i ? "," : "",
+				startupnames[i], startupusec[i] / 1e3);
+		total += startupusec[i];
+	}
+	size_t n = strlen(status);
+	snprintf(status + n, sizeof status - n, ", total %.1fms", total / 1e3);
+	tracef("%s", status);
+
+	if (readyfd >= 0) {
+		if (write(readyfd, "\n", 1) != 1) jotf("notify ready: %s", strerror(errno));
+		close(readyfd);
+		readyfd = -1;
+	}
+
+	const char *path = getenv("NOTIFY_SOCKET");
+	if (!path || !*path) return;
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	size_t len = strlen(path);
+	if (len >= sizeof addr.sun_path) {
+		jotf("notify ready: NOTIFY_SOCKET too long: %s", path);
+		return;
+	}
+	memcpy(addr.sun_path, path, len);
+	// A leading @ means an abstract socket.
+	if (addr.sun_path[0] == '@') addr.sun_path[0] = '\0';
+	char msg[sizeof status + 32];
+	int msglen = snprintf(msg, sizeof msg, "READY=1\nSTATUS=%s", status);
+	int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	socklen_t addrlen = offsetof(struct sockaddr_un, sun_path) + len;
+	if (fd < 0 || sendto(fd, msg, msglen, 0, (struct sockaddr *)&addr, addrlen) < 0) {
+		jotf("notify ready: %s: %s", path, strerror(errno));
+	}
+	if (fd >= 0) close(fd);
+}
+
+// reexec execs restartargv, handing over the state of each session and its
+// connection, which keeps the keys grabbed until the new process has closed
+// it. If the exec fails, ptrkeys carries on as it was.
+static void
+reexec()
+{
+	isrestarting = 0;
+	Handover *h = calloc(1, sizeof *h);
+	if (!h) {
+		jot("restart: out of memory");
+		return;
+	}
+	h->nsessions = nsessions;
+	for (size_t i = 0; i < nsessions; i++) {
+		selectsession(&sessions[i]);
+		// A key press held back for a chord wouldn't be dispatched.
+		if (sel->chordcode) flushchord(nowusec());
+		HandoverConn *c = &h->conns[i];
+		snprintf(c->display, sizeof c->display, "%s", DisplayString(dpy));
+		c->xfd = ConnectionNumber(dpy);
+		c->probewin = sel->probewin;
+		HandoverSession *hs = &h->sessions[i];
+		hs->iskeyboardgrabbed = sel->iskeyboardgrabbed;
+		for (size_t j = 0; j < sel->nlayerstack; j++) {
+			const char *name = cfg->layers[sel->layerstack[j] - 1].name;
+			snprintf(hs->layers[j], sizeof hs->layers[j], "%s", name ? name : "");
+		}
+		hs->nlayers = sel->nlayerstack;
+		hs->islatched = sel->islatched;
+		hs->selchan = sel->selchan;
+		memcpy(hs->keychan, sel->keychan, sizeof hs->keychan);
+		handoversave(hs, &sel->engine);
+		hs->injectfd = sel->engine.inject ? sel->injectfd : -1;
+		hs->statefd = sel->state ? sel->statefd : -1;
+		// The new process can't tell where a half-sent request ends.
+		XSync(dpy, False);
+	}
+	int fd = handoverwrite(h);
+	free(h);
+	if (fd < 0) {
+		jotf("restart: %s", strerror(errno));
+		return;
+	}
+	char env[16];
+	snprintf(env, sizeof env, "%d", fd);
+	setenv(HANDOVER_ENV, env, 1);
+	setfdflags(0);
+	tracef("restart: exec %s", restartargv[0]);
+	execvp(restartargv[0], restartargv);
+
+	jotf("restart: exec %s: %s", restartargv[0], strerror(errno));
+	unsetenv(HANDOVER_ENV);
+	close(fd);
+	setfdflags(FD_CLOEXEC);
+}
+
+// setfdflags sets the fd flags of the fds handed over on restart, to keep
+// them open across the exec or not.
+static void
+setfdflags(int flags)
+{
+	for (size_t i = 0; i < nsessions; i++) {
+		Session *s = &sessions[i];
+		fcntl(ConnectionNumber(s->dpy), F_SETFD, flags);
+		if (s->engine.inject && s->injectfd >= 0) fcntl(s->injectfd, F_SETFD, flags);
+		if (s->state && s->statefd >= 0) fcntl(s->statefd, F_SETFD, flags);
+	}
+}
+
+// takeover reads the handover left by the process this one replaced, if it
+// was started by reexec.
+static void
+takeover()
+{
+	const char *env = getenv(HANDOVER_ENV);
+	if (!env) return;
+	int fd = atoi(env);
+	unsetenv(HANDOVER_ENV);
+	handover = malloc(sizeof *handover);
+	if (!handover) die("take over: out of memory");
+	int rc = handoverread(fd, handover);
+	if (rc < 0) {
+		// Any old connections are left open, so grabbing will fail.
+		jotf("take over: %s", strerror(errno));
+		free(handover);
+		handover = NULL;
+		return;
+	}
+	if (rc) jot("take over: handed over by an incompatible version; starting afresh");
+	canresume = !rc;
+	// The old process already notified readiness, and the fd it was given
+	// might be something else's by now.
+	readyfd = -1;
+}
+
+// handoverindex returns the index of the selected session's display in the
+// handover, or -1.
+static int
+handoverindex()
+{
+	if (!handover) return -1;
+	for (size_t i = 0; i < handover->nsessions; i++) {
+		if (!strcmp(handover->conns[i].display, DisplayString(dpy))) return i;
+	}
+	return -1;
+}
+
+// releaseold closes the old process's connection c and waits for the xserver
+// to release its grabs. The xserver frees all of a client's resources at
+// once, so they're gone when the probe window it created is.
+static void
+releaseold(HandoverConn *c)
+{
+	XErrorHandler defaulthandler = XSetErrorHandler(saveerror);
+	nsavederrors = 0;
+	XSelectInput(dpy, c->probewin, StructureNotifyMask);
+	XSync(dpy, False);
+	XSetErrorHandler(defaulthandler);
+	close(c->xfd);
+	c->xfd = -1;
+	if (nsavederrors) return; // Already gone.
+	long long start = nowusec();
+	XEvent ev;
+	while (!XCheckTypedWindowEvent(dpy, c->probewin, DestroyNotify, &ev)) {
+		if (nowusec() - start > HANDOVER_TIMEOUT_MS * 1000LL) {
+			jotf("take over: %s: old connection still open after %dms", c->display, HANDOVER_TIMEOUT_MS);
+			return;
+		}
+		struct pollfd fd = {ConnectionNumber(dpy), POLLIN, 0};
+		poll(&fd, 1, 10);
+	}
+	tracef("take over: %s: released after %lldus", c->display, nowusec() - start);
+}
+
+// resumesession restores the selected session's keyboard grab, layers and
+// movement from hs. Layers are matched by name, in case the config changed.
+static void
+resumesession(const HandoverSession *hs)
+{
+	sel->selchan = hs->selchan < sel->nchannels ? hs->selchan : 0;
+	for (size_t code = 0; code < PK_NKEYCODES; code++) {
+		sel->keychan[code] = hs->keychan[code] < sel->nchannels ? hs->keychan[code] : 0;
+	}
+	if (hs->iskeyboardgrabbed) grabkeyboard(NULL);
+	for (size_t i = 0; i < hs->nlayers && i < MAX_LAYER_DEPTH; i++) {
+		for (size_t j = 0; j < cfg->nlayers; j++) {
+			const char *name = cfg->layers[j].name;
+			if (!name || strcmp(name, hs->layers[i])) continue;
+			sel->layerstack[sel->nlayerstack++] = j + 1;
+			break;
+		}
+	}
+	if (sel->nlayerstack) {
+		sel->dispatch = sel->dispatches[sel->layerstack[sel->nlayerstack-1]];
+		sel->islatched = hs->islatched;
+	}
+	handoverrestore(&sel->engine, hs);
+}
+
+// setupinject creates s's injection ring, named after its display, or adopts
+// the one at fd handed over by the process this one replaced, so producers
+// stay attached.
+static void
+setupinject(Session *s, int fd)
+{
+	shmname(s->injectname, sizeof s->injectname, "/ptrkeys-", s->dpy);
+	if (fd >= 0) {
+		s->engine.inject = injectadopt(fd);
+		if (s->engine.inject) {
+			s->injectfd = fd;
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+			tracef("injection ring: %s, taken over", s->injectname);
+			return;
+		}
+		jotf("take over injection ring %s: %s", s->injectname, strerror(errno));
+		close(fd);
+	}
+	s->engine.inject = injectcreate(s->injectname);
+	if (!s->engine.inject) {
+		jotf("create injection ring %s: %s", s->injectname, strerror(errno));
+		return;
+	}
+	s->injectfd = shm_open(s->injectname, O_RDWR, 0);
+	tracef("injection ring: %s", s->injectname);
+}
+
+// setupstate creates the file s's state is exported to, named after its
+// display, or adopts the one at fd like setupinject, so readers stay attached.
+static void
+setupstate(Session *s, int fd)
+{
+	shmname(s->statename, sizeof s->statename, "/ptrkeys-state-", s->dpy);
+	if (fd >= 0) {
+		s->state = stateadopt(fd);
+		if (s->state) {
+			s->statefd = fd;
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+			tracef("state file: %s, taken over", s->statename);
+			return;
+		}
+		jotf("take over state file %s: %s", s->statename, strerror(errno));
+		close(fd);
+	}
+	s->state = statecreate(s->statename);
+	if (!s->state) {
+		jotf("create state file %s: %s", s->statename, strerror(errno));
+		return;
+	}
+	s->statefd = shm_open(s->statename, O_RDWR, 0);
+	tracef("state file: %s", s->statename);
+}
+
+// shmname writes the shm_open(3) name for prefix and display d to dst.
+static void
+shmname(char *dst, size_t len, const char *prefix, Display *d)
+{
+	snprintf(dst, len, "%s%s", prefix, DisplayString(d));
+	for (char *c = dst + 1; *c; c++) {
+		if (*c == '/') *c = '_';
+	}
+}
+
+// exportstate publishes the selected session's state, if it's changed since
+// it was last published. Readers are only woken for real changes.
+static void
+exportstate()
+{
+	PkState st;
+	memset(&st, 0, sizeof st);
+	st.iskeyboardgrabbed = sel->iskeyboardgrabbed;
+	if (sel->nlayerstack) {
+		const char *name = cfg->layers[sel->layerstack[sel->nlayerstack-1] - 1].name;
+		snprintf(st.layer, sizeof st.layer, "%s", name ? name : "");
+	}
+	st.nchannels = sel->nchannels < STATE_MAX_CHANNELS ? sel->nchannels : STATE_MAX_CHANNELS;
+	for (size_t i = 0; i < st.nchannels; i++) {
+		st.channels[i] = (PkStateChannel){sel->engine.ptr.isscroll[i],
+				sel->engine.ptr.mul[i], sel->engine.scroll.mul[i]};
+	}
+	st.chordwaits = sel->chordwaits;
+	st.chordwaitusec = sel->chordwaitusec;
+	st.chordwaitmax = sel->chordwaitmax;
+	if (!memcmp(&st, &sel->exported, sizeof st)) return;
+	sel->exported = st;
+	statepublish(sel->state, &st);
+}
+
+// startwatchdog starts a thread that releases the keyboard if the event loop
+// stops making progress while it's grabbed, so a hang in ptrkeys or the
+// xserver can't lock the user out. It only reads the heartbeat, so it costs
+// the event loop nothing.
+static void
+startwatchdog()
+{
+	pthread_t t;
+	int err = pthread_create(&t, NULL, watchdog, NULL);
+	if (err) {
+		jotf("watchdog: %s", strerror(err));
+		return;
+	}
+	pthread_detach(t);
+}
+
+static void *
+watchdog(void *arg)
+{
+	(void)arg;
+	long interval = WATCHDOG_MS / 4 ? WATCHDOG_MS / 4 : 1;
+	unsigned long last = 0;
+	long stalled = 0;
+	for (;;) {
+		msleep(interval);
+		unsigned long beat = __atomic_load_n(&heartbeat, __ATOMIC_RELAXED);
+		if (beat != last || __atomic_load_n(&isidle, __ATOMIC_RELAXED)) {
+			last = beat;
+			stalled = 0;
+			continue;
+		}
+		stalled += interval;
+		if (stalled < WATCHDOG_MS) continue;
+		int released = 0;
+		for (size_t i = 0; i < nsessions; i++) {
+			if (!__atomic_load_n(&sessions[i].iskeyboardgrabbed, __ATOMIC_RELAXED)) continue;
+			releasestalled(&sessions[i]);
+			released = 1;
+		}
+		if (released) {
+			jotf("watchdog: event loop stalled for %ldms, exiting to release the keyboard", stalled);
+			// Skip the atexit cleanup, which would use the stalled connections.
+			_exit(1);
+		}
+		stalled = 0;
+	}
+	return NULL;
+}
+
+// releasestalled undoes what grabbing s's keyboard changed, using the
+// watchdog's connection. The grab itself belongs to the stalled connection,
+// so it's released when the process exits.
+static void
+releasestalled(Session *s)
+{
+	Display *d = s->watchdpy;
+	if (!d) return;
+	XkbSetServerInternalMods(d, XkbUseCoreKbd, cfg->internalmods, 0, 0, 0);
+	XKeyboardControl ctrl = {.auto_repeat_mode=AutoRepeatModeDefault};
+	XChangeKeyboardControl(d, KBAutoRepeatMode, &ctrl);
+	// The event loop is stuck, so the NOREPEAT keys won't change under us.
+	for (size_t i = 0; i < s->nnorepeats; i++) {
+		XKeyboardControl key = {.auto_repeat_mode=AutoRepeatModeOn, .key=s->norepeats[i].code};
+		XChangeKeyboardControl(d, KBKey|KBAutoRepeatMode, &key);
+	}
+	// Not XSync: if the xserver is what stalled, the reply would never come.
+	XFlush(d);
+}
+
+static void
+onwake(int sig)
+{
+	(void)sig;
+	int saved = errno;
+	ssize_t n = write(wakepipe[1], "", 1);
+	(void)n;
+	errno = saved;
+}
+
+static void
+onrestart(int sig)
+{
+	(void)sig;
+	isrestarting = 1;
+}
+
+// selectsession makes s the session that commands and Xlib calls act on.
+static void
+selectsession(Session *s)
+{
+	sel = s;
+	dpy = s->dpy;
+	root = s->root;
+}
+
+// updatesession scrolls and moves the selected session's pointers by the
+// movement since it was last updated, along with any injected input up to now,
+// and returns nonzero if any of them are still moving. Unless spread is set,
+// the frame's scroll events are all sent now.
+static int
+updatesession(long long now, int spread)
+{
+	long long elapsed = now - sel->stepped;
+	int usec = elapsed < INT_MAX ? elapsed : INT_MAX;
+	sel->stepped = now;
+	long long lag = sel->isprobing ? now - sel->probesent : sel->lag;
+	int max = lag > SCROLL_MAX_LAG_MS * 1000LL ? 0 : SCROLL_MAX_PER_FRAME;
+	PkFrame f;
+	long stalls = sel->engine.stalls;
+	int busy = enginestep(&sel->engine, usec, now, max, &f);
+	if (sel->engine.stalls != stalls) {
+		tracef("stall: %dus step, %ld stalls totalling %lldus over the limit",
+				usec, sel->engine.stalls, sel->engine.stalledusec);
+	}
+	if (f.dropped) tracef("scroll: dropped %ld events, lag=%lldus", f.dropped, lag);
+	int framems = 1000 / cfg->fps;
+	int spreadms = spread && sel->delaydpy ? framems : 0;
+	request_scrolling(dpy, &f, spreadms, 0, 0);
+	if (f.isscrolling && !sel->isprobing && now - sel->probesent >= SCROLL_PROBE_MS * 1000LL) {
+		XChangeProperty(dpy, sel->probewin, sel->probeatom, XA_INTEGER, 32,
+				PropModeReplace, NULL, 0);
+		sel->isprobing = 1;
+		sel->probesent = now;
+	}
+	for (size_t i = 0; i < sel->nchannels; i++) warpby(i, f.ptr[i].dx, f.ptr[i].dy);
+	for (size_t i = 0; i < f.nbuttons; i++) {
+		fakebutton(f.buttons[i].channel, f.buttons[i].button, f.buttons[i].press, 0);
+	}
+	if (sel->plan) busy |= replay(now, framems);
+	XFlush(dpy);
+	// Spread the rest of the scroll events over the frame, with the xserver
+	// doing the timing on delaydpy so clicks and warps aren't held up.
+	int last = 0;
+	for (int ms = 1; ms < spreadms; ms++) {
+		if (request_scrolling(sel->delaydpy, &f, spreadms, ms, ms - last)) last = ms;
+	}
+	if (sel->delaydpy) XFlush(sel->delaydpy);
+	return busy;
+}
+
+static void
+handle_pending_events()
+{
+	// MappingNotify can't be selected with an event mask, so drain the queue
+	// in order instead of using XCheckMaskEvent.
+	while (XPending(dpy)) {
+		XEvent ev;
+		XNextEvent(dpy, &ev);
+		switch (ev.type) {
+		case KeyPress:
+			keypress(&ev); break;
+		case KeyRelease:
+			keyrelease(&ev); break;
+		case MappingNotify:
+			refreshmapping(&ev.xmapping); break;
+		case ConfigureNotify: {
+			XConfigureEvent *c = &ev.xconfigure;
+			pk_markwindowmoved(sel->marks, LEN(sel->marks), c->window, c->x, c->y);
+			TopLevel *t = findtoplevel(c->window);
+			if (t) t->r = (PkRegion){c->x, c->y, c->width + 2*c->border_width, c->height + 2*c->border_width};
+			break;
+		}
+		case CreateNotify: {
+			XCreateWindowEvent *c = &ev.xcreatewindow;
+			if (!sel->istopsindexed || c->parent != root) break;
+			addtoplevel(c->window, (PkRegion){c->x, c->y, c->width + 2*c->border_width,
+					c->height + 2*c->border_width}, 0);
+			break;
+		}
+		case MapNotify: {
+			TopLevel *t = findtoplevel(ev.xmap.window);
+			if (t) t->ismapped = 1;
+			break;
+		}
+		case UnmapNotify: {
+			TopLevel *t = findtoplevel(ev.xunmap.window);
+			if (t) t->ismapped = 0;
+			break;
+		}
+		case PropertyNotify:
+			if (ev.xproperty.window == root && ev.xproperty.atom == sel->netactivewindow) {
+				focuschanged();
+				break;
+			}
+			if (ev.xproperty.window != sel->probewin) break;
+			sel->lag = nowusec() - sel->probesent;
+			sel->isprobing = 0;
+			break;
+		case DestroyNotify:
+			pk_markwindowgone(sel->marks, LEN(sel->marks), ev.xdestroywindow.window);
+			forgetwindow(ev.xdestroywindow.window);
+			removetoplevel(ev.xdestroywindow.window);
+			break;
+		case ReparentNotify:
+			if (ev.xreparent.parent == root) {
+				// Rare enough to ask for the geometry.
+				if (sel->istopsindexed) querytoplevel(ev.xreparent.window);
+				break;
+			}
+			pk_markwindowgone(sel->marks, LEN(sel->marks), ev.xreparent.window);
+			removetoplevel(ev.xreparent.window);
+			break;
+#ifdef XI2
+		case GenericEvent:
+			xievent(&ev.xcookie); break;
+#endif
+		}
+	}
+}
+
+// focuschanged switches the selected session to the profile of the window
+// the window manager says is focused. Window properties are only fetched here,
+// and only for windows that aren't cached.
+static void
+focuschanged()
+{
+	Window win = activewindow();
+	if (win == sel->active) return;
+	sel->active = win;
+	int app = win ? appofwindow(win) : -1;
+	if (app == sel->app) return;
+	sel->app = app;
+	tracef("focus: window 0x%lx, profile %s", win, app >= 0 ? appprofiles[app].class : "none");
+	applyapp();
+}
+
+static Window
+activewindow()
+{
+	Atom type;
+	int format;
+	unsigned long n, after;
+	unsigned char *data = NULL;
+	Window win = None;
+	if (XGetWindowProperty(dpy, root, sel->netactivewindow, 0, 1, False, XA_WINDOW,
+			&type, &format, &n, &after, &data) == Success && data) {
+		if (type == XA_WINDOW && format == 32 && n == 1) win = *(Window *)data;
+		XFree(data);
+	}
+	return win;
+}
+
+// appofwindow returns the index of win's profile in appprofiles, or -1. win
+// may already be gone, so X errors are ignored, and it's only cached while
+// it's known to exist.
+static int
+appofwindow(Window win)
+{
+	for (size_t i = 0; i < LEN(sel->classes); i++) {
+		if (sel->classes[i].win == win) return sel->classes[i].app;
+	}
+	XErrorHandler defaulthandler = XSetErrorHandler(saveerror);
+	nsavederrors = 0;
+	int app = -1;
+	Atom type;
+	int format;
+	unsigned long n, after;
+	unsigned char *data = NULL;
+	// WM_CLASS is the instance and class names, each null-terminated.
+	if (XGetWindowProperty(dpy, win, XA_WM_CLASS, 0, 64, False, XA_STRING,
+			&type, &format, &n, &after, &data) == Success && data) {
+		if (type == XA_STRING && format == 8 && n && !data[n-1]) {
+			const char *instance = (char *)data;
+			size_t len = strlen(instance);
+			const char *class = len + 1 < n ? instance + len + 1 : NULL;
+			app = findappprofile(appprofiles, LEN(appprofiles), instance, class);
+		}
+		XFree(data);
+	}
+	// Hear about win being destroyed, so its id isn't mistaken for a new
+	// window's.
+	XSelectInput(dpy, win, StructureNotifyMask);
+	XSync(dpy, False);
+	XSetErrorHandler(defaulthandler);
+	if (nsavederrors) return -1;
+	sel->classes[sel->nextclass] = (ClassEntry){win, app};
+	sel->nextclass = (sel->nextclass + 1) % LEN(sel->classes);
+	return app;
+}
+
+static void
+forgetwindow(Window win)
+{
+	for (size_t i = 0; i < LEN(sel->classes); i++) {
+		if (sel->classes[i].win == win) sel->classes[i].win = None;
+	}
+	if (sel->active == win) sel->active = None;
+}
+
+// findappprofile returns the index of the first of apps whose class is class
+// or instance, or -1 if there's none.
+int
+findappprofile(const AppProfile *apps, size_t n, const char *instance, const char *class)
+{
+	for (size_t i = 0; i < n; i++) {
+		if (instance && !strcmp(apps[i].class, instance)) return i;
+		if (class && !strcmp(apps[i].class, class)) return i;
+	}
+	return -1;
+}
+
+// applyapp sets the selected session's speeds for the focused application.
+static void
+applyapp()
+{
+	double speed = cfg->basespeed, scroll = cfg->basescroll, mul = 1;
+	if (sel->app >= 0) {
+		const AppProfile *a = &appprofiles[sel->app];
+		if (a->basespeed) speed = a->basespeed;
+		if (a->basescroll) scroll = a->basescroll;
+		if (a->mul) mul = a->mul;
+	}
+	enginesetspeeds(&sel->engine, speed, scroll, mul);
+}
+
+// snaptarget writes the nearest window edge or center from x, y in each axis
+// of dir to tx, ty, considering the mapped windows that the pointer would
+// cross moving along that axis. Returns nonzero if there's a target.
+int
+snaptarget(const TopLevel *tops, size_t n, int x, int y, unsigned int dir, int *tx, int *ty)
+{
+	int xsign = (dir & RIGHT) ? 1 : (dir & LEFT) ? -1 : 0;
+	int ysign = (dir & DOWN) ? 1 : (dir & UP) ? -1 : 0;
+	int xbest = INT_MAX, ybest = INT_MAX;
+	*tx = x;
+	*ty = y;
+	for (size_t i = 0; i < n; i++) {
+		if (!tops[i].ismapped) continue;
+		PkRegion r = tops[i].r;
+		if (xsign && y >= r.y && y < r.y + r.h) {
+			int xs[] = {r.x, r.x + r.w/2, r.x + r.w - 1};
+			for (size_t j = 0; j < LEN(xs); j++) {
+				int d = (xs[j] - x) * xsign;
+				if (d <= 0 || d >= xbest) continue;
+				xbest = d;
+				*tx = xs[j];
+			}
+		}
+		if (ysign && x >= r.x && x < r.x + r.w) {
+			int ys[] = {r.y, r.y + r.h/2, r.y + r.h - 1};
+			for (size_t j = 0; j < LEN(ys); j++) {
+				int d = (ys[j] - y) * ysign;
+				if (d <= 0 || d >= ybest) continue;
+				ybest = d;
+				*ty = ys[j];
+			}
+		}
+	}
+	return xbest != INT_MAX || ybest != INT_MAX;
+}
+
+// indextoplevels builds the selected session's table of top-level windows,
+// which SubstructureNotify events keep current from then on, so snapping
+// doesn't need any round trips.
+static void
+indextoplevels()
+{
+	if (!sel->istrackingwindows) {
+		XSelectInput(dpy, root, ROOTMASK|SubstructureNotifyMask);
+		sel->istrackingwindows = 1;
+	}
+	sel->istopsindexed = 1;
+	Window rootret, parent, *children;
+	unsigned int n;
+	if (!XQueryTree(dpy, root, &rootret, &parent, &children, &n)) return;
+	for (unsigned int i = 0; i < n; i++) querytoplevel(children[i]);
+	if (children) XFree(children);
+	tracef("snap: indexed %zu windows", sel->ntops);
+}
+
+// querytoplevel adds win to the table with its current geometry, unless it's
+// already gone.
+static void
+querytoplevel(Window win)
+{
+	XWindowAttributes wa;
+	XErrorHandler defaulthandler = XSetErrorHandler(saveerror);
+	nsavederrors = 0;
+	int ok = XGetWindowAttributes(dpy, win, &wa);
+	XSetErrorHandler(defaulthandler);
+	if (!ok || nsavederrors) return;
+	PkRegion r = {wa.x, wa.y, wa.width + 2*wa.border_width, wa.height + 2*wa.border_width};
+	addtoplevel(win, r, wa.map_state != IsUnmapped);
+}
+
+static TopLevel *
+findtoplevel(Window win)
+{
+	for (size_t i = 0; i < sel->ntops; i++) {
+		if (sel->tops[i].win == win) return &sel->tops[i];
+	}
+	return NULL;
+}
+
+static void
+addtoplevel(Window win, PkRegion r, int ismapped)
+{
+	TopLevel *t = findtoplevel(win);
+	if (!t) {
+		if (sel->ntops == sel->topscap) {
+			sel->topscap = sel->topscap ? 2 * sel->topscap : 64;
+			sel->tops = realloc(sel->tops, sel->topscap * sizeof *sel->tops);
+			if (!sel->tops) die("add top-level window: out of memory");
+		}
+		t = &sel->tops[sel->ntops++];
+	}
+	*t = (TopLevel){win, r, ismapped};
+}
+
+static void
+removetoplevel(Window win)
+{
+	TopLevel *t = findtoplevel(win);
+	if (t) *t = sel->tops[--sel->ntops];
+}
+
+// capture gets the square of the screen within EDGE_REACH of x, y, moved to
+// fit on the screen, and sets ox, oy to its origin. It uses MIT-SHM if it can,
+// so the pixels aren't copied through the socket. Returns NULL on failure.
+static XImage *
+capture(int x, int y, int *ox, int *oy)
+{
+	int scr = DefaultScreen(dpy);
+	int sw = DisplayWidth(dpy, scr), sh = DisplayHeight(dpy, scr);
+	int w = 2*EDGE_REACH < sw ? 2*EDGE_REACH : sw;
+	int h = 2*EDGE_REACH < sh ? 2*EDGE_REACH : sh;
+	*ox = x - EDGE_REACH;
+	*oy = y - EDGE_REACH;
+	if (*ox > sw - w) *ox = sw - w;
+	if (*oy > sh - h) *oy = sh - h;
+	if (*ox < 0) *ox = 0;
+	if (*oy < 0) *oy = 0;
+	XErrorHandler defaulthandler = XSetErrorHandler(saveerror);
+	nsavederrors = 0;
+	XImage *img = NULL;
+#ifdef MITSHM
+	if (w == 2*EDGE_REACH && h == 2*EDGE_REACH && setupshm()) {
+		if (XShmGetImage(dpy, root, sel->shmimage, *ox, *oy, AllPlanes)) img = sel->shmimage;
+	}
+#endif
+	if (!img) img = XGetImage(dpy, root, *ox, *oy, w, h, AllPlanes, ZPixmap);
+	XSetErrorHandler(defaulthandler);
+	if (nsavederrors) {
+		jotf("capture: error %d", savederrors[0].error_code);
+		releasecapture(img);
+		return NULL;
+	}
+	return img;
+}
+
+static void
+releasecapture(XImage *img)
+{
+#ifdef MITSHM
+	if (img == sel->shmimage) return;
+#endif
+	if (img) img->f.destroy_image(img);
+}
+
+#ifdef MITSHM
+// setupshm creates the shared image capture uses, the first time it's called.
+// Returns zero if MIT-SHM isn't available, such as on a remote display.
+static int
+setupshm()
+{
+	if (sel->isshmtried) return sel->shmimage != NULL;
+	sel->isshmtried = 1;
+	if (!XShmQueryExtension(dpy)) return 0;
+	int scr = DefaultScreen(dpy);
+	XShmSegmentInfo *si = &sel->shminfo;
+	XImage *img = XShmCreateImage(dpy, DefaultVisual(dpy, scr), DefaultDepth(dpy, scr),
+			ZPixmap, NULL, si, 2*EDGE_REACH, 2*EDGE_REACH);
+	if (!img) return 0;
+	si->shmid = shmget(IPC_PRIVATE, img->bytes_per_line * img->height, IPC_CREAT|0600);
+	if (si->shmid < 0) {
+		img->f.destroy_image(img);
+		return 0;
+	}
+	si->shmaddr = shmat(si->shmid, NULL, 0);
+	si->readOnly = False;
+	int ok = si->shmaddr != (char *)-1;
+	if (ok) {
+		XErrorHandler defaulthandler = XSetErrorHandler(saveerror);
+		nsavederrors = 0;
+		XShmAttach(dpy, si);
+		XSync(dpy, False);
+		XSetErrorHandler(defaulthandler);
+		ok = !nsavederrors;
+	}
+	// Once both sides are attached, the segment can be marked for removal so
+	// it goes away with ptrkeys.
+	shmctl(si->shmid, IPC_RMID, NULL);
+	if (!ok) {
+		if (si->shmaddr != (char *)-1) shmdt(si->shmaddr);
+		img->f.destroy_image(img);
+		trace("capture: MIT-SHM unavailable");
+		return 0;
+	}
+	img->data = si->shmaddr;
+	sel->shmimage = img;
+	return 1;
+}
+#endif
+
+// edgedistance returns how far the nearest edge in img is from x, y in the
+// direction sx, sy, or 0 if there's none in the image. The scan covers a band
+// EDGE_BAND pixels wide, which an edge must cross entirely.
+static int
+edgedistance(XImage *img, int x, int y, int sx, int sy)
+{
+	static uint32_t strip[EDGE_BAND][2*EDGE_REACH];
+	int len = sx > 0 ? img->width - x : sx < 0 ? x + 1 : sy > 0 ? img->height - y : y + 1;
+	if (len > 2*EDGE_REACH) len = 2*EDGE_REACH;
+	for (int r = 0; r < EDGE_BAND; r++) {
+		int off = r - EDGE_BAND/2;
+		for (int i = 0; i < len; i++) {
+			int px = x + i*sx + (sy ? off : 0);
+			int py = y + i*sy + (sx ? off : 0);
+			if (px < 0) px = 0;
+			if (py < 0) py = 0;
+			if (px >= img->width) px = img->width - 1;
+			if (py >= img->height) py = img->height - 1;
+			strip[r][i] = pixelat(img, px, py);
+		}
+	}
+	int d = edgescan(&strip[0][0], LEN(strip[0]), EDGE_BAND, len, EDGE_THRESHOLD, 1);
+	return d < 0 ? 0 : d;
+}
+
+static uint32_t
+pixelat(XImage *img, int x, int y)
+{
+	if (img->bits_per_pixel == 32) {
+		return ((uint32_t *)(img->data + y*img->bytes_per_line))[x];
+	}
+	return img->f.get_pixel(img, x, y);
+}
+
+// request_scrolling sends the scroll events of f that are due ms into the
+// frame on d, the first delay ms after the previous request. Returns the
+// number sent.
+static int
+request_scrolling(Display *d, const PkFrame *f, int framems, int ms, unsigned long delay)
+{
+	int sent = 0;
+	for (size_t ch = 0; ch < sel->nchannels; ch++) {
+		PkScrollUpdate su = f->scroll[ch];
+		int n = notchesdue(su.xevents, framems, ms);
+		for (int i = 0; i < n; i++, sent++) {
+			fakebuttonon(d, ch, su.xbutton, PRESS, sent ? 0 : delay);
+			fakebuttonon(d, ch, su.xbutton, RELEASE, 0);
+		}
+		n = notchesdue(su.yevents, framems, ms);
+		for (int i = 0; i < n; i++, sent++) {
+			fakebuttonon(d, ch, su.ybutton, PRESS, sent ? 0 : delay);
+			fakebuttonon(d, ch, su.ybutton, RELEASE, 0);
+		}
+	}
+	return sent;
+}
+
+// notchesdue returns how many of an axis's events are due ms into a frame
+// framems long, when they're spread evenly over it starting at 0.
+int
+notchesdue(int events, int framems, int ms)
+{
+	if (framems <= 0) return ms ? 0 : events;
+	return notchesbefore(events, framems, ms + 1) - notchesbefore(events, framems, ms);
+}
+
+// notchesbefore returns how many of events are due before ms. Event k is due
+// at k*framems/events, rounded down.
+static int
+notchesbefore(int events, int framems, int ms)
+{
+	long long n = ((long long)ms * events + framems - 1) / framems;
+	return n < events ? n : events;
+}
+
+// setupchannels finds the master pointers to drive. The client pointer at
+// startup is channel 0.
+static void
+setupchannels()
+{
+	sel->nchannels = 1;
+	sel->channels[0] = (Channel){0};
+#ifdef XI2
+	closechannels();
+	int event, error, major = 2, minor = 2;
+	if (!XQueryExtension(dpy, "XInputExtension", &sel->xiopcode, &event, &error)
+	|| XIQueryVersion(dpy, &major, &minor) != Success) {
+		sel->xiopcode = -1;
+		resetmovement(NULL);
+		return;
+	}
+	int client = 0;
+	XIGetClientPointer(dpy, None, &client);
+	int ndev;
+	XIDeviceInfo *dev = XIQueryDevice(dpy, XIAllDevices, &ndev);
+	sel->nchannels = 0;
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < ndev; i++) {
+			if (dev[i].use != XIMasterPointer) continue;
+			if ((dev[i].deviceid == client) != (pass == 0)) continue;
+			if (sel->nchannels == PK_MAX_CHANNELS) {
+				jotf("setup channels: ignoring master pointer %s", dev[i].name);
+				continue;
+			}
+			Channel *c = &sel->channels[sel->nchannels++];
+			*c = (Channel){dev[i].deviceid, dev[i].attachment, NULL};
+			for (int j = 0; j < ndev; j++) {
+				if (dev[j].use != XISlavePointer || dev[j].attachment != c->ptr) continue;
+				const char *suffix = " XTEST pointer";
+				size_t len = strlen(dev[j].name), slen = strlen(suffix);
+				if (len < slen || strcmp(dev[j].name + len - slen, suffix)) continue;
+				c->xtest = XOpenDevice(dpy, dev[j].deviceid);
+				break;
+			}
+			if (!c->xtest) jotf("setup channels: no XTEST device for %s", dev[i].name);
+		}
+	}
+	XIFreeDeviceInfo(dev);
+	if (!sel->nchannels) {
+		sel->nchannels = 1;
+		sel->channels[0] = (Channel){0};
+	}
+	tracef("setup channels: %zu master pointers", sel->nchannels);
+
+	// Raw key events say which keyboard a key was pressed on, and are
+	// delivered before the core event, even while a key is grabbed.
+	unsigned char rawmask[XIMaskLen(XI_LASTEVENT)] = {0};
+	unsigned char hiermask[XIMaskLen(XI_LASTEVENT)] = {0};
+	XISetMask(rawmask, XI_RawKeyPress);
+	XISetMask(hiermask, XI_HierarchyChanged);
+	XIEventMask masks[] = {
+		{XIAllMasterDevices, sizeof rawmask, rawmask},
+		{XIAllDevices, sizeof hiermask, hiermask},
+	};
+	XISelectEvents(dpy, root, masks, LEN(masks));
+#endif
+	resetmovement(NULL);
+}
+
+#ifdef XI2
+static void
+closechannels()
+{
+	for (size_t i = 0; i < sel->nchannels; i++) {
+		if (sel->channels[i].xtest) XCloseDevice(dpy, sel->channels[i].xtest);
+		sel->channels[i].xtest = NULL;
+	}
+}
+
+static void
+xievent(XGenericEventCookie *cookie)
+{
+	if (cookie->extension != sel->xiopcode || !XGetEventData(dpy, cookie)) return;
+	switch (cookie->evtype) {
+	case XI_RawKeyPress: {
+		XIRawEvent *ev = cookie->data;
+		for (size_t i = 0; i < sel->nchannels; i++) {
+			if (sel->channels[i].kbd == ev->deviceid) sel->selchan = i;
+		}
+		break;
+	}
+	case XI_HierarchyChanged:
+		// Master pointers were added or removed, so channel numbers may
+		// have changed.
+		sel->selchan = 0;
+		setupchannels();
+		break;
+	}
+	XFreeEventData(dpy, cookie);
+}
+#endif
+
+// warpby moves channel ch's pointer relative to its current position.
+static void
+warpby(size_t ch, int dx, int dy)
+{
+	if (!dx && !dy) return;
+	if (sel->isrecording) record((PkMacroStep){.op=PK_MACRO_MOVE, .channel=ch, .dx=dx, .dy=dy});
+#ifdef XI2
+	if (sel->channels[ch].ptr) {
+		XIWarpPointer(dpy, sel->channels[ch].ptr, None, None, 0, 0, 0, 0, dx, dy);
+		return;
+	}
+#else
+	(void)ch;
+#endif
+	XWarpPointer(dpy, None, None, 0, 0, 0, 0, dx, dy);
+}
+
+static void
+warpto(size_t ch, int x, int y)
+{
+	if (sel->isrecording) record((PkMacroStep){.op=PK_MACRO_WARP, .channel=ch, .x=x, .y=y});
+#ifdef XI2
+	if (sel->channels[ch].ptr) {
+		XIWarpPointer(dpy, sel->channels[ch].ptr, None, root, 0, 0, 0, 0, x, y);
+		return;
+	}
+#else
+	(void)ch;
+#endif
+	XWarpPointer(dpy, None, root, 0, 0, 0, 0, x, y);
+}
+
+static void
+fakebutton(size_t ch, unsigned int button, Bool press, unsigned long delay)
+{
+	fakebuttonon(dpy, ch, button, press, delay);
+}
+
+// fakebuttonon sends a button event for channel ch on d, which may be a
+// different connection to the selected session's display.
+static void
+fakebuttonon(Display *d, size_t ch, unsigned int button, Bool press, unsigned long delay)
+{
+	if (sel->isrecording) {
+		record((PkMacroStep){.op=PK_MACRO_BUTTON, .channel=ch, .button=button, .press=press});
+	}
+#ifdef XI2
+	if (sel->channels[ch].xtest) {
+		XTestFakeDeviceButtonEvent(d, sel->channels[ch].xtest, button, press, NULL, 0, delay);
+		return;
+	}
+#else
+	(void)ch;
+#endif
+	XTestFakeButtonEvent(d, button, press, delay);
+}
+
+// gridkeypress narrows gridregion to the cell for keysym and returns nonzero
+// if keysym is in gridkeys[]. Targeting ends once a cell is a single pixel.
+static int
+gridkeypress(KeySym keysym)
+{
+	for (size_t i = 0; i < LEN(gridkeys); i++) {
+		if (keysym != gridkeys[i]) continue;
+		sel->gridregion = pk_gridcell(sel->gridregion, GRID_COLS, LEN(gridkeys) / GRID_COLS, i);
+		warptocenter(sel->gridregion);
+		if (sel->gridregion.w <= 1 && sel->gridregion.h <= 1) sel->isgridding = 0;
+		return 1;
+	}
+	return 0;
+}
+
+static void
+warptocenter(PkRegion r)
+{
+	warpto(sel->selchan, r.x + r.w/2, r.y + r.h/2);
+}
+
+// pointermonitor returns the geometry of the monitor containing the pointer,
+// or of the whole screen without Xinerama.
+static PkRegion
+pointermonitor()
+{
+	int scr = DefaultScreen(dpy);
+	PkRegion r = {0, 0, DisplayWidth(dpy, scr), DisplayHeight(dpy, scr)};
+#ifdef XINERAMA
+	if (!XineramaIsActive(dpy)) return r;
+	int x, y;
+	pointerposition(sel->selchan, &x, &y);
+	int n;
+	XineramaScreenInfo *info = XineramaQueryScreens(dpy, &n);
+	for (int i = 0; i < n; i++) {
+		if (x < info[i].x_org || x >= info[i].x_org + info[i].width) continue;
+		if (y < info[i].y_org || y >= info[i].y_org + info[i].height) continue;
+		r = (PkRegion){info[i].x_org, info[i].y_org, info[i].width, info[i].height};
+		break;
+	}
+	XFree(info);
+#endif
+	return r;
+}
+
+static void
+pointerposition(size_t ch, int *x, int *y)
+{
+#ifdef XI2
+	if (sel->channels[ch].ptr) {
+		Window dummywin;
+		double rx, ry, dummy;
+		XIButtonState buttons;
+		XIModifierState mods;
+		XIGroupState group;
+		XIQueryPointer(dpy, sel->channels[ch].ptr, root, &dummywin, &dummywin,
+				&rx, &ry, &dummy, &dummy, &buttons, &mods, &group);
+		XFree(buttons.mask);
+		*x = (int)rx;
+		*y = (int)ry;
+		return;
+	}
+#else
+	(void)ch;
+#endif
+	Window dummywin;
+	int dummy;
+	unsigned int mask;
+	XQueryPointer(dpy, root, &dummywin, &dummywin, x, y, &dummy, &dummy, &mask);
+}
+
+// toplevel returns the child of the root window that contains w, which is
+// usually the window manager's frame, or None if w is the root.
+static Window
+toplevel(Window w)
+{
+	for (;;) {
+		Window rootret, parent, *children;
+		unsigned int n;
+		if (!XQueryTree(dpy, w, &rootret, &parent, &children, &n)) return None;
+		if (children) XFree(children);
+		if (parent == root) return w;
+		if (parent == None) return None;
+		w = parent;
+	}
 }
 
-static void
-handle_pending_events()
+static PkMark *
+markslot(const Arg *slot, const char *caller)
 {
-	for (XEvent ev; XCheckMaskEvent(dpy, ~NoEventMask, &ev);) {
-		switch (ev.type) {
-		case KeyPress:
-			keypress(&ev); break;
-		case KeyRelease:
-			keyrelease(&ev); break;
-		case MappingNotify:
-			updatenumlockmask(); break;
-		}
+	if (!slot) dief("%s: NULL arg", caller);
+	if (slot->i < 0 || slot->i >= NMARKS) {
+		dief("%s: slot %d out of range [0, %d)", caller, slot->i, NMARKS);
 	}
+	return &sel->marks[slot->i];
 }
 
+// updatekeysyms caches the unshifted keysym of each keycode, which is what
+// bindings are matched against.
 static void
-request_scrolling(ScrollUpdate su)
+updatekeysyms()
 {
-	for (int i = 0; i < su.xevents; i++) {
-		XTestFakeButtonEvent(dpy, su.xbutton, PRESS, CurrentTime);
-		XTestFakeButtonEvent(dpy, su.xbutton, RELEASE, CurrentTime);
+	int min, max;
+	XDisplayKeycodes(dpy, &min, &max);
+	for (int code = 0; code < PK_NKEYCODES; code++) {
+		sel->keysyms[code] = NoSymbol;
+		if (code < min || code > max) continue;
+		sel->keysyms[code] = XkbKeycodeToKeysym(dpy, code, 0, 0);
 	}
-	for (int i = 0; i < su.yevents; i++) {
-		XTestFakeButtonEvent(dpy, su.ybutton, PRESS, CurrentTime);
-		XTestFakeButtonEvent(dpy, su.ybutton, RELEASE, CurrentTime);
+}
+
+// builddispatches compiles cfg's base bindings and layers into dispatch
+// tables.
+static void
+builddispatches()
+{
+	free(sel->dispatches);
+	sel->dispatches = calloc(cfg->nlayers + 1, sizeof *sel->dispatches);
+	if (!sel->dispatches) die("builddispatches: out of memory");
+	for (size_t i = 0; i < cfg->nlayers; i++) {
+		Layer *layer = &cfg->layers[i];
+		pk_builddispatch(sel->dispatches[i+1], sel->keysyms, layer->keys, layer->nkeys);
+		pk_builddispatch(sel->dispatches[i+1], sel->keysyms, cfg->keys, cfg->nkeys);
 	}
+	pk_builddispatch(sel->dispatches[0], sel->keysyms, cfg->keys, cfg->nkeys);
+	sel->dispatch = sel->dispatches[sel->nlayerstack ? sel->layerstack[sel->nlayerstack-1] : 0];
+}
+
+static void
+resetlayers()
+{
+	sel->nlayerstack = 0;
+	sel->islatched = 0;
+	sel->dispatch = sel->dispatches[0];
 }
 
 static void
 keypress(XEvent *e)
 {
 	XKeyEvent *ev = &e->xkey;
-	KeySym keysym = XkbKeycodeToKeysym(dpy, ev->keycode, 0, 0);
+	KeySym keysym = sel->keysyms[ev->keycode];
+	sel->keychan[ev->keycode] = sel->selchan;
+	sel->keyx = ev->x_root;
+	sel->keyy = ev->y_root;
 
 	if (jottrace) {
 		char keystr[MAX_KEYSYM_DESC_LEN] = {0};
@@ -384,88 +2082,272 @@ keypress(XEvent *e)
 		tracef("press %s", keystr);
 	}
 
-	for (size_t i = 0; i < LEN(keys); i++) {
-		if (keysym != keys[i].keysym) continue;
-		if (iskeyboardgrabbed && keys[i].mod) continue;
-		if (!iskeyboardgrabbed && NOLOCKMASK(keys[i].mod) != NOLOCKMASK(ev->state)) {
-			continue;
+	if (sel->isgridding) {
+		if (gridkeypress(keysym)) {
+			sel->swallowed[ev->keycode/8] |= 1 << ev->keycode%8;
+			return;
 		}
+		// Any other key ends targeting and acts as usual, eg for fine-tuning.
+		sel->isgridding = 0;
+	}
+
+	if (sel->iskeyboardgrabbed) {
+		if (chordpress(ev->keycode, keysym, nowusec())) return;
+		dispatchpress(ev->keycode);
+		return;
+	}
+
+	// Only global hotkeys are seen while the keyboard isn't grabbed, so
+	// there are few enough to search.
+	Key *keys = cfg->keys;
+	for (size_t i = 0; i < cfg->nkeys; i++) {
+		if (keysym != keys[i].keysym) continue;
+		if (NOLOCKMASK(keys[i].mod) != NOLOCKMASK(ev->state)) continue;
 		if (!keys[i].pressfunc) continue;
+		sel->pressed[ev->keycode] = &keys[i];
 		keys[i].pressfunc(&(keys[i].pressarg));
 		return;
 	}
 	// Key is unmapped. Ignore it.
 }
 
+// keyrelease runs the release function of the binding the key was pressed
+// with, even if the layer has changed since. Keys that were already down when
+// the keyboard was grabbed use the current layer's binding.
 static void
 keyrelease(XEvent *e)
 {
 	XKeyEvent *ev = &e->xkey;
-	KeySym keysym = XkbKeycodeToKeysym(dpy, ev->keycode, 0, 0);
 
 	if (jottrace) {
 		char keystr[MAX_KEYSYM_DESC_LEN] = {0};
-		sprintkeysym(keystr, LEN(keystr), keysym, ev->state);
+		sprintkeysym(keystr, LEN(keystr), sel->keysyms[ev->keycode], ev->state);
 		tracef("release %s", keystr);
 	}
 
-	for (size_t i = 0; i < LEN(keys); i++) {
-		if (keysym != keys[i].keysym) continue;
-		if (keys[i].mod) continue;
-		if (!keys[i].releasefunc) continue;
-		keys[i].releasefunc(&(keys[i].releasearg));
+	if (sel->swallowed[ev->keycode/8] & 1 << ev->keycode%8) {
+		sel->swallowed[ev->keycode/8] &= ~(1 << ev->keycode%8);
 		return;
 	}
-	// Key is unmapped. Ignore it.
+
+	if (chordrelease(ev->keycode)) return;
+
+	const Key *key = sel->pressed[ev->keycode];
+	sel->pressed[ev->keycode] = NULL;
+	if (!key) key = sel->dispatch[ev->keycode];
+	if (!key || key->mod || !key->releasefunc) return;
+	// Release on the channel the key was pressed on, even if another
+	// keyboard has been used since.
+	sel->selchan = sel->keychan[ev->keycode];
+	key->releasefunc(&key->releasearg);
+}
+
+static void
+dispatchpress(KeyCode code)
+{
+	const Key *key = sel->dispatch[code];
+	int waslatched = sel->islatched;
+	sel->pressed[code] = key;
+	if (key && key->pressfunc) key->pressfunc(&key->pressarg);
+	if (waslatched) poplayer(NULL);
+}
+
+// chordpress returns nonzero if it handles a key press as part of a chord. A
+// press that could start a chord is held back until the other key is pressed
+// or CHORD_MS passes. Presses that can't start one are left to dispatch right
+// away.
+static int
+chordpress(KeyCode code, KeySym keysym, long long now)
+{
+	if (CHORD_MS <= 0) return 0;
+	if (sel->chordcode) {
+		const Chord *c = pk_findchord(chords, LEN(chords), sel->keysyms[sel->chordcode], keysym);
+		if (c && code != sel->chordcode) {
+			tracef("chord: after %lldus", now - sel->chordpressed);
+			sel->chorded = c;
+			sel->chordcodes[0] = sel->chordcode;
+			sel->chordcodes[1] = code;
+			sel->chordcode = 0;
+			if (c->pressfunc) c->pressfunc(&c->pressarg);
+			return 1;
+		}
+		int isrepeat = code == sel->chordcode;
+		flushchord(now);
+		// The autorepeat stands for the press it just dispatched.
+		if (isrepeat) return 1;
+	}
+	// Don't hold back autorepeats of a key that's already been dispatched.
+	if (sel->pressed[code] || !pk_findchord(chords, LEN(chords), keysym, 0)) return 0;
+	sel->chordcode = code;
+	sel->chordpressed = now;
+	sel->chorddue = now + CHORD_MS * 1000LL;
+	return 1;
+}
+
+// chordrelease returns nonzero if it handles a key release as part of a
+// chord. Releasing either key of a chord releases the chord, and the other
+// key's release is ignored. Releasing a held-back key dispatches its press
+// first.
+static int
+chordrelease(KeyCode code)
+{
+	if (sel->chordcode == code) flushchord(nowusec());
+	const Chord *c = sel->chorded;
+	if (!c || (code != sel->chordcodes[0] && code != sel->chordcodes[1])) return 0;
+	KeyCode other = sel->chordcodes[code == sel->chordcodes[0]];
+	sel->swallowed[other/8] |= 1 << other%8;
+	sel->chorded = NULL;
+	sel->selchan = sel->keychan[code];
+	if (c->releasefunc) c->releasefunc(&c->releasearg);
+	return 1;
+}
+
+// flushchord dispatches the held-back key press, on the channel it was
+// pressed on.
+static void
+flushchord(long long now)
+{
+	KeyCode code = sel->chordcode;
+	sel->chordcode = 0;
+	long long waited = now - sel->chordpressed;
+	sel->chordwaits++;
+	sel->chordwaitusec += waited;
+	if (waited > sel->chordwaitmax) sel->chordwaitmax = waited;
+	tracef("chord: held back %lldus; %ld held back, %lldus on average, %lldus at most",
+			waited, sel->chordwaits, sel->chordwaitusec / sel->chordwaits, sel->chordwaitmax);
+	size_t ch = sel->selchan;
+	sel->selchan = sel->keychan[code];
+	dispatchpress(code);
+	sel->selchan = ch;
 }
 
 static void
 grabkeys()
 {
 	XUngrabKey(dpy, AnyKey, AnyModifier, root);
-	int nerr = 0;
-	for (size_t i = 0; i < LEN(keys); i++) {
-		if (!(keys[i].opts & GRAB)) continue;
-		int err = grabkey(&keys[i]);
-		if (err) nerr++;
-	}
+	Grab *newgrabs, *newnorepeats;
+	size_t nnewgrabs, nnewnorepeats;
+	keygrabs(cfg, &newgrabs, &nnewgrabs, &newnorepeats, &nnewnorepeats);
+	int nerr = regrab(newgrabs, nnewgrabs, newnorepeats, nnewnorepeats);
 	if (nerr) dief("grabkeys: failed to grab %d keys", nerr);
 }
 
+// keygrabs allocates and fills grabs with the keys that c needs grabbed, and
+// norepeats with the keys that need autorepeat disabled.
+static void
+keygrabs(Config *c, Grab **newgrabs, size_t *nnewgrabs, Grab **newnorepeats, size_t *nnewnorepeats)
+{
+	*newgrabs = calloc(c->nkeys + 1, sizeof **newgrabs);
+	*newnorepeats = calloc(c->nkeys + 1, sizeof **newnorepeats);
+	if (!*newgrabs || !*newnorepeats) die("keygrabs: out of memory");
+	*nnewgrabs = *nnewnorepeats = 0;
+	for (size_t i = 0; i < c->nkeys; i++) {
+		Key *key = &c->keys[i];
+		if (!(key->opts & (GRAB|NOREPEAT))) continue;
+		Grab g = {key->keysym, XKeysymToKeycode(dpy, key->keysym), key->mod};
+		if (key->opts & GRAB) (*newgrabs)[(*nnewgrabs)++] = g;
+		g.mod = 0;
+		if (key->opts & NOREPEAT && g.code) (*newnorepeats)[(*nnewnorepeats)++] = g;
+	}
+}
+
+// regrab makes newgrabs and newnorepeats current, taking ownership of them and
+// only ungrabbing and grabbing keys, or changing their autorepeat, where they
+// differ from the current ones. Returns the number of keys that couldn't be
+// grabbed.
 static int
-grabkey(Key *key)
+regrab(Grab *newgrabs, size_t nnewgrabs, Grab *newnorepeats, size_t nnewnorepeats)
 {
-	int err = 0;
-	char keystr[MAX_KEYSYM_DESC_LEN] = {0};
-	sprintkeysym(keystr, LEN(keystr), key->keysym, key->mod);
-	KeyCode code = XKeysymToKeycode(dpy, key->keysym);
-	if (!code) dief("grabkey: keysym %s has no bound keycode", keystr);
+	size_t max = sel->ngrabs;
+	if (nnewgrabs > max) max = nnewgrabs;
+	if (sel->nnorepeats > max) max = sel->nnorepeats;
+	if (nnewnorepeats > max) max = nnewnorepeats;
+	Grab *diff = calloc(max + 1, sizeof *diff);
+	if (!diff) die("regrab: out of memory");
 
-	int (*defaulthandler)(Display *, XErrorEvent *);
-	defaulthandler = XSetErrorHandler(saveerror);
+	int nerr = 0;
+	size_t n = grabdiff(sel->grabs, sel->ngrabs, newgrabs, nnewgrabs, diff);
+	for (size_t i = 0; i < n; i++) ungrabkey(&diff[i]);
+	n = grabdiff(newgrabs, nnewgrabs, sel->grabs, sel->ngrabs, diff);
+	nerr += grabkeyset(diff, n);
+	n = grabdiff(sel->norepeats, sel->nnorepeats, newnorepeats, nnewnorepeats, diff);
+	for (size_t i = 0; i < n; i++) setrepeat(diff[i].code, AutoRepeatModeOn);
+	n = grabdiff(newnorepeats, nnewnorepeats, sel->norepeats, sel->nnorepeats, diff);
+	for (size_t i = 0; i < n; i++) setrepeat(diff[i].code, AutoRepeatModeOff);
+
+	free(diff);
+	free(sel->grabs);
+	free(sel->norepeats);
+	sel->grabs = newgrabs;
+	sel->ngrabs = nnewgrabs;
+	sel->norepeats = newnorepeats;
+	sel->nnorepeats = nnewnorepeats;
+	return nerr;
+}
 
-	unsigned int modifiers[] = {0, numlockmask, LockMask, numlockmask|LockMask};
-	for (size_t j = 0; j < LEN(modifiers); j++) {
-		savederror.error_code = Success;
+// grabkeyset grabs each of the n keys in g, checking for errors with a
+// single round trip. Returns the number of keys that couldn't be grabbed.
+static int
+grabkeyset(Grab *g, size_t n)
+{
+	if (!n) return 0;
+	unsigned int modifiers[] = {0, sel->numlockmask, LockMask, sel->numlockmask|LockMask};
+	// Errors are matched to keys by the serial numbers of their requests.
+	unsigned long *serials = calloc(n, sizeof *serials);
+	int *failed = calloc(n, sizeof *failed);
+	if (!serials || !failed) die("grabkeyset: out of memory");
 
-		XGrabKey(dpy, code, key->mod | modifiers[j], root, False, GrabModeAsync, GrabModeAsync);
+	int (*defaulthandler)(Display *, XErrorEvent *);
+	defaulthandler = XSetErrorHandler(saveerror);
+	nsavederrors = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (!g[i].code) {
+			char keystr[MAX_KEYSYM_DESC_LEN] = {0};
+			sprintkeysym(keystr, LEN(keystr), g[i].keysym, g[i].mod);
+			jotf("grabkey: keysym %s has no bound keycode", keystr);
+			failed[i] = 1;
+			continue;
+		}
+		serials[i] = NextRequest(dpy);
+		for (size_t j = 0; j < LEN(modifiers); j++) {
+			XGrabKey(dpy, g[i].code, g[i].mod | modifiers[j], root, False, GrabModeAsync, GrabModeAsync);
+		}
+	}
+	XSync(dpy, False);
+	XSetErrorHandler(defaulthandler);
 
-		XSync(dpy, False);
-		if (savederror.error_code != Success
-		&& savederror.request_code == X_GrabKey
-		&& savederror.error_code == BadAccess) {
+	for (int e = 0; e < nsavederrors; e++) {
+		XErrorEvent *err = &savederrors[e];
+		size_t i = 0;
+		for (; i < n; i++) {
+			if (!serials[i]) continue;
+			if (err->serial >= serials[i] && err->serial < serials[i] + LEN(modifiers)) break;
+		}
+		if (i == n || failed[i]) continue;
+		failed[i] = 1;
+		char keystr[MAX_KEYSYM_DESC_LEN] = {0};
+		sprintkeysym(keystr, LEN(keystr), g[i].keysym, g[i].mod);
+		if (err->request_code == X_GrabKey && err->error_code == BadAccess) {
 			jotf("grabkey: %s already grabbed by another program", keystr);
-			err = 1;
-			break;
-		} else if (savederror.error_code != Success) {
+		} else {
 			jotf("grab key %s: unexpected X11 protocol error", keystr);
-			defaulthandler(dpy, &savederror); // Probably calls exit.
-			err = 1;
-			break;
+			defaulthandler(dpy, err); // Probably calls exit.
 		}
 	}
-	XSetErrorHandler(defaulthandler);
-	return err;
+	int nerr = 0;
+	for (size_t i = 0; i < n; i++) nerr += failed[i];
+	free(serials);
+	free(failed);
+	return nerr;
+}
+
+static void
+ungrabkey(Grab *g)
+{
+	unsigned int modifiers[] = {0, sel->numlockmask, LockMask, sel->numlockmask|LockMask};
+	for (size_t j = 0; j < LEN(modifiers); j++) {
+		XUngrabKey(dpy, g->code, g->mod | modifiers[j], root);
+	}
 }
 
 // setkeyrepeat sets the repeat mode of keys with the NOREPEAT option set to
@@ -474,48 +2356,230 @@ grabkey(Key *key)
 static void
 setkeyrepeat(int mode)
 {
-	for (size_t i = 0; i < LEN(keys); i++) {
-		if (!(keys[i].opts & NOREPEAT)) continue;
-		KeyCode code = XKeysymToKeycode(dpy, keys[i].keysym);
-		XKeyboardControl ctrl = {
-			.auto_repeat_mode=mode,
-			.key = code,
-		};
-		XChangeKeyboardControl(dpy, KBKey|KBAutoRepeatMode, &ctrl);
+	for (size_t i = 0; i < sel->nnorepeats; i++) {
+		setrepeat(sel->norepeats[i].code, mode);
+	}
+}
+
+static void
+setrepeat(KeyCode code, int mode)
+{
+	XKeyboardControl ctrl = {
+		.auto_repeat_mode=mode,
+		.key = code,
+	};
+	XChangeKeyboardControl(dpy, KBKey|KBAutoRepeatMode, &ctrl);
+}
+
+// defaultconfig sets c to the compiled-in settings, without any bindings.
+static void
+defaultconfig(Config *c)
+{
+	*c = compiledcfg;
+	c->internalmods = internalmods;
+	c->keys = NULL;
+	c->nkeys = 0;
+	c->layers = NULL;
+	c->nlayers = 0;
+}
+
+// watchconfig starts watching the config file for changes. The directory is
+// watched, since editors often replace files instead of writing them.
+static void
+watchconfig()
+{
+	inotifyfd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+	if (inotifyfd < 0) {
+		jotf("watch config: %s", strerror(errno));
+		return;
+	}
+	char dir[4096] = ".";
+	const char *slash = strrchr(configpath, '/');
+	if (slash) {
+		size_t len = slash == configpath ? 1 : (size_t)(slash - configpath);
+		if (len >= sizeof dir) die("watch config: path too long");
+		memcpy(dir, configpath, len);
+		dir[len] = '\0';
+	}
+	if (inotify_add_watch(inotifyfd, dir, IN_CLOSE_WRITE|IN_MOVED_TO) < 0) {
+		jotf("watch config %s: %s", dir, strerror(errno));
+		close(inotifyfd);
+		inotifyfd = -1;
+	}
+}
+
+// configchanged drains pending inotify events and returns nonzero if any of
+// them were for the config file.
+static int
+configchanged()
+{
+	const char *slash = strrchr(configpath, '/');
+	const char *base = slash ? slash + 1 : configpath;
+	int changed = 0;
+	long buf[4096 / sizeof(long)];
+	for (ssize_t n; (n = read(inotifyfd, buf, sizeof buf)) > 0;) {
+		for (char *p = (char *)buf; p < (char *)buf + n;) {
+			struct inotify_event ev;
+			memcpy(&ev, p, sizeof ev);
+			if (ev.len && !strcmp(p + sizeof ev, base)) changed = 1;
+			p += sizeof ev + ev.len;
+		}
+	}
+	return changed;
+}
+
+// reloadconfig parses the config file again and, if it's valid, swaps it in
+// between frames, only regrabbing keys whose bindings changed.
+static void
+reloadconfig()
+{
+	Config *c = malloc(sizeof *c);
+	if (!c) die("reload config: out of memory");
+	defaultconfig(c);
+	if (loadconfigfile(c, configpath) || badconfig(c)) {
+		jotf("reload config %s: keeping current config", configpath);
+		freeconfig(c);
+		free(c);
+		return;
+	}
+	for (size_t i = 0; i < nsessions; i++) {
+		selectsession(&sessions[i]);
+		Grab *newgrabs, *newnorepeats;
+		size_t nnewgrabs, nnewnorepeats;
+		keygrabs(c, &newgrabs, &nnewgrabs, &newnorepeats, &nnewnorepeats);
+		int nerr = regrab(newgrabs, nnewgrabs, newnorepeats, nnewnorepeats);
+		if (nerr) jotf("reload config: %s: failed to grab %d keys", DisplayString(dpy), nerr);
+		if (sel->iskeyboardgrabbed) {
+			XkbSetServerInternalMods(dpy, XkbUseCoreKbd,
+					cfg->internalmods|c->internalmods, c->internalmods, 0, 0);
+		}
+	}
+	Config *old = cfg;
+	cfg = c;
+	for (size_t i = 0; i < nsessions; i++) {
+		selectsession(&sessions[i]);
+		// Pushed layers and held keys refer to the old config.
+		sel->nlayerstack = 0;
+		memset(sel->pressed, 0, sizeof sel->pressed);
+		builddispatches();
+		resetlayers();
+		// Key releases might not match the presses they follow anymore.
+		resetmovement(NULL);
+	}
+	if (old != &compiledcfg) {
+		freeconfig(old);
+		free(old);
+	}
+	tracef("reloaded config %s", configpath);
+}
+
+// waitforwork blocks until there's an event from the xserver or the config
+// file changes, or for timeout ms if it's not negative. Unless isbusy, when
+// injected events are drained each frame anyway, it also wakes for them.
+static void
+waitforwork(int timeout, int isbusy)
+{
+	struct pollfd fds[MAX_DISPLAYS + 2];
+	nfds_t n = 0;
+	int ready = 0;
+	for (size_t i = 0; i < nsessions; i++) {
+		Session *s = &sessions[i];
+		if (XPending(s->dpy)) ready = 1;
+		// Producers only signal while we sleep, so check for events committed
+		// before they could see that.
+		if (!isbusy && s->engine.inject && injectsleep(s->engine.inject)) ready = 1;
+		fds[n++] = (struct pollfd){ConnectionNumber(s->dpy), POLLIN, 0};
+	}
+	if (inotifyfd >= 0) fds[n++] = (struct pollfd){inotifyfd, POLLIN, 0};
+	if (wakepipe[0] >= 0) fds[n++] = (struct pollfd){wakepipe[0], POLLIN, 0};
+	__atomic_store_n(&isidle, 1, __ATOMIC_RELAXED);
+	if (!ready && poll(fds, n, timeout) < 0 && errno != EINTR) {
+		dief("poll: %s", strerror(errno));
 	}
+	__atomic_store_n(&isidle, 0, __ATOMIC_RELAXED);
+	for (size_t i = 0; i < nsessions && !isbusy; i++) {
+		if (sessions[i].engine.inject) injectwake(sessions[i].engine.inject);
+	}
+	char buf[64];
+	while (wakepipe[0] >= 0 && read(wakepipe[0], buf, sizeof buf) > 0) {}
 }
 
 static void
 updatenumlockmask()
 {
 	XModifierKeymap *modmap = XGetModifierMapping(dpy);
-	numlockmask = 0;
+	sel->numlockmask = 0;
 	KeyCode target = XKeysymToKeycode(dpy, XK_Num_Lock);
 	for (int i = ShiftMapIndex; i <= Mod5MapIndex; i++) {
 		for (int j = 0; j < modmap->max_keypermod; j++) {
 			KeyCode code = modmap->modifiermap[i * modmap->max_keypermod + j];
-			if (code == target) numlockmask = (1 << i);
+			if (code == target) sel->numlockmask = (1 << i);
 		}
 	}
 	XFreeModifiermap(modmap);
 }
 
+// refreshmapping updates grabs, autorepeat settings, and dispatch tables after
+// the keyboard or modifier mapping changes, eg with xmodmap or setxkbmap. Only
+// keys whose keycodes changed are ungrabbed and grabbed again.
+static void
+refreshmapping(XMappingEvent *ev)
+{
+	if (ev->request == MappingPointer) return;
+	XRefreshKeyboardMapping(ev);
+	if (ev->request == MappingModifier) {
+		int old = sel->numlockmask;
+		updatenumlockmask();
+		if (sel->numlockmask != old) {
+			// Every grab includes numlockmask variants, so redo them all.
+			sel->numlockmask = old;
+			for (size_t i = 0; i < sel->ngrabs; i++) ungrabkey(&sel->grabs[i]);
+			updatenumlockmask();
+			sel->ngrabs = 0;
+		}
+	}
+	updatekeysyms();
+	builddispatches();
+	Grab *newgrabs, *newnorepeats;
+	size_t nnewgrabs, nnewnorepeats;
+	keygrabs(cfg, &newgrabs, &nnewgrabs, &newnorepeats, &nnewnorepeats);
+	int nerr = regrab(newgrabs, nnewgrabs, newnorepeats, nnewnorepeats);
+	if (nerr) jotf("refresh mapping: failed to grab %d keys", nerr);
+	tracef("refreshed mapping: request=%d", ev->request);
+}
+
 static void
 cleanup()
 {
-	if (iskeyboardgrabbed) ungrabkeyboard(NULL);
-	setkeyrepeat(AutoRepeatModeOn);
-	XFlush(dpy);
+	for (size_t i = 0; i < nsessions; i++) {
+		if (!sessions[i].dpy) continue;
+		selectsession(&sessions[i]);
+		if (sel->iskeyboardgrabbed) ungrabkeyboard(NULL);
+		setkeyrepeat(AutoRepeatModeOn);
+		XFlush(dpy);
+		if (sel->engine.inject) injectdestroy(sel->engine.inject, sel->injectname);
+		sel->engine.inject = NULL;
+		if (sel->state) statedestroy(sel->state, sel->statename);
+		sel->state = NULL;
+	}
 }
 
 static int
 saveerror(Display *dpy, XErrorEvent *ee)
 {
 	(void)dpy;
-	savederror = *ee;
+	if (nsavederrors < MAX_GRAB_ERRORS) savederrors[nsavederrors++] = *ee;
 	return 0;
 }
 
+static long long
+nowusec()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
 static void
 msleep(long ms)
 {
@@ -528,7 +2592,12 @@ msleep(long ms)
 void
 grabkeyboard(const Arg *keysym)
 {
-	XkbSetServerInternalMods(dpy, XkbUseCoreKbd, internalmods, internalmods, 0, 0);
+#ifdef XI2
+	// Core grabs act on the keyboard paired with the client pointer, so make
+	// that the keyboard the grab key was pressed on.
+	if (sel->channels[sel->selchan].ptr) XISetClientPointer(dpy, None, sel->channels[sel->selchan].ptr);
+#endif
+	XkbSetServerInternalMods(dpy, XkbUseCoreKbd, cfg->internalmods, cfg->internalmods, 0, 0);
 	XAutoRepeatOff(dpy);
 	int err = XGrabKeyboard(dpy, root, 0, GrabModeAsync, GrabModeAsync, CurrentTime);
 	int waited = 0;
@@ -539,6 +2608,7 @@ grabkeyboard(const Arg *keysym)
 		int interval = 10;
 		msleep(interval);
 		waited += interval;
+		__atomic_store_n(&heartbeat, heartbeat + 1, __ATOMIC_RELAXED);
 		err = XGrabKeyboard(dpy, root, 0, GrabModeAsync, GrabModeAsync, CurrentTime);
 	}
 	if (waited) {
@@ -556,7 +2626,7 @@ grabkeyboard(const Arg *keysym)
 		jotf("grab keyboard: %s", msg);
 		exit(1);
 	}
-	iskeyboardgrabbed = 1;
+	__atomic_store_n(&sel->iskeyboardgrabbed, 1, __ATOMIC_RELAXED);
 	if (keysym && keysym->ul) {
 		KeyCode code = XKeysymToKeycode(dpy, keysym->ul);
 		waitforrelease(code);
@@ -567,11 +2637,13 @@ void
 ungrabkeyboard(const Arg *ignored)
 {
 	(void)ignored;
-	XkbSetServerInternalMods(dpy, XkbUseCoreKbd, internalmods, 0, 0, 0);
+	XkbSetServerInternalMods(dpy, XkbUseCoreKbd, cfg->internalmods, 0, 0, 0);
 	XUngrabKeyboard(dpy, CurrentTime);
 	XKeyboardControl ctrl = {.auto_repeat_mode=AutoRepeatModeDefault};
 	XChangeKeyboardControl(dpy, KBAutoRepeatMode, &ctrl);
-	iskeyboardgrabbed = 0;
+	__atomic_store_n(&sel->iskeyboardgrabbed, 0, __ATOMIC_RELAXED);
+	sel->isgridding = 0;
+	resetlayers();
 	// Stop moving the pointer when the keyboard is ungrabbed, even if movement
 	// keys are pressed.
 	resetmovement(NULL);
@@ -581,7 +2653,7 @@ void
 togglegrabkeyboard(const Arg *ignored)
 {
 	(void)ignored;
-	if (iskeyboardgrabbed) {
+	if (sel->iskeyboardgrabbed) {
 		ungrabkeyboard(NULL);
 	} else {
 		grabkeyboard(NULL);
@@ -601,14 +2673,16 @@ void
 movestart(const Arg *dir)
 {
 	if (!dir) die("movestart: NULL arg");
-	startdir(&mvptr, dir->ui);
+	if (enginestartmove(&sel->engine, sel->selchan, dir->ui)) {
+		jotf("movestart: conflicting directions %#x", dir->ui & PK_DIRMASK);
+	}
 }
 
 void
 movestop(const Arg *dir)
 {
 	if (!dir) die("stop: NULL arg");
-	stopdir(&mvptr, dir->ui);
+	enginestopmove(&sel->engine, sel->selchan, dir->ui);
 }
 
 // move2scroll changes pointer movement into scrolling based on the given
@@ -618,17 +2692,7 @@ void
 move2scroll(const Arg *enable)
 {
 	if (!enable) die("move2scroll: NULL arg");
-	if (enable->i == ismove2scroll) return;
-	ismove2scroll = enable->i;
-	if (ismove2scroll) {
-		mvptr.basespeed = BASE_SCROLL;
-	} else {
-		mvptr.basespeed = BASE_SPEED;
-	}
-	mvptr.xrem = 0;
-	mvptr.yrem = 0;
-	mvptr.xcont = 0;
-	mvptr.ycont = 0;
+	enginesetm2s(&sel->engine, sel->selchan, enable->i);
 }
 
 // togglem2s toggles move2scroll behaviour.
@@ -636,7 +2700,7 @@ void
 togglem2s(const Arg *ignored)
 {
 	(void)ignored;
-	Arg arg = {.i=!ismove2scroll};
+	Arg arg = {.i=!sel->engine.ptr.isscroll[sel->selchan]};
 	move2scroll(&arg);
 }
 
@@ -644,56 +2708,340 @@ void
 scrollstart(const Arg *dir)
 {
 	if (!dir) die("scrollstart: NULL arg");
-	startdir(&mvscroll, dir->ui);
+	if (enginestartscroll(&sel->engine, sel->selchan, dir->ui)) {
+		jotf("scrollstart: conflicting directions %#x", dir->ui & PK_DIRMASK);
+	}
 }
 
 void
 scrollstop(const Arg *dir)
 {
 	if (!dir) die("scrollstop: NULL arg");
-	stopdir(&mvscroll, dir->ui);
+	enginestopscroll(&sel->engine, sel->selchan, dir->ui);
 }
 
 void
 multiplyspeed(const Arg *factor)
 {
 	if (!factor) die("multiplyspeed: NULL arg");
-	mvptr.mul *= factor->f;
-	mvscroll.mul *= factor->f;
+	enginemulspeed(&sel->engine, sel->selchan, factor->f);
 }
 
 void
 dividespeed(const Arg *factor)
 {
 	if (!factor) die("dividespeed: NULL arg");
-	mvptr.mul /= factor->f;
-	mvscroll.mul /= factor->f;
+	enginemulspeed(&sel->engine, sel->selchan, 1 / factor->f);
+}
+
+void
+snap(const Arg *dir)
+{
+	if (!dir) die("snap: NULL arg");
+	if (!sel->istopsindexed) indextoplevels();
+	unsigned int d = dir->ui & PK_DIRMASK;
+	if (!d) d = sel->engine.ptr.dir[sel->selchan];
+	int x, y;
+	if (!snaptarget(sel->tops, sel->ntops, sel->keyx, sel->keyy, d, &x, &y)) return;
+	warpto(sel->selchan, x, y);
+	// Warp before the next key press, whose position the next snap starts
+	// from.
+	XFlush(dpy);
+}
+
+// snapedge warps to the nearest edge on the screen, such as a window border
+// or splitter, in the direction dir, or the direction being moved, scanning
+// up to EDGE_REACH pixels of a screen capture around the pointer.
+void
+snapedge(const Arg *dir)
+{
+	if (!dir) die("snapedge: NULL arg");
+	long long start = nowusec();
+	unsigned int d = dir->ui & PK_DIRMASK;
+	if (!d) d = sel->engine.ptr.dir[sel->selchan];
+	int sx = (d & RIGHT) ? 1 : (d & LEFT) ? -1 : 0;
+	int sy = (d & DOWN) ? 1 : (d & UP) ? -1 : 0;
+	if (!sx && !sy) return;
+	int x = sel->keyx, y = sel->keyy, ox, oy;
+	XImage *img = capture(x, y, &ox, &oy);
+	if (!img) return;
+	int dx = sx ? sx * edgedistance(img, x - ox, y - oy, sx, 0) : 0;
+	int dy = sy ? sy * edgedistance(img, x - ox, y - oy, 0, sy) : 0;
+	releasecapture(img);
+	if (dx || dy) {
+		warpto(sel->selchan, x + dx, y + dy);
+		XFlush(dpy);
+	}
+	tracef("snapedge: moved %d, %d in %lldus", dx, dy, nowusec() - start);
+}
+
+void
+gridstart(const Arg *ignored)
+{
+	(void)ignored;
+	sel->gridregion = pointermonitor();
+	sel->isgridding = 1;
+	warptocenter(sel->gridregion);
+}
+
+void
+pushlayer(const Arg *layer)
+{
+	if (!layer) die("pushlayer: NULL arg");
+	if (layer->i < 0 || (size_t)layer->i >= cfg->nlayers) {
+		dief("pushlayer: layer %d out of range [0, %zu)", layer->i, cfg->nlayers);
+	}
+	if (sel->nlayerstack == MAX_LAYER_DEPTH) {
+		jotf("pushlayer: more than %d layers pushed", MAX_LAYER_DEPTH);
+		return;
+	}
+	sel->layerstack[sel->nlayerstack++] = layer->i + 1;
+	sel->dispatch = sel->dispatches[layer->i + 1];
+	sel->islatched = 0;
+	tracef("push layer %s", cfg->layers[layer->i].name);
+}
+
+void
+poplayer(const Arg *ignored)
+{
+	(void)ignored;
+	if (!sel->nlayerstack) return;
+	sel->nlayerstack--;
+	sel->dispatch = sel->dispatches[sel->nlayerstack ? sel->layerstack[sel->nlayerstack-1] : 0];
+	sel->islatched = 0;
+	trace("pop layer");
+}
+
+void
+latchlayer(const Arg *layer)
+{
+	pushlayer(layer);
+	sel->islatched = 1;
+}
+
+void
+setmark(const Arg *slot)
+{
+	PkMark *m = markslot(slot, "setmark");
+	*m = (PkMark){.isset=1, .win=None};
+	pointerposition(sel->selchan, &m->x, &m->y);
+}
+
+// setwinmark is like setmark, but the mark follows the focused window when it
+// moves. Mark positions are kept current by ConfigureNotify events, so jumping
+// to a mark doesn't have to ask the xserver where the window is.
+void
+setwinmark(const Arg *slot)
+{
+	PkMark *m = markslot(slot, "setwinmark");
+	setmark(slot);
+	Window focus;
+	int revert;
+	XGetInputFocus(dpy, &focus, &revert);
+	if (focus == None || focus == PointerRoot || focus == root) return;
+	Window top = toplevel(focus);
+	XWindowAttributes wa;
+	if (!top || !XGetWindowAttributes(dpy, top, &wa)) return;
+	if (!sel->istrackingwindows) {
+		XSelectInput(dpy, root, ROOTMASK|SubstructureNotifyMask);
+		sel->istrackingwindows = 1;
+	}
+	m->win = top;
+	m->wx = wa.x;
+	m->wy = wa.y;
+	m->x -= wa.x;
+	m->y -= wa.y;
+}
+
+void
+gotomark(const Arg *slot)
+{
+	PkMark *m = markslot(slot, "gotomark");
+	if (!m->isset) {
+		tracef("gotomark: mark %d not set", slot->i);
+		return;
+	}
+	warpto(sel->selchan, m->x + m->wx, m->y + m->wy);
 }
 
 void
 clickpress(const Arg *btn)
 {
 	if (!btn) die("clickpress: NULL arg");
-	XTestFakeButtonEvent(dpy, btn->ui, True, CurrentTime);
+	click(btn->ui, True);
 }
 
 void
 clickrelease(const Arg *btn)
 {
 	if (!btn) die("clickrelease: NULL arg");
-	XTestFakeButtonEvent(dpy, btn->ui, False, CurrentTime);
+	click(btn->ui, False);
+}
+
+// click sends a button event for the selected channel right away instead of
+// at the end of the frame. Movement up to now is applied first, so the click
+// lands where the pointer would be if the frame had just run.
+static void
+click(unsigned int button, Bool press)
+{
+	updatesession(nowusec(), 0);
+	fakebutton(sel->selchan, button, press, 0);
+	XFlush(dpy);
+}
+
+// doubleclick clicks btn twice, with the xserver spacing the clicks
+// MULTICLICK_MS apart so the timing doesn't depend on when ptrkeys runs.
+void
+doubleclick(const Arg *btn)
+{
+	if (!btn) die("doubleclick: NULL arg");
+	updatesession(nowusec(), 0);
+	for (int i = 0; i < 2; i++) {
+		fakebutton(sel->selchan, btn->ui, True, i ? MULTICLICK_MS : 0);
+		fakebutton(sel->selchan, btn->ui, False, 0);
+	}
+	XFlush(dpy);
+}
+
+// togglerecording starts recording a macro of the pointer motion and button
+// events ptrkeys sends, replacing the last one, or stops recording.
+void
+togglerecording(const Arg *ignored)
+{
+	(void)ignored;
+	if (sel->isrecording) {
+		sel->isrecording = 0;
+		tracef("macro: recorded %zu steps", sel->macro.n);
+		return;
+	}
+	stopplayback();
+	sel->macro.n = 0;
+	for (size_t i = 0; i < sel->nchannels; i++) pointerposition(i, &sel->recx[i], &sel->recy[i]);
+	sel->recordstart = nowusec();
+	sel->isrecording = 1;
+	trace("macro: recording");
+}
+
+void
+playmacro(const Arg *speed)
+{
+	startplayback(speed, 0);
+}
+
+void
+playmacrowarps(const Arg *speed)
+{
+	startplayback(speed, 1);
+}
+
+static void
+startplayback(const Arg *speed, int collapse)
+{
+	if (!speed) die("playmacro: NULL arg");
+	sel->isrecording = 0;
+	stopplayback();
+	if (!sel->macro.n) return;
+	sel->plan = malloc(sel->macro.n * sizeof *sel->plan);
+	if (!sel->plan) die("playmacro: out of memory");
+	sel->nplan = pk_macroplan(&sel->macro, speed->f, collapse, sel->plan);
+	sel->played = 0;
+	sel->playstart = nowusec();
+	tracef("macro: playing %zu steps at %gx", sel->nplan, speed->f);
+}
+
+static void
+stopplayback()
+{
+	free(sel->plan);
+	sel->plan = NULL;
+	sel->nplan = sel->played = 0;
+}
+
+// record adds s to the macro being recorded, keeping track of where the
+// pointer ends up so the macro can be played back as warps.
+static void
+record(PkMacroStep s)
+{
+	int *x = &sel->recx[s.channel], *y = &sel->recy[s.channel];
+	if (s.op == PK_MACRO_MOVE) {
+		*x += s.dx;
+		*y += s.dy;
+	} else if (s.op == PK_MACRO_WARP) {
+		*x = s.x;
+		*y = s.y;
+	}
+	// The xserver keeps the pointer on the screen.
+	int scr = DefaultScreen(dpy);
+	if (*x < 0) *x = 0;
+	if (*y < 0) *y = 0;
+	if (*x >= DisplayWidth(dpy, scr)) *x = DisplayWidth(dpy, scr) - 1;
+	if (*y >= DisplayHeight(dpy, scr)) *y = DisplayHeight(dpy, scr) - 1;
+	s.x = *x;
+	s.y = *y;
+	s.usec = nowusec() - sel->recordstart;
+	if (pk_macroappend(&sel->macro, &s, MACRO_MAX_STEPS)) {
+		sel->isrecording = 0;
+		jotf("macro: recording stopped after %zu steps", sel->macro.n);
+	}
+}
+
+// replay sends the macro steps due before the end of the frame starting at
+// now. The xserver times them using XTest delays on delaydpy, so they're
+// pipelined with no round trips and ptrkeys doesn't wake for each one.
+// Without delaydpy, only the steps already due are sent. Returns nonzero if
+// there are steps left.
+static int
+replay(long long now, int framems)
+{
+	Display *d = sel->delaydpy ? sel->delaydpy : dpy;
+	long long end = sel->delaydpy ? now + framems * 1000LL : now + 1;
+	long long last = now;
+	for (; sel->played < sel->nplan; sel->played++) {
+		const PkMacroStep *s = &sel->plan[sel->played];
+		long long due = sel->playstart + s->usec;
+		if (due >= end) break;
+		if (s->channel >= sel->nchannels) continue;
+		unsigned long delay = 0;
+		if (due > last) {
+			delay = due/1000 - last/1000;
+			last = due;
+		}
+		playstep(d, s, sel->delaydpy ? delay : 0);
+	}
+	if (sel->played < sel->nplan) return 1;
+	stopplayback();
+	trace("macro: played");
+	return 0;
+}
+
+static void
+playstep(Display *d, const PkMacroStep *s, unsigned long delay)
+{
+	size_t ch = s->channel;
+	if (s->op == PK_MACRO_BUTTON) {
+		fakebuttonon(d, ch, s->button, s->press, delay);
+		return;
+	}
+	// Moves were recorded from warps, which the xserver doesn't accelerate,
+	// but it would accelerate relative XTest motion, so every step goes to
+	// where the pointer ended up.
+	int axes[2] = {s->x, s->y};
+#ifdef XI2
+	if (sel->channels[ch].xtest) {
+		XTestFakeDeviceMotionEvent(d, sel->channels[ch].xtest, False, 0, axes, 2, delay);
+		return;
+	}
+#endif
+	XTestFakeMotionEvent(d, -1, axes[0], axes[1], delay);
 }
 
 void
 resetmovement(const Arg *ignored)
 {
 	(void)ignored;
-	Movement zero = {.mul=1};
-	mvptr = zero;
-	mvptr.basespeed = BASE_SPEED;
-	mvscroll = zero;
-	mvscroll.basespeed = BASE_SCROLL;
-	ismove2scroll = 0;
+	stopplayback();
+	enginereset(&sel->engine, sel->nchannels);
+	applyapp();
 }
 
 void
@@ -702,3 +3050,14 @@ quit(const Arg *ignored)
 	(void)ignored;
 	quitting = 1;
 }
+
+void
+restart(const Arg *ignored)
+{
+	(void)ignored;
+	if (!restartargv) {
+		jot("restart: not enabled");
+		return;
+	}
+	isrestarting = 1;
+}
@@ -3,69 +3,111 @@
 
 #include <X11/Xlib.h>
 
+#include "engine.h"
+
+// Short names for the parts of libptrkeys that config.h uses.
+typedef PkArg Arg;
+typedef PkKey Key;
+typedef PkChord Chord;
+typedef PkProfile Profile;
+
+enum {
+	UP = PK_UP,
+	DOWN = PK_DOWN,
+	LEFT = PK_LEFT,
+	RIGHT = PK_RIGHT,
+};
+
+enum {
+	STALL_CLAMP = PK_STALL_CLAMP,
+	STALL_SPREAD = PK_STALL_SPREAD,
+	STALL_DROP = PK_STALL_DROP,
+};
+
+#define PROFILE(n) PK_PROFILE(n)
+
+// A Layer is a named set of bindings that can be pushed on top of the base
+// bindings while the keyboard is grabbed. Keys it doesn't bind fall through to
+// the base bindings.
 typedef struct {
-	double basespeed;
-	unsigned int dir;  // Bits from enum Direction, defined later.
-	double mul;
-	double xrem, yrem; // Subunit remainders.
-	int xcont, ycont; // Continuing a movement?
-} Movement;
-
-typedef union {
-	int i;
-	unsigned int ui;
-	unsigned long ul;
-	double f;
-	const void *v;
-} Arg;
+	const char *name;
+	Key *keys;
+	size_t nkeys;
+} Layer;
 
+// An AppProfile sets the speeds used while a window whose WM_CLASS class or
+// instance name is class has the focus. Zero speeds keep the configured ones.
 typedef struct {
-	unsigned int mod;
-	KeySym keysym;
-	unsigned int opts;
-	void (*pressfunc)(const Arg *);
-	const Arg pressarg;
-	void (*releasefunc)(const Arg *);
-	const Arg releasearg;
-} Key;
+	const char *class;
+	double basespeed, basescroll;
+	double mul; // Initial speed multiplier.
+} AppProfile;
+
+// Config holds the settings that can be loaded from a file at runtime.
+typedef struct {
+	Key *keys;
+	size_t nkeys;
+	unsigned int internalmods;
+	int fps;
+	double basespeed, basescroll;
+	Layer *layers;
+	size_t nlayers;
+} Config;
 
+void loadconfig(const char *path);
+void adddisplay(const char *name);
+void enableinject();
+void enablestate();
+void notifywhenready(int fd);
+void restartwith(char *argv[]);
 void setup();
 void runeventloop();
+void runbenchmark(int seconds);
 void dieifbadbindings();
 void waitforrelease(KeyCode keycode);
 
-// xserver connection
+// Connection to the xserver being handled.
 extern Display *dpy;
 extern Window root;
 
-// Pointer and scrolling movement.
-extern Movement mvptr;
-extern Movement mvscroll;
-extern int ismove2scroll;
+extern Config *cfg;
 
-extern int iskeyboardgrabbed;
 extern int quitting;
 
 
 // Exported for testing only:
 
-typedef struct {
-	int dx, dy;
-} PointerUpdate;
+void runonce();
 
+// A Grab is a key the xserver has been asked to deliver to ptrkeys.
 typedef struct {
-	int xevents, yevents;
-	unsigned int xbutton, ybutton;
-} ScrollUpdate;
-
-void startdir(Movement *m, unsigned int dir);
-void stopdir(Movement *m, unsigned int dir);
-PointerUpdate pointerupdate(Movement *m, int usec);
-ScrollUpdate scrollupdate(Movement *m, int usec);
+	KeySym keysym;
+	KeyCode code;
+	unsigned int mod;
+} Grab;
+
 void sprintkeysym(char *dst, size_t len, KeySym keysym, int mods);
 int strappend(char *dst, size_t dstlen, char *src);
+
+// A TopLevel is a child of the root window, as tracked for snapping.
+typedef struct {
+	Window win;
+	PkRegion r; // Including the border.
+	int ismapped;
+} TopLevel;
+
+int snaptarget(const TopLevel *tops, size_t n, int x, int y, unsigned int dir, int *tx, int *ty);
+int notchesdue(int events, int framems, int ms);
+int findappprofile(const AppProfile *apps, size_t n, const char *instance, const char *class);
+size_t grabdiff(const Grab *a, size_t alen, const Grab *b, size_t blen, Grab *out);
+int badconfig(Config *c);
+int badbindings(Key *keys, size_t len, size_t nlayers);
 int duplicate_bindings_exist(Key *keys, size_t len);
 int modified_key_with_release_func_exists(Key *keys, size_t len);
 int modified_ungrabbed_keys_exist(Key *keys, size_t len);
+int bad_profile_exists(Key *keys, size_t len, size_t nprofiles);
+int bad_layer_exists(Key *keys, size_t len, size_t nlayers);
+int bad_mark_exists(Key *keys, size_t len, size_t nmarks);
+int modified_layer_keys_exist(Layer *layer);
 
 #endif
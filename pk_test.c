@@ -51,157 +51,6 @@ test_strappend()
 	return rc;
 }
 
-int
-test_pointerupdate()
-{
-	int rc = 0;
-	double base = 100;
-	struct frame {
-		unsigned int startdirs, stopdirs;
-		double mul;
-		int usec;
-		PointerUpdate want;
-	};
-
-	struct frame each_dir_one_frame[] = {
-		{RIGHT, 0,     1, 1e6, {base,  0}},
-		{LEFT,  RIGHT, 1, 1e6, {-base, 0}},
-		{UP,    LEFT,  1, 1e6, {0,     -base}},
-		{DOWN,  UP,    1, 1e6, {0,     base}},
-		{0,     DOWN,  1, 1e6, {0,     0}},
-	};
-
-	struct frame subpixel_movements_add_up[] = {
-		{RIGHT, 0, 1, 3e3, {0, 0}},
-		{0,     0, 1, 3e3, {0, 0}},
-		{0,     0, 1, 3e3, {0, 0}},
-		{0,     0, 1, 3e3, {1, 0}},
-	};
-
-	struct frame big_and_small_multipliers[] = {
-		{RIGHT|UP,  0, 50,      10e3, {50, -50}},
-		{0,         0, 50,      10e3, {50, -50}},
-		{DOWN|LEFT, 0, 1.0/5.0, 10e3, {0,  0}},
-		{0,         0, 1.0/5.0, 10e3, {0,  0}},
-		{0,         0, 1.0/5.0, 10e3, {0,  0}},
-		{0,         0, 1.0/5.0, 10e3, {0,  0}},
-		{0,         0, 1.0/5.0, 10e3, {-1, 1}},
-	};
-
-	struct test {
-		struct frame *frames;
-		size_t len;
-	};
-	struct test tests[] = {
-		{each_dir_one_frame, LEN(each_dir_one_frame)},
-		{subpixel_movements_add_up, LEN(subpixel_movements_add_up)},
-		{big_and_small_multipliers, LEN(big_and_small_multipliers)},
-	};
-	Movement init = {base, 0, 1, 0, 0, 0, 0};
-	for (size_t i = 0; i < LEN(tests); i++) {
-		struct test test = tests[i];
-		Movement mv = init;
-		for (size_t j = 0; j < test.len; j++) {
-			struct frame frame = test.frames[j];
-			startdir(&mv, frame.startdirs);
-			stopdir(&mv, frame.stopdirs);
-			mv.mul = frame.mul;
-			PointerUpdate got = pointerupdate(&mv, frame.usec);
-			PointerUpdate want = frame.want;
-			if (got.dx != want.dx || got.dy != want.dy) {
-				rc = 1;
-				jotf("mv: base=%.2g dir=%u mul=%.2g xrem=%.2g yrem=%.2g xcont=%d ycont=%d",
-						mv.basespeed, mv.dir, mv.mul, mv.xrem, mv.yrem, mv.xcont, mv.ycont);
-				jotf("test=%zu frame=%zu got={dx=%d dy=%d}, want={dx=%d dy=%d}",
-						i, j, got.dx, got.dy, want.dx, want.dy);
-				break;
-			}
-		}
-	}
-	return rc;
-}
-
-int
-test_scrollupdate()
-{
-	int rc = 0;
-	double base = 10;
-	struct frame {
-		unsigned int startdirs, stopdirs;
-		double mul;
-		int usec;
-		ScrollUpdate want;
-	};
-
-	struct frame each_dir_one_frame[] = {
-		{RIGHT, 0,     1, 1e6, {base, 0,    SCROLLRIGHT, 0}},
-		{LEFT,  RIGHT, 1, 1e6, {base, 0,    SCROLLLEFT,  0}},
-		{UP,    LEFT,  1, 1e6, {0,    base, 0,           SCROLLUP}},
-		{DOWN,  UP,    1, 1e6, {0,    base, 0,           SCROLLDOWN}},
-		{0,     DOWN,  1, 1e6, {0,    0,    0,           0}},
-	};
-
-	struct frame event_distribution[] = {
-		// One event right away...
-		{RIGHT, 0, 1, 40e3,  {1, 0, SCROLLRIGHT, 0}},
-		{0,     0, 1, 40e3,  {0, 0, 0,           0}},
-		{0,     0, 1, 40e3,  {0, 0, 0,           0}},
-		{0,     0, 1, 40e3,  {0, 0, 0,           0}},
-		// ...one 2/base seconds = 200ms later.
-		{0,     0, 1, 40e3,  {1, 0, SCROLLRIGHT, 0}},
-		{0,     0, 1, 40e3,  {0, 0, 0,           0}},
-		// ...adding up to base*mul events happening in the first second.
-		{0,     0, 1, 760e3, {8, 0, SCROLLRIGHT, 0}},
-	};
-
-	struct frame big_and_small_multipliers[] = {
-		// base*mul = 10*20 = 200 events per second; 200 * 0.01s = 2
-		{RIGHT|UP,  0, 20,      10e3,  {2, 2, SCROLLRIGHT, SCROLLUP}},  
-		{0,         0, 20,      10e3,  {2, 2, SCROLLRIGHT, SCROLLUP}},  
-		// base/mul = 10/5 = 2 events per second
-		{DOWN|LEFT, 0, 1.0/5.0, 10e3,  {1, 1, SCROLLLEFT,  SCROLLDOWN}},
-		{0,         0, 1.0/5.0, 10e3,  {0, 0, 0,           0}},         
-		{0,         0, 1.0/5.0, 970e3, {0, 0, 0,           0}},
-		{0,         0, 1.0/5.0, 10e3,  {1, 1, SCROLLLEFT,  SCROLLDOWN}},
-	};
-
-	struct test {
-		struct frame *frames;
-		size_t len;
-	};
-	struct test tests[] = {
-		{each_dir_one_frame, LEN(each_dir_one_frame)},
-		{event_distribution, LEN(event_distribution)},
-		{big_and_small_multipliers, LEN(big_and_small_multipliers)},
-	};
-	Movement init = {base, 0, 1, 0, 0, 0, 0};
-	for (size_t i = 0; i < LEN(tests); i++) {
-		struct test test = tests[i];
-		Movement mv = init;
-		for (size_t j = 0; j < test.len; j++) {
-			struct frame frame = test.frames[j];
-			startdir(&mv, frame.startdirs);
-			stopdir(&mv, frame.stopdirs);
-			mv.mul = frame.mul;
-			ScrollUpdate got = scrollupdate(&mv, frame.usec);
-			ScrollUpdate want = frame.want;
-			if (got.xevents != want.xevents
-			|| got.yevents != want.yevents
-			|| (want.xevents && got.xbutton != want.xbutton)
-			|| (want.yevents && got.ybutton != want.ybutton)) {
-				rc = 1;
-				jotf("mv: base=%.2g dir=%u mul=%.2g xrem=%.2g yrem=%.2g xcont=%d ycont=%d",
-						mv.basespeed, mv.dir, mv.mul, mv.xrem, mv.yrem, mv.xcont, mv.ycont);
-				jotf("test=%zu frame=%zu got={x=%d xbut=%d y=%d ybut=%d}, want={x=%d xbut=%d y=%d ybut=%d}",
-						i, j,
-						got.xevents, got.xbutton, got.yevents, got.ybutton,
-						want.xevents, want.xbutton, want.yevents, want.ybutton);
-				break;
-			}
-		}
-	}
-	return rc;
-}
 int
 test_sprintkeysym()
 {
@@ -216,6 +65,7 @@ test_sprintkeysym()
 	struct test tests[] = {
 		{"a", XK_a, 0},
 		{"Shift+Control+Home", XK_Home, ShiftMask|ControlMask},
+		{"Control+0x1234", 0x1234, ControlMask}, // No name.
 		{"Shift+Lock+Control+Mod1+Mod2+Mod3+Mod4+Mod5+Hyper_R", XK_Hyper_R, allmods},
 	};
 	for (size_t i = 0; i < LEN(tests); i++) {
@@ -253,6 +103,14 @@ test_duplicate_bindings_exist()
 		{0, XK_w, 0, NULL, {0}, NULL, {0}},
 		{0, XK_w, 0, NULL, {0}, NULL, {0}},
 	};
+	Key dupe_far_apart[] = {
+		{0,         XK_a, 0,    NULL, {0}, NULL, {0}},
+		{0,         XK_b, 0,    NULL, {0}, NULL, {0}},
+		{Mod4Mask,  XK_c, GRAB, NULL, {0}, NULL, {0}},
+		{0,         XK_d, 0,    NULL, {0}, NULL, {0}},
+		{0,         XK_e, 0,    NULL, {0}, NULL, {0}},
+		{Mod4Mask,  XK_c, GRAB, NULL, {0}, NULL, {0}},
+	};
 	Key no_dupes_empty[] = {0};
 	struct test {
 		int wantdupes;
@@ -264,6 +122,7 @@ test_duplicate_bindings_exist()
 		{0, no_dupes_grabbed_mod, LEN(no_dupes_grabbed_mod)},
 		{0, no_dupes_ungrabbed_mod_and_nomod, LEN(no_dupes_ungrabbed_mod_and_nomod)},
 		{1, dupe_ungrabbed, LEN(dupe_ungrabbed)},
+		{1, dupe_far_apart, LEN(dupe_far_apart)},
 		{0, no_dupes_empty, LEN(no_dupes_empty)},
 	};
 	int rc = 0;
@@ -310,6 +169,116 @@ test_modified_key_with_release_func_exists()
 	return rc;
 }
 
+int
+test_grabdiff()
+{
+	int rc = 0;
+	Grab a[] = {{XK_w, 25, Mod4Mask}, {XK_Select, 66, 0}, {XK_v, 55, Mod4Mask}};
+	Grab b[] = {{XK_v, 55, Mod4Mask}, {XK_w, 25, 0}, {XK_Select, 66, 0}};
+	struct test {
+		Grab *a, *b;
+		size_t alen, blen;
+		size_t want[LEN(a)]; // Indexes into a.
+		size_t nwant;
+	};
+	struct test tests[] = {
+		{a, b, LEN(a), LEN(b), {0}, 1},  // Modifier changed.
+		{a, b, LEN(a), 0, {0, 1, 2}, 3},
+		{a, b, 0, LEN(b), {0}, 0},
+		{a, a, LEN(a), LEN(a), {0}, 0},
+	};
+	for (size_t i = 0; i < LEN(tests); i++) {
+		struct test test = tests[i];
+		Grab out[LEN(a)];
+		size_t n = grabdiff(test.a, test.alen, test.b, test.blen, out);
+		if (n != test.nwant) {
+			rc = 1;
+			jotf("test=%zu n=%zu want %zu", i, n, test.nwant);
+			continue;
+		}
+		for (size_t j = 0; j < n; j++) {
+			Grab want = test.a[test.want[j]];
+			if (out[j].code != want.code || out[j].mod != want.mod) {
+				rc = 1;
+				jotf("test=%zu grab=%zu got={%d %u} want={%d %u}",
+						i, j, out[j].code, out[j].mod, want.code, want.mod);
+			}
+		}
+	}
+	return rc;
+}
+
+int
+test_bad_profile_exists()
+{
+	Key in_range[] = {
+		{0, XK_w, 0, movestart, {.ui=UP|PROFILE(1)}, movestop, {.ui=UP}},
+		{0, XK_s, 0, scrollstart, {.ui=DOWN}, scrollstop, {.ui=DOWN}},
+	};
+	Key out_of_range[] = {
+		{0, XK_w, 0, scrollstart, {.ui=UP|PROFILE(2)}, scrollstop, {.ui=UP}},
+	};
+	// Only movement commands take a profile.
+	Key not_a_dir[] = {
+		{0, XK_j, 0, clickpress, {.ui=0xffffff}, NULL, {0}},
+	};
+	struct test {
+		int want;
+		Key *key;
+		size_t len;
+	};
+	struct test tests[] = {
+		{0, in_range, LEN(in_range)},
+		{1, out_of_range, LEN(out_of_range)},
+		{0, not_a_dir, LEN(not_a_dir)},
+	};
+	int rc = 0;
+	for (size_t i = 0; i < LEN(tests); i++) {
+		struct test test = tests[i];
+		int got = bad_profile_exists(test.key, test.len, 2);
+		if (got != test.want) {
+			jotf("test %zu: got=%d want=%d", i, got, test.want);
+			rc = 1;
+		}
+	}
+	return rc;
+}
+
+int
+test_bad_layer_exists()
+{
+	Key in_range[] = {
+		{0, XK_Tab, 0, pushlayer, {.i=1}, poplayer, {0}},
+		{0, XK_grave, 0, latchlayer, {.i=0}, NULL, {0}},
+	};
+	Key out_of_range[] = {
+		{0, XK_Tab, 0, pushlayer, {.i=2}, poplayer, {0}},
+	};
+	Key negative[] = {
+		{0, XK_Tab, 0, latchlayer, {.i=-1}, NULL, {0}},
+	};
+	struct test {
+		int want;
+		Key *key;
+		size_t len;
+	};
+	struct test tests[] = {
+		{0, in_range, LEN(in_range)},
+		{1, out_of_range, LEN(out_of_range)},
+		{1, negative, LEN(negative)},
+	};
+	int rc = 0;
+	for (size_t i = 0; i < LEN(tests); i++) {
+		struct test test = tests[i];
+		int got = bad_layer_exists(test.key, test.len, 2);
+		if (got != test.want) {
+			jotf("test %zu: got=%d want=%d", i, got, test.want);
+			rc = 1;
+		}
+	}
+	return rc;
+}
+
 int
 test_modified_ungrabbed_keys_exist()
 {
@@ -343,16 +312,122 @@ test_modified_ungrabbed_keys_exist()
 	return rc;
 }
 
+int
+test_findappprofile()
+{
+	int rc = 0;
+	AppProfile apps[] = {
+		{"firefox", 0, 28, 1},
+		{"FreeCAD", 400, 0, 1},
+		{"Navigator", 0, 0, 2},
+	};
+	struct test {
+		const char *instance, *class;
+		int want;
+	};
+	struct test tests[] = {
+		{"Navigator", "firefox", 0}, // Earlier profiles win.
+		{"freecad", "FreeCAD", 1},
+		{"xterm", "XTerm", -1},
+		{NULL, NULL, -1},
+	};
+	for (size_t i = 0; i < LEN(tests); i++) {
+		struct test test = tests[i];
+		int got = findappprofile(apps, LEN(apps), test.instance, test.class);
+		if (got != test.want) {
+			rc = 1;
+			jotf("test=%zu got=%d want=%d", i, got, test.want);
+		}
+	}
+	return rc;
+}
+
+int
+test_snaptarget()
+{
+	int rc = 0;
+	TopLevel tops[] = {
+		{1, {100, 0, 200, 100}, 1},
+		{2, {0, 300, 100, 100}, 1},
+		{3, {500, 0, 100, 100}, 0}, // Unmapped.
+	};
+	struct test {
+		int x, y;
+		unsigned int dir;
+		int ok, wantx, wanty;
+	};
+	struct test tests[] = {
+		{0, 50, RIGHT, 1, 100, 50},
+		{100, 50, RIGHT, 1, 200, 50}, // Already on an edge.
+		{299, 50, RIGHT, 0, 299, 50}, // Ignores the unmapped window.
+		{250, 50, LEFT, 1, 200, 50},
+		{50, 0, DOWN, 1, 50, 300},
+		{50, 399, UP, 1, 50, 350},
+		{50, 320, DOWN|RIGHT, 1, 99, 350}, // Both axes.
+		{400, 200, DOWN, 0, 400, 200},
+	};
+	for (size_t i = 0; i < LEN(tests); i++) {
+		struct test test = tests[i];
+		int x, y;
+		int ok = snaptarget(tops, LEN(tops), test.x, test.y, test.dir, &x, &y);
+		if (!ok != !test.ok || x != test.wantx || y != test.wanty) {
+			rc = 1;
+			jotf("test=%zu got=%d (%d, %d) want=%d (%d, %d)", i, ok, x, y,
+					test.ok, test.wantx, test.wanty);
+		}
+	}
+	return rc;
+}
+
+int
+test_notchesdue()
+{
+	int rc = 0;
+	struct test {
+		int events, framems;
+		int want[16];
+	};
+	struct test tests[] = {
+		{0, 16, {0}},
+		{1, 16, {1}},
+		{4, 16, {1, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 1}},
+		{3, 16, {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1}},
+		{20, 16, {2, 1, 1, 1, 2, 1, 1, 1, 2, 1, 1, 1, 2, 1, 1, 1}},
+		{3, 0, {3}}, // No time to spread them over.
+	};
+	for (size_t i = 0; i < LEN(tests); i++) {
+		struct test test = tests[i];
+		int total = 0;
+		for (int ms = 0; ms < 16; ms++) {
+			int got = notchesdue(test.events, test.framems, ms);
+			total += got;
+			if (got != test.want[ms]) {
+				rc = 1;
+				jotf("test=%zu ms=%d got=%d want=%d", i, ms, got, test.want[ms]);
+			}
+		}
+		if (total != test.events) {
+			rc = 1;
+			jotf("test=%zu sent %d of %d events", i, total, test.events);
+		}
+	}
+	return rc;
+}
+
 int
 main()
 {
 	prove_init();
 	prove_run(test_strappend);
 	prove_run(test_sprintkeysym);
-	prove_run(test_pointerupdate);
-	prove_run(test_scrollupdate);
 	prove_run(test_duplicate_bindings_exist);
 	prove_run(test_modified_key_with_release_func_exists);
 	prove_run(test_modified_ungrabbed_keys_exist);
+	prove_run(test_grabdiff);
+	prove_run(test_bad_profile_exists);
+	prove_run(test_bad_layer_exists);
+	prove_run(test_findappprofile);
+	prove_run(test_snaptarget);
+	prove_run(test_notchesdue);
 	prove_exit();
 }
@@ -3,17 +3,20 @@
 #include <setjmp.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
 
 #include "pk.h"
 #include "jot.h"
 
-#define USAGE "usage: ptrkeys [-d|--debug] [-h|--help] [--version]\n"
+#define USAGE "usage: ptrkeys [-c FILE] [-D DISPLAY]... [-i] [-s] [-n FD] [-b SECONDS] [-d|--debug] [-h|--help] [--version]\n"
 
 static void onsigint();
 static void setsighandler();
 
 int jottrace = 0;
 
+static char *configpath = NULL;
+static int benchseconds = 0;
 static sigjmp_buf jmpbuf;
 static volatile sig_atomic_t canjump;
 
@@ -40,7 +43,29 @@ static void
 parseargs(int argc, char *argv[])
 {
 	for (int i = 1; i < argc; i++) {
-		if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--debug")) {
+		if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+			configpath = argv[++i];
+		} else if (!strcmp(argv[i], "-D") && i + 1 < argc) {
+			adddisplay(argv[++i]);
+		} else if (!strcmp(argv[i], "-i")) {
+			enableinject();
+		} else if (!strcmp(argv[i], "-s")) {
+			enablestate();
+		} else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			char *end;
+			long fd = strtol(argv[++i], &end, 10);
+			if (*end || fd < 0 || fd > INT_MAX) {
+				fprintf(stderr, USAGE);
+				exit(1);
+			}
+			notifywhenready(fd);
+		} else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+			benchseconds = atoi(argv[++i]);
+			if (benchseconds <= 0) {
+				fprintf(stderr, USAGE);
+				exit(1);
+			}
+		} else if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--debug")) {
 			jottrace = 1;
 		} else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
 			fprintf(stdout, USAGE);
@@ -59,6 +84,8 @@ int
 main(int argc, char *argv[])
 {
 	parseargs(argc, argv);
+	restartwith(argv);
+	if (configpath) loadconfig(configpath);
 	dieifbadbindings();
 	setup();
 	setsighandler();
@@ -67,6 +94,10 @@ main(int argc, char *argv[])
 		exit(130);
 	}
 	canjump = 1;
+	if (benchseconds) {
+		runbenchmark(benchseconds);
+		exit(0);
+	}
 	runeventloop();
 	exit(0);
 }
@@ -0,0 +1,368 @@
+// Tests of the requests ptrkeys sends, and the round trips it waits for,
+// using the fake Xlib in fakex.c instead of an xserver.
+#include <string.h>
+#include <X11/Xlib.h>
+#include <X11/keysym.h>
+
+#include "pk.h"
+#include "command.h"
+#include "fakex.h"
+#include "prove.h"
+#include "jot.h"
+
+// Longer than WATCHDOG_MS in config.def.h, plus the watchdog's check interval.
+#define HOLD_MS 4500
+
+#define LEN(X) (sizeof X / sizeof X[0])
+
+int jottrace = 1;
+
+static void
+key(int type, KeySym keysym)
+{
+	XEvent ev = {0};
+	ev.xkey.type = type;
+	ev.xkey.window = root;
+	ev.xkey.root = root;
+	ev.xkey.keycode = fakexkeycode(keysym);
+	ev.xkey.same_screen = True;
+	fakexevent(dpy, &ev);
+}
+
+// lastof returns the index of the last request sent by name, or -1.
+static long
+lastof(const char *name)
+{
+	long last = -1;
+	for (long i = fakexfind(name, 0); i >= 0; i = fakexfind(name, i + 1)) last = i;
+	return last;
+}
+
+// Setting up grabs every key with a single round trip, after the grabs.
+// Relies on the log of setup, so must run first.
+int
+test_setup_grabs()
+{
+	int rc = 0;
+	long ungrab = fakexfind("XUngrabKey", 0);
+	long first = fakexfind("XGrabKey", 0);
+	long last = lastof("XGrabKey");
+	size_t ngrabs = fakexcount("XGrabKey");
+	if (ungrab < 0 || first < ungrab || !ngrabs || ngrabs % 4) {
+		jotf("ungrab=%ld first grab=%ld grabs=%zu", ungrab, first, ngrabs);
+		return 1;
+	}
+	size_t trips = fakexroundtrips(ungrab, last + 2);
+	if (trips != 1 || strcmp(fakexlog[last + 1].name, "XSync")) {
+		jotf("%zu round trips, then %s after the last grab", trips, fakexlog[last + 1].name);
+		rc = 1;
+	}
+	return rc;
+}
+
+// Each frame of a held movement costs exactly one warp and no round trips.
+int
+test_held_move()
+{
+	int rc = 0;
+	key(KeyPress, XK_Select);
+	key(KeyPress, XK_d);
+	runonce();
+	for (int frame = 0; frame < 3; frame++) {
+		fakexreset();
+		runonce();
+		if (nfakexlog != 1 || fakexcount("XWarpPointer") != 1) {
+			jotf("frame=%d: %zu requests, first %s", frame, nfakexlog,
+					nfakexlog ? fakexlog[0].name : "none");
+			rc = 1;
+			continue;
+		}
+		if (fakexlog[0].a <= 0 || fakexlog[0].b) {
+			jotf("frame=%d: warped by %d,%d", frame, fakexlog[0].a, fakexlog[0].b);
+			rc = 1;
+		}
+	}
+	key(KeyRelease, XK_d);
+	key(KeyRelease, XK_Select);
+	fakexreset();
+	runonce();
+	if (fakexcount("XUngrabKeyboard") != 1 || fakexroundtrips(0, nfakexlog)) {
+		jotf("release: %zu ungrabs, %zu round trips", fakexcount("XUngrabKeyboard"),
+				fakexroundtrips(0, nfakexlog));
+		rc = 1;
+	}
+	return rc;
+}
+
+// A click pressed in the middle of a move goes out as soon as it arrives,
+// before the next frame's warp.
+int
+test_click_midframe()
+{
+	int rc = 0;
+	key(KeyPress, XK_Select);
+	key(KeyPress, XK_d);
+	runonce();
+	fakexreset();
+	XEvent ev = {0};
+	ev.xkey.type = KeyPress;
+	ev.xkey.window = root;
+	ev.xkey.root = root;
+	ev.xkey.keycode = fakexkeycode(XK_space);
+	ev.xkey.same_screen = True;
+	fakexeventafter(dpy, &ev, 1000 / cfg->fps / 2);
+	runonce();
+	long click = fakexfind("XTestFakeButtonEvent", 0);
+	if (click < 0) click = fakexfind("XTestFakeDeviceButtonEvent", 0);
+	runonce();
+	long warp = fakexfind("XWarpPointer", click + 1);
+	if (click < 0 || warp < 0) {
+		jotf("click at %ld, next frame's warp at %ld", click, warp);
+		rc = 1;
+	}
+	key(KeyRelease, XK_space);
+	key(KeyRelease, XK_d);
+	key(KeyRelease, XK_Select);
+	runonce();
+	return rc;
+}
+
+// When a grabbed key moves to another keycode, only its grabs are redone: all
+// ungrabs go before the grabs, which are checked with one round trip.
+int
+test_remap_regrab()
+{
+	int rc = 0;
+	KeyCode code = fakexkeycode(XK_BackSpace);
+	fakexremap(XK_Select, code);
+	XEvent ev = {0};
+	ev.xmapping.type = MappingNotify;
+	ev.xmapping.request = MappingKeyboard;
+	ev.xmapping.first_keycode = code;
+	ev.xmapping.count = 1;
+	fakexevent(dpy, &ev);
+	fakexreset();
+	runonce();
+
+	// Select and Shift+Select, with and without NumLock and CapsLock.
+	size_t ungrabs = fakexcount("XUngrabKey"), grabs = fakexcount("XGrabKey");
+	long last = lastof("XUngrabKey"), first = fakexfind("XGrabKey", 0);
+	if (ungrabs != 8 || grabs != 8 || last > first) {
+		jotf("ungrabs=%zu grabs=%zu last ungrab=%ld first grab=%ld", ungrabs, grabs, last, first);
+		return 1;
+	}
+	for (long i = first; i >= 0; i = fakexfind("XGrabKey", i + 1)) {
+		if (fakexlog[i].a != code) {
+			jotf("grabbed keycode %d, want %d", fakexlog[i].a, code);
+			rc = 1;
+		}
+	}
+	size_t trips = fakexroundtrips(0, nfakexlog);
+	long sync = fakexfind("XSync", first);
+	if (trips != 1 || sync != lastof("XGrabKey") + 1) {
+		jotf("%zu round trips, sync at %ld", trips, sync);
+		rc = 1;
+	}
+	return rc;
+}
+
+// recordmove records a macro of the pointer moving right for frames frames
+// and returns where it ended up. The keyboard must be grabbed.
+static void
+recordmove(int frames, int *x, int *y)
+{
+	key(KeyPress, XK_z);
+	key(KeyRelease, XK_z);
+	key(KeyPress, XK_d);
+	for (int i = 0; i < frames; i++) runonce();
+	key(KeyRelease, XK_d);
+	key(KeyPress, XK_z);
+	key(KeyRelease, XK_z);
+	runonce();
+	Window w;
+	int wx, wy;
+	unsigned int mask;
+	XQueryPointer(dpy, root, &w, &w, x, y, &wx, &wy, &mask);
+}
+
+// ismotion returns nonzero if request i is faked motion.
+static int
+ismotion(size_t i)
+{
+	return !strcmp(fakexlog[i].name, "XTestFakeMotionEvent")
+			|| !strcmp(fakexlog[i].name, "XTestFakeRelativeMotionEvent")
+			|| !strcmp(fakexlog[i].name, "XTestFakeDeviceMotionEvent");
+}
+
+// isfakebutton returns nonzero if request i is a faked button event.
+static int
+isfakebutton(size_t i)
+{
+	return !strcmp(fakexlog[i].name, "XTestFakeButtonEvent")
+			|| !strcmp(fakexlog[i].name, "XTestFakeDeviceButtonEvent");
+}
+
+// Scroll events spread over a frame and macro steps wait in the xserver, so
+// they go on their own connection: nothing on the main one, such as a click,
+// is delayed.
+int
+test_scroll_click()
+{
+	int rc = 0;
+	int x, y;
+	key(KeyPress, XK_Select);
+	recordmove(5, &x, &y);
+	key(KeyPress, XK_v);
+	key(KeyRelease, XK_v);
+	key(KeyPress, XK_Shift_L);
+	key(KeyPress, XK_Control_L);
+	key(KeyPress, XK_s);
+	fakexreset();
+	for (int frame = 0; frame < 60; frame++) runonce();
+	key(KeyPress, XK_space);
+	runonce();
+	size_t delayed = 0, delayedmotion = 0;
+	long click = -1;
+	for (size_t i = 0; i < nfakexlog; i++) {
+		if (ismotion(i) && fakexlog[i].delay) delayedmotion++;
+		if (!isfakebutton(i) && !ismotion(i)) continue;
+		if (fakexlog[i].delay) delayed++;
+		if (fakexlog[i].dpy == dpy && fakexlog[i].delay) {
+			jotf("request %zu: delayed %lums on the main connection", i, fakexlog[i].delay);
+			rc = 1;
+		}
+		if (isfakebutton(i) && fakexlog[i].a == Button1 && fakexlog[i].b) click = i;
+	}
+	if (!delayed || !delayedmotion || click < 0 || fakexlog[click].dpy != dpy) {
+		jotf("%zu delayed requests, %zu of them motion, click at %ld", delayed, delayedmotion, click);
+		rc = 1;
+	}
+	key(KeyRelease, XK_space);
+	key(KeyRelease, XK_s);
+	key(KeyRelease, XK_Control_L);
+	key(KeyRelease, XK_Shift_L);
+	key(KeyRelease, XK_Select);
+	runonce();
+	return rc;
+}
+
+// Recorded moves are played back as absolute motion, which the xserver
+// doesn't accelerate, ending where the recording did.
+int
+test_playback_absolute()
+{
+	int rc = 0;
+	int x, y;
+	key(KeyPress, XK_Select);
+	recordmove(5, &x, &y);
+	fakexreset();
+	key(KeyPress, XK_v);
+	key(KeyRelease, XK_v);
+	for (int frame = 0; frame < 30; frame++) runonce();
+	long last = -1;
+	for (size_t i = 0; i < nfakexlog; i++) {
+		if (ismotion(i)) last = i;
+	}
+	if (last < 0 || fakexcount("XTestFakeRelativeMotionEvent")
+			|| fakexlog[last].a != x || fakexlog[last].b != y) {
+		jotf("last motion at %ld to %d,%d, want %d,%d", last,
+				last < 0 ? 0 : fakexlog[last].a, last < 0 ? 0 : fakexlog[last].b, x, y);
+		rc = 1;
+	}
+	key(KeyRelease, XK_Select);
+	runonce();
+	return rc;
+}
+
+// remapped has ptrkeys refresh its keysyms, dispatch tables, and grabs.
+static void
+remapped()
+{
+	XEvent ev = {0};
+	ev.xmapping.type = MappingNotify;
+	ev.xmapping.request = MappingKeyboard;
+	ev.xmapping.first_keycode = fakexkeycode(XK_y);
+	ev.xmapping.count = 1;
+	fakexevent(dpy, &ev);
+	runonce();
+}
+
+// An autorepeat of a key held back for a chord dispatches its press once, not
+// again for the repeat. y starts the default chord.
+int
+test_chord_repeat()
+{
+	static Key keys[] = {
+		{0, XK_Select, GRAB|NOREPEAT, grabkeyboard, {0}, ungrabkeyboard, {0}},
+		{0, XK_y, 0, clickpress, {.ui=BTNLEFT}, clickrelease, {.ui=BTNLEFT}},
+	};
+	Config *old = cfg;
+	Config c = *old;
+	c.keys = keys;
+	c.nkeys = LEN(keys);
+	c.layers = NULL;
+	c.nlayers = 0;
+	cfg = &c;
+	remapped();
+	key(KeyPress, XK_Select);
+	runonce();
+	fakexreset();
+	key(KeyPress, XK_y);
+	key(KeyPress, XK_y);
+	runonce();
+	size_t presses = 0;
+	for (size_t i = 0; i < nfakexlog; i++) {
+		if (isfakebutton(i) && fakexlog[i].a == Button1 && fakexlog[i].b) presses++;
+	}
+	key(KeyRelease, XK_y);
+	key(KeyRelease, XK_Select);
+	runonce();
+	cfg = old;
+	remapped();
+	if (presses != 1) {
+		jotf("%zu presses, want 1", presses);
+		return 1;
+	}
+	return 0;
+}
+
+// Holding the grab key for longer than the watchdog allows the event loop to
+// stall isn't a stall: if the watchdog thought it was, it would exit.
+// Leaves the keyboard grabbed, so must run last.
+int
+test_hold_grab_key()
+{
+	XEvent ev = {0};
+	ev.xkey.type = KeyPress;
+	ev.xkey.window = root;
+	ev.xkey.root = root;
+	ev.xkey.keycode = fakexkeycode(XK_w);
+	ev.xkey.state = Mod4Mask;
+	ev.xkey.same_screen = True;
+	fakexevent(dpy, &ev);
+	ev.xkey.type = KeyRelease;
+	fakexeventafter(dpy, &ev, HOLD_MS);
+	fakexreset();
+	runonce();
+	if (fakexcount("XGrabKeyboard") != 1 || XPending(dpy)) {
+		jotf("%zu keyboard grabs, %d events left", fakexcount("XGrabKeyboard"), XPending(dpy));
+		return 1;
+	}
+	return 0;
+}
+
+int
+main()
+{
+	setup();
+	prove_init();
+	prove_run(test_setup_grabs);
+	prove_run(test_held_move);
+	prove_run(test_click_midframe);
+	prove_run(test_remap_regrab);
+	prove_run(test_playback_absolute);
+	prove_run(test_scroll_click);
+	prove_run(test_chord_repeat);
+	prove_run(test_hold_grab_key);
+	prove_exit();
+}
@@ -14,7 +14,7 @@ for f in *_test; do
         rc=1
     fi
 
-    if valgrind --leak-check=full --error-exitcode=1 -q ./$f 2>> $log; then
+    if valgrind --leak-check=full --suppressions=valgrind.supp --error-exitcode=1 -q ./$f 2>> $log; then
         echo $f PASS
     else
         echo $f ERROR
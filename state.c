@@ -0,0 +1,154 @@
+// For syscall(2), which futexes need.
+#define _DEFAULT_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "state.h"
+
+#define MAX_READ_TRIES 1000 // Before giving up on a writer that died mid-write.
+
+
+// statecreate creates and maps the state file with the given shm_open(3)
+// name, replacing any left by a previous run. Returns NULL and sets errno on
+// error.
+PkStateFile *
+statecreate(const char *name)
+{
+	shm_unlink(name);
+	int fd = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0644);
+	if (fd < 0) return NULL;
+	if (ftruncate(fd, sizeof(PkStateFile))) goto fail;
+	PkStateFile *f = mmap(NULL, sizeof *f, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (f == MAP_FAILED) goto fail;
+	close(fd);
+	stateinit(f);
+	return f;
+fail:;
+	int err = errno;
+	close(fd);
+	shm_unlink(name);
+	errno = err;
+	return NULL;
+}
+
+// stateadopt maps the state file open at fd, which a writer that exec'd
+// created, to carry on publishing to its readers. Returns NULL and sets errno
+// on error.
+PkStateFile *
+stateadopt(int fd)
+{
+	struct stat st;
+	if (fstat(fd, &st)) return NULL;
+	if (st.st_size < (off_t)sizeof(PkStateFile)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	PkStateFile *f = mmap(NULL, sizeof *f, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (f == MAP_FAILED) return NULL;
+	if (f->magic != STATE_MAGIC || f->version != STATE_VERSION) {
+		munmap(f, sizeof *f);
+		errno = EINVAL;
+		return NULL;
+	}
+	return f;
+}
+
+void
+statedestroy(PkStateFile *f, const char *name)
+{
+	munmap(f, sizeof *f);
+	if (name) shm_unlink(name);
+}
+
+void
+stateinit(PkStateFile *f)
+{
+	memset(f, 0, sizeof *f);
+	f->version = STATE_VERSION;
+	__atomic_store_n(&f->magic, STATE_MAGIC, __ATOMIC_RELEASE);
+}
+
+// statepublish replaces the state with s and wakes readers waiting for a
+// change. There must only be one writer.
+void
+statepublish(PkStateFile *f, const PkState *s)
+{
+	unsigned int seq = __atomic_load_n(&f->seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&f->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&f->state, s, sizeof *s);
+	__atomic_store_n(&f->seq, seq + 2, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&f->changes, 1, __ATOMIC_RELEASE);
+	syscall(SYS_futex, &f->changes, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+// stateattach maps an existing state file read-only. Returns NULL and sets
+// errno on error.
+const PkStateFile *
+stateattach(const char *name)
+{
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) return NULL;
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(PkStateFile)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	PkStateFile *f = mmap(NULL, sizeof *f, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (f == MAP_FAILED) return NULL;
+	if (f->magic != STATE_MAGIC || f->version != STATE_VERSION) {
+		munmap(f, sizeof *f);
+		errno = EINVAL;
+		return NULL;
+	}
+	return f;
+}
+
+void
+statedetach(const PkStateFile *f)
+{
+	munmap((void *)f, sizeof *f);
+}
+
+// stateread copies a consistent snapshot of the state to s, and if changes
+// isn't NULL, the change count it's from, to pass to statewait. Returns
+// nonzero if the writer seems to have died while writing.
+int
+stateread(const PkStateFile *f, PkState *s, unsigned int *changes)
+{
+	for (int i = 0; i < MAX_READ_TRIES; i++) {
+		unsigned int n = __atomic_load_n(&f->changes, __ATOMIC_ACQUIRE);
+		unsigned int seq = __atomic_load_n(&f->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) continue;
+		memcpy(s, &f->state, sizeof *s);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&f->seq, __ATOMIC_RELAXED) != seq) continue;
+		if (changes) *changes = n;
+		return 0;
+	}
+	return -1;
+}
+
+// statewait sleeps until the state changes after the read that returned
+// changes, or for timeoutms if it's not negative. Returns nonzero on timeout.
+int
+statewait(const PkStateFile *f, unsigned int changes, int timeoutms)
+{
+	struct timespec ts = {timeoutms / 1000, timeoutms % 1000 * 1000000L};
+	while (__atomic_load_n(&f->changes, __ATOMIC_ACQUIRE) == changes) {
+		long rc = syscall(SYS_futex, &f->changes, FUTEX_WAIT, changes,
+				timeoutms < 0 ? NULL : &ts, NULL, 0);
+		if (rc && errno == ETIMEDOUT) return -1;
+	}
+	return 0;
+}
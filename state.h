@@ -0,0 +1,51 @@
+#ifndef STATE_H
+#define STATE_H
+// Shared-memory export of ptrkeys' state, for status bars and the like.
+//
+// ptrkeys -s publishes a PkState for each display it serves in a small file
+// named "/ptrkeys-state-DISPLAY", under a seqlock: readers copy it out with
+// stateread(), retrying if it changed meanwhile, so any number of them can
+// poll without system calls and the writer never waits on them. Readers that
+// would rather sleep can wait for the next change with statewait().
+
+#define STATE_MAGIC 0x706b7374 // "pkst"
+#define STATE_VERSION 1
+#define STATE_MAX_CHANNELS 8 // Same as the engine's PK_MAX_CHANNELS.
+#define STATE_LAYER_LEN 32
+
+typedef struct {
+	int ismove2scroll; // Movement keys scroll.
+	double ptrmul, scrollmul; // Speed multipliers.
+} PkStateChannel;
+
+typedef struct {
+	int iskeyboardgrabbed; // The bindings other than global hotkeys are active.
+	char layer[STATE_LAYER_LEN]; // Top of the layer stack, or "" for none.
+	unsigned int nchannels;
+	PkStateChannel channels[STATE_MAX_CHANNELS];
+	long chordwaits; // Key presses held back for chords that didn't come.
+	long long chordwaitusec, chordwaitmax; // How long, in total and at most.
+} PkState;
+
+typedef struct {
+	unsigned int magic, version;
+	unsigned int seq; // Odd while state is being written.
+	unsigned int changes; // Incremented after each change, for statewait.
+	PkState state;
+} PkStateFile;
+
+// Writer side.
+PkStateFile *statecreate(const char *name);
+PkStateFile *stateadopt(int fd);
+void statedestroy(PkStateFile *f, const char *name);
+void statepublish(PkStateFile *f, const PkState *s);
+
+// Reader side.
+const PkStateFile *stateattach(const char *name);
+void statedetach(const PkStateFile *f);
+int stateread(const PkStateFile *f, PkState *s, unsigned int *changes);
+int statewait(const PkStateFile *f, unsigned int changes, int timeoutms);
+
+void stateinit(PkStateFile *f);
+
+#endif
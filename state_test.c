@@ -0,0 +1,135 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "state.h"
+#include "prove.h"
+#include "jot.h"
+
+#define WRITES 100000
+
+int jottrace = 1;
+
+static PkStateFile *
+newstate()
+{
+	PkStateFile *f = malloc(sizeof *f);
+	if (!f) die("newstate: out of memory");
+	stateinit(f);
+	return f;
+}
+
+int
+test_state_roundtrip()
+{
+	int rc = 0;
+	PkStateFile *f = newstate();
+	PkState want = {.iskeyboardgrabbed = 1, .layer = "scroll", .nchannels = 1};
+	want.channels[0] = (PkStateChannel){1, 0.125, 4};
+	unsigned int before, after;
+	PkState got;
+	stateread(f, &got, &before);
+	statepublish(f, &want);
+	if (stateread(f, &got, &after)) {
+		rc = 1;
+		jot("read failed");
+	}
+	if (memcmp(&got, &want, sizeof got)) {
+		rc = 1;
+		jotf("got grabbed=%d layer=%s mul=%g", got.iskeyboardgrabbed, got.layer, got.channels[0].ptrmul);
+	}
+	if (after == before) {
+		rc = 1;
+		jot("change count didn't change");
+	}
+	// The change has already been seen, so there's nothing to wait for.
+	if (!statewait(f, after, 10)) {
+		rc = 1;
+		jot("statewait didn't time out");
+	}
+	if (statewait(f, before, 10)) {
+		rc = 1;
+		jot("statewait missed a change");
+	}
+	free(f);
+	return rc;
+}
+
+static void *
+writer(void *arg)
+{
+	PkStateFile *f = arg;
+	for (int i = 1; i <= WRITES; i++) {
+		PkState s = {.nchannels = i};
+		for (int ch = 0; ch < STATE_MAX_CHANNELS; ch++) s.channels[ch].ptrmul = i;
+		s.chordwaits = i;
+		statepublish(f, &s);
+	}
+	return NULL;
+}
+
+// Readers never see a half-written state.
+int
+test_state_torn()
+{
+	int rc = 0;
+	PkStateFile *f = newstate();
+	pthread_t t;
+	if (pthread_create(&t, NULL, writer, f)) die("pthread_create failed");
+	unsigned int last = 0;
+	while (last < WRITES) {
+		PkState s;
+		if (stateread(f, &s, NULL)) continue;
+		for (int ch = 0; ch < STATE_MAX_CHANNELS; ch++) {
+			if (s.channels[ch].ptrmul != s.nchannels) rc = 1;
+		}
+		if (s.chordwaits != (long)s.nchannels || s.nchannels < last) rc = 1;
+		if (rc) {
+			jotf("torn read: nchannels=%u chordwaits=%ld last=%u", s.nchannels, s.chordwaits, last);
+			break;
+		}
+		last = s.nchannels;
+	}
+	pthread_join(t, NULL);
+	free(f);
+	return rc;
+}
+
+// A writer that adopts the file its predecessor kept publishes to the same
+// readers.
+int
+test_state_adopt()
+{
+	int rc = 0;
+	FILE *tmp = tmpfile();
+	if (!tmp || ftruncate(fileno(tmp), sizeof(PkStateFile))) die("tmpfile failed");
+	int fd = fileno(tmp);
+	PkStateFile *reader = mmap(NULL, sizeof *reader, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (reader == MAP_FAILED) die("mmap failed");
+	stateinit(reader);
+	PkStateFile *f = stateadopt(fd);
+	if (!f) die("stateadopt failed");
+	PkState want = {.iskeyboardgrabbed = 1}, got;
+	statepublish(f, &want);
+	if (stateread(reader, &got, NULL) || !got.iskeyboardgrabbed) {
+		rc = 1;
+		jot("reader didn't see the adopter's state");
+	}
+	statedestroy(f, NULL);
+	munmap(reader, sizeof *reader);
+	fclose(tmp);
+	return rc;
+}
+
+int
+main()
+{
+	prove_init();
+	prove_run(test_state_roundtrip);
+	prove_run(test_state_torn);
+	prove_run(test_state_adopt);
+	prove_exit();
+}